@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "instr.h"
+
+// Image is header followed by code, all numbers are little-endian.
+//
+// header: "MCBC", u32 version, u32 code size in bytes
+// code:   u8 opcode followed by its operands, execution starts at offset 0
+//
+//   PUSH               i32 value
+//   PUSHR, POPR        u8  register
+//   PUSHM, POPM        u8  register, i32 offset
+//   CALL, JMP, Jcc     u32 code offset of target
+//   others             no operands
+//
+// superinstructions replace frequent sequences of translator output
+//
+//   ADDSP              i32 value                  PUSH n; PUSHR SP; ADD; POPR SP
+//                                                 PUSHR SP; PUSH n; SUB; POPR SP
+//   PUSHM2             u8  register, i32 offset,  PUSHM m1; PUSHM m2
+//                      u8  register, i32 offset
+//   ADDI, SUBI,        i32 value                  PUSH n; ADD
+//   MULI, DIVI
+//   JccI               i32 value, u32 target      PUSH n; Jcc
+//
+// registers are encoded as instr::Register
+
+namespace compiler {
+namespace bytecode {
+
+const char     MAGIC[]  = "MCBC";
+const uint32_t VERSION  = 2;
+
+const size_t HEADER_SIZE = 12;
+
+enum Opcode
+{
+    OPCODE_HLT   = 0x00,
+
+    OPCODE_PUSH  = 0x01,
+    OPCODE_PUSHR = 0x02,
+    OPCODE_POPR  = 0x03,
+    OPCODE_PUSHM = 0x04,
+    OPCODE_POPM  = 0x05,
+
+    OPCODE_ADD   = 0x10,
+    OPCODE_SUB   = 0x11,
+    OPCODE_MUL   = 0x12,
+    OPCODE_DIV   = 0x13,
+    OPCODE_POW   = 0x14,
+    OPCODE_SQR   = 0x15,
+
+    OPCODE_IN    = 0x20,
+    OPCODE_OUT   = 0x21,
+    OPCODE_DRAW  = 0x22,
+
+    OPCODE_CALL  = 0x30,
+    OPCODE_RET   = 0x31,
+    OPCODE_JMP   = 0x32,
+    OPCODE_JE    = 0x33,
+    OPCODE_JNE   = 0x34,
+    OPCODE_JA    = 0x35,
+    OPCODE_JB    = 0x36,
+    OPCODE_JAE   = 0x37,
+    OPCODE_JBE   = 0x38,
+
+    OPCODE_ADDSP  = 0x40,
+    OPCODE_PUSHM2 = 0x41,
+    OPCODE_ADDI   = 0x42,
+    OPCODE_SUBI   = 0x43,
+    OPCODE_MULI   = 0x44,
+    OPCODE_DIVI   = 0x45,
+    OPCODE_JEI    = 0x48,
+    OPCODE_JNEI   = 0x49,
+    OPCODE_JAI    = 0x4A,
+    OPCODE_JBI    = 0x4B,
+    OPCODE_JAEI   = 0x4C,
+    OPCODE_JBEI   = 0x4D,
+};
+
+// selects superinstructions, resolves labels to code offsets and writes binary image
+void write(instr::Program* program, FILE* stream);
+
+void log_stats();
+
+} // bytecode
+} // compiler
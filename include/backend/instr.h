@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "vector.h"
+
+#define PROGRAM_INITLIST            \
+    {                               \
+        .code   = VECTOR_INITLIST,  \
+        .labels = VECTOR_INITLIST,  \
+    }
+
+namespace compiler {
+namespace instr {
+
+enum Opcode
+{
+    OPCODE_LABEL,
+
+    OPCODE_PUSH,
+    OPCODE_PUSHR,
+    OPCODE_POPR,
+    OPCODE_PUSHM,
+    OPCODE_POPM,
+
+    OPCODE_ADD,
+    OPCODE_SUB,
+    OPCODE_MUL,
+    OPCODE_DIV,
+    OPCODE_POW,
+    OPCODE_SQR,
+
+    OPCODE_IN,
+    OPCODE_OUT,
+    OPCODE_DRAW,
+    OPCODE_HLT,
+
+    OPCODE_CALL,
+    OPCODE_RET,
+    OPCODE_JMP,
+    OPCODE_JE,
+    OPCODE_JNE,
+    OPCODE_JA,
+    OPCODE_JB,
+    OPCODE_JAE,
+    OPCODE_JBE,
+};
+
+enum Register
+{
+    REGISTER_NONE,
+    REGISTER_SP,
+    REGISTER_A0,
+    REGISTER_T0,
+};
+
+struct Instr
+{
+    Opcode   opcode;
+    int      imm;   // PUSH value or offset of memory operand
+    Register reg;   // PUSHR, POPR register or base of memory operand
+    size_t   label; // LABEL, jumps and CALL
+};
+
+struct Program
+{
+    Vector code;   // Instr
+    Vector labels; // char*, owned label names
+};
+
+void ctor(Program* program);
+
+void dtor(Program* program);
+
+// returns id of label with formatted name, adding it on first use
+size_t label(Program* program, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+const char* label_name(Program* program, size_t label);
+
+void emit(Program* program, Opcode opcode);
+
+void emit_imm(Program* program, Opcode opcode, int imm);
+
+void emit_reg(Program* program, Opcode opcode, Register reg);
+
+void emit_mem(Program* program, Opcode opcode, Register reg, int offset);
+
+void emit_label(Program* program, Opcode opcode, size_t label);
+
+Instr* instr_at(Program* program, size_t ind);
+
+bool is_jump(Opcode opcode);
+
+// control never reaches next instruction
+bool is_terminator(Opcode opcode);
+
+// conditional jump taken exactly when given one is not
+Opcode invert_jump(Opcode opcode);
+
+const char* opcode_str(Opcode opcode);
+
+const char* register_str(Register reg);
+
+// formats program in memory and writes it with single fwrite
+void write(Program* program, FILE* stream);
+
+} // instr
+} // compiler
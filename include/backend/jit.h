@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "regcode.h"
+
+#define JIT_INITLIST            \
+    {                           \
+        .code      = NULL,      \
+        .code_size = 0,         \
+    }
+
+// x86-64 machine code generated from regcode right in memory.
+//
+// Lowering is the one of x86 target: code before the first function
+// is entry, functions follow SysV ABI, slot s is at -4(s + 1)(%rbp).
+// Runtime lives in compiler itself and is called by absolute address,
+// runtime error unwinds back to run.
+
+namespace compiler {
+namespace jit {
+
+enum JitErr
+{
+    JIT_ERR_NONE,
+    JIT_ERR_MAP_FAIL,
+    JIT_ERR_BAD_ADDRESS,
+    JIT_ERR_DIV_BY_ZERO,
+    JIT_ERR_INPUT,
+};
+
+struct Jit
+{
+    uint8_t* code; // mapped read and execute only
+    size_t   code_size;
+};
+
+// encodes program and maps it as executable
+JitErr compile(Jit* jit, regcode::Program* program);
+
+// runs compiled program until HLT
+JitErr run(Jit* jit, FILE* in, FILE* out);
+
+void dtor(Jit* jit);
+
+const char* strerr(JitErr err);
+
+} // jit
+} // compiler
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "instr.h"
+
+namespace compiler {
+namespace layout {
+
+// threads jumps landing on jumps, inverts conditional jumps over JMP,
+// places blocks entered only by jump right after it, drops unreachable
+// code, unreferenced labels and jumps to next instruction
+void optimize(instr::Program* program);
+
+} // layout
+} // compiler
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "instr.h"
+
+namespace compiler {
+namespace peephole {
+
+// rewrites windows of adjacent instructions by rule table, rules are
+// matched on tail of output, so replacement is matched again with
+// instructions before it and single pass reaches fixpoint
+void optimize(instr::Program* program);
+
+void log_stats();
+
+} // peephole
+} // compiler
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vector.h"
+
+#define REGPROGRAM_INITLIST         \
+    {                               \
+        .code   = VECTOR_INITLIST,  \
+        .labels = VECTOR_INITLIST,  \
+    }
+
+// Three-address code for register VM, registers are frame slots.
+//
+// Slot s of function is cell FP + s: parameters and variables come
+// first in order of their ids, temporaries follow, then outgoing
+// arguments, which are parameters of callee frame starting at FP + frame.
+//
+// Image is header followed by code, all numbers are little-endian.
+//
+// header:  "MCRC", u32 version, u32 code size in bytes
+// code:    u8 opcode followed by its operands, execution starts at offset 0
+// operand: u8 kind (OPERAND_IMM or OPERAND_SLOT), i32 value or slot
+//
+//   MOV, SQR           dst, a
+//   ADD, SUB, MUL,     dst, a, b
+//   DIV, POW
+//   JMP                u32 target
+//   Jcc                a, b, u32 target
+//   CALL               dst, u32 target, u32 frame
+//   RET, OUT           a
+//   IN                 dst
+//   STORE              a (VRAM address), b
+//   DRAW, HLT          no operands
+//
+// dst is always slot, CALL writes returned value to it in caller frame
+
+namespace compiler {
+namespace regcode {
+
+const char     MAGIC[]  = "MCRC";
+const uint32_t VERSION  = 1;
+
+const size_t HEADER_SIZE = 12;
+
+enum Opcode
+{
+    OPCODE_LABEL = 0xFF, // not encoded
+    OPCODE_FUNC  = 0xFE, // not encoded, marks function entry for native targets
+
+    OPCODE_HLT   = 0x00,
+    OPCODE_MOV   = 0x01,
+
+    OPCODE_ADD   = 0x10,
+    OPCODE_SUB   = 0x11,
+    OPCODE_MUL   = 0x12,
+    OPCODE_DIV   = 0x13,
+    OPCODE_POW   = 0x14,
+    OPCODE_SQR   = 0x15,
+
+    OPCODE_IN    = 0x20,
+    OPCODE_OUT   = 0x21,
+    OPCODE_DRAW  = 0x22,
+    OPCODE_STORE = 0x23,
+
+    OPCODE_CALL  = 0x30,
+    OPCODE_RET   = 0x31,
+    OPCODE_JMP   = 0x32,
+    OPCODE_JE    = 0x33,
+    OPCODE_JNE   = 0x34,
+    OPCODE_JA    = 0x35,
+    OPCODE_JB    = 0x36,
+    OPCODE_JAE   = 0x37,
+    OPCODE_JBE   = 0x38,
+};
+
+enum OperandKind
+{
+    OPERAND_NONE,
+    OPERAND_IMM,
+    OPERAND_SLOT,
+    OPERAND_TEMP, // index among temporaries, resolved to slot at function end
+    OPERAND_ARG,  // index of outgoing argument, resolved to slot at function end
+};
+
+struct Operand
+{
+    OperandKind kind;
+    int32_t     val;
+};
+
+struct Instr
+{
+    Opcode  opcode;
+    Operand dst;
+    Operand a;
+    Operand b;
+    size_t  label;  // LABEL, FUNC, jumps and CALL
+    size_t  frame;  // CALL, slots of caller frame below callee one
+    size_t  params; // FUNC, number of parameters
+};
+
+struct Program
+{
+    Vector code;   // Instr
+    Vector labels; // char*, owned label names
+};
+
+void ctor(Program* program);
+
+void dtor(Program* program);
+
+// returns id of label with formatted name, adding it on first use
+size_t label(Program* program, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+const char* label_name(Program* program, size_t label);
+
+void emit(Program* program, Opcode opcode, Operand dst, Operand a, Operand b);
+
+void emit_label(Program* program, Opcode opcode, size_t label);
+
+// conditional jump on a and b
+void emit_branch(Program* program, Opcode opcode, Operand a, Operand b, size_t label);
+
+void emit_call(Program* program, Operand dst, size_t label);
+
+// precedes label of function taking params arguments
+void emit_func(Program* program, size_t label, size_t params);
+
+Instr* instr_at(Program* program, size_t ind);
+
+Operand imm(int32_t val);
+
+Operand slot(int32_t ind);
+
+bool operand_equal(Operand a, Operand b);
+
+const char* opcode_str(Opcode opcode);
+
+// textual listing, for inspection only
+void write_asm(Program* program, FILE* stream);
+
+// resolves labels to code offsets and writes binary image
+void write_image(Program* program, FILE* stream);
+
+} // regcode
+} // compiler
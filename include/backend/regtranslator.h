@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ast.h"
+#include "regcode.h"
+#include "translator.h"
+
+#define REG_TRANSLATOR_INITLIST             \
+    {                                       \
+        .astree      = NULL,                \
+        .file        = NULL,                \
+        .current_env = NULL,                \
+        .label_id    = 0,                   \
+        .format      = OUTPUT_FORMAT_ASM,   \
+        .program     = REGPROGRAM_INITLIST, \
+        .temps       = 0,                   \
+        .max_temps   = 0,                   \
+    }
+
+namespace compiler {
+
+struct RegTranslator {
+    ast::AST* astree;
+    FILE* file;
+
+    Env* current_env;
+
+    int label_id;
+
+    OutputFormat format;
+
+    regcode::Program program;
+
+    size_t temps;     // live temporaries of statement being emitted
+    size_t max_temps; // of current function
+};
+
+// lowers AST to three-address code for register VM and writes it
+void emit_register_program(RegTranslator* tr);
+
+// only fills tr->program, which is then owned by caller
+void lower_register_program(RegTranslator* tr);
+
+} // compiler
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdio.h>
+
+#define TEXT_INITLIST       \
+    {                       \
+        .buf  = NULL,       \
+        .size = 0,          \
+        .cap  = 0,          \
+    }
+
+namespace compiler {
+namespace text {
+
+// assembly text, written to stream at once
+struct Text
+{
+    char*  buf;
+    size_t size;
+    size_t cap;
+};
+
+void reserve(Text* text, size_t add);
+
+void put_str(Text* text, const char* str);
+
+// same as %d, or %+d when sign is forced
+void put_int(Text* text, int val, bool force_sign);
+
+// writes text with single fwrite and frees it
+void flush(Text* text, FILE* stream);
+
+} // text
+} // compiler
@@ -1,17 +1,27 @@
 #pragma once
 
 #include "ast.h"
+#include "instr.h"
 
 #define TRANSLATOR_INILIST  \
     {                       \
         .astree = NULL,     \
         .file   = NULL,     \
         .current_env = NULL,\
-        .label_id = 0       \
+        .label_id = 0,      \
+        .format = OUTPUT_FORMAT_ASM, \
+        .program = PROGRAM_INITLIST \
     }
 
 namespace compiler {
 
+enum OutputFormat
+{
+    OUTPUT_FORMAT_ASM,
+    OUTPUT_FORMAT_BYTECODE,
+    OUTPUT_FORMAT_X86_64, // GNU assembler, register target only
+};
+
 struct Translator {
     ast::AST* astree;
     FILE* file;
@@ -19,6 +29,10 @@ struct Translator {
     Env* current_env;
 
     int label_id;
+
+    OutputFormat format;
+
+    instr::Program program; // filled by emit_program before it is written
 };
 
 void emit_program(Translator* tr);
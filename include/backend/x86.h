@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "regcode.h"
+
+// GNU assembler for x86-64 Linux, AT&T syntax, lowered from regcode.
+//
+// Code before the first function becomes C main, functions follow
+// SysV ABI: first six arguments in registers, rest on stack, result
+// in eax. Slot s lives at -4(s + 1)(%rbp), values are 32-bit.
+//
+// in, out, ramset, draw, division and power go through small runtime
+// emitted with the program, so output builds with
+//
+//   cc prog.s -o prog -lm
+
+namespace compiler {
+namespace x86 {
+
+void write(regcode::Program* program, FILE* stream);
+
+// bytes of stack frame of function whose code starts at begin, 16-byte aligned
+size_t frame_size(regcode::Program* program, size_t begin, size_t params);
+
+} // x86
+} // compiler
@@ -16,6 +16,7 @@
         .to_delete   = VECTOR_INITLIST, \
         .envs        = VECTOR_INITLIST, \
         .current_env = NULL,            \
+        .names       = VECTOR_INITLIST, \
         .buf = {            \
             .ptr = NULL,    \
             .len = 0,       \
@@ -34,11 +35,12 @@ struct ASTNode
     
     token::Token token;
 
+    int cons_id; // hash-consing id of subtree, 0 if not interned
 };
 
 struct AST
 {
-    ASTNode* root;
+    ASTNode* root; // separator tree with function declarations in leaves
     size_t   size;
 
     Vector to_delete;
@@ -47,6 +49,8 @@ struct AST
     Env*   current_env;
     int    current_env_id;
 
+    Vector names; // char*, owned names of compiler generated symbols
+
     struct {
         char*   ptr;
         ssize_t len;
@@ -70,6 +74,10 @@ ASTNode* new_node(token::Token* token, ASTNode *left, ASTNode *right, ASTNode *p
 
 ASTNode* copy_subtree(AST* astree, ASTNode* node, ASTNode* parent);
 
+// links new_node into node's place under node's parent,
+// drops hash-consing ids of ancestors
+void replace_node(ASTNode* node, ASTNode* new_node);
+
 int add_enviroment(AST* astree, Env** enviroment);
 
 Env* get_enviroment(AST* astree, int env_id);
@@ -77,6 +85,35 @@ Env* get_enviroment(AST* astree, int env_id);
 // searches in [0, current_env_id]
 Env* find_enviroment(AST* astree, utils_str_t* str, SymbolType type);
 
+// statements hang off left side of SEMICOL chain
+ASTNode* statement_of(ASTNode* node);
+
+// links new_stmt into SEMICOL chain right before stmt
+void insert_statement_before(ASTNode* stmt, ASTNode* new_stmt);
+
+// unlinks stmt from SEMICOL chain and frees it, chain of single
+// statement is left with empty statement
+void remove_statement(ASTNode* stmt);
+
+// formats name of compiler generated symbol, astree owns the string
+utils_str_t new_name(AST* astree, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// adds variable with generated name, which can not clash with
+// user identifiers, returns token to build identifier nodes from
+token::Token new_temporary(AST* astree, int env_id);
+
+// pushes ASTNode* of every element of separator list
+// (call arguments, parameters) to list, left to right
+void collect_list(ASTNode* node, Vector* list);
+
+size_t count_nodes(ASTNode* node);
+
+bool holds_call(ASTNode* node);
+
+// true if evaluating subtree may stop the program:
+// division by anything but nonzero literal
+bool may_trap(ASTNode* node);
+
 void free_subtree(ASTNode* node);
 
 void mark_to_delete(AST* astree, ASTNode* node);
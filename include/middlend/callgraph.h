@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ast.h"
+#include "vector.h"
+
+namespace compiler {
+namespace callgraph {
+
+struct Function
+{
+    ast::ASTNode* node;
+    Vector        callees;   // size_t, indices of functions called directly
+    size_t        scc;       // index of strongly connected component
+    bool          recursive; // calls itself directly or through others
+    bool          reachable; // from main
+    bool          pure;      // no IN, OUT, RAMSET and calls only pure functions
+};
+
+struct CallGraph
+{
+    Vector functions; // Function, in program order
+    Vector order;     // size_t, indices with callees before callers
+    size_t scc_cnt;
+};
+
+// graph is snapshot, it is rebuilt after functions are added or calls change
+void ctor(CallGraph* graph, ast::AST* astree);
+
+void dtor(CallGraph* graph);
+
+Function* get_function(CallGraph* graph, size_t ind);
+
+size_t function_index(CallGraph* graph, Function* func);
+
+Function* find_function(CallGraph* graph, utils_str_t* name);
+
+bool is_main(ast::ASTNode* func);
+
+// unlinks and frees functions not reachable from main,
+// returns number of removed ones
+size_t remove_unreachable(ast::AST* astree);
+
+} // callgraph
+} // compiler
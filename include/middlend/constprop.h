@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace constprop {
+
+// flow-sensitive propagation of constants and copies between variables
+// of function, returns true if any variable use was replaced
+bool propagate(ast::AST* astree);
+
+} // constprop
+} // compiler
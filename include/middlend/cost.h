@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ast.h"
+#include "token.h"
+
+namespace compiler {
+namespace cost {
+
+// roughly VM instructions translator emits, weighted by their price
+
+const long PUSH  = 1;
+const long PUSHM = 2;
+const long POPM  = 2;
+
+long operator_cost(token::OperatorType op_type, bool unary);
+
+long expression_cost(ast::ASTNode* node);
+
+} // cost
+} // compiler
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace cse {
+
+// value-numbers call-free expressions inside straight-line statement runs,
+// repeated ones are computed once into temporary and loaded afterwards
+void eliminate_common_subexpressions(ast::AST* astree);
+
+} // cse
+} // compiler
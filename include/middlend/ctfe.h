@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace ctfe {
+
+// runs calls of functions without IN, OUT and RAMSET with literal
+// arguments at compile time and replaces them with result, gives up
+// on calls exceeding step or depth budget, returns true if any replaced
+bool evaluate_pure_calls(ast::AST* astree);
+
+} // ctfe
+} // compiler
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace dse {
+
+// removes assignments whose value is never read, right sides with calls
+// or traps are kept as expression statements, then drops unused frame slots
+void eliminate_dead_stores(ast::AST* astree);
+
+} // dse
+} // compiler
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace egraph {
+
+// saturates every call-free expression with algebraic rules and
+// replaces it with the cheapest equivalent under stack machine cost model
+void optimize_expressions(ast::AST* astree);
+
+} // egraph
+} // compiler
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "ast.h"
+#include "token.h"
 
 namespace compiler {
 
 int evaluate_operator(ast::ASTNode* node);
 
+int evaluate_operator_type(token::OperatorType op_type, int left, int right);
+
 } // compiler
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace hashcons {
+
+// structurally equal subtrees get equal ids; ids are cached in
+// ASTNode::cons_id and dropped by ast::replace_node on the path to root
+
+void ctor();
+
+// resets ids cached in tree
+void dtor(ast::ASTNode* root);
+
+int intern(ast::ASTNode* node);
+
+bool equal(ast::ASTNode* a, ast::ASTNode* b);
+
+void log_stats();
+
+} // hashcons
+} // compiler
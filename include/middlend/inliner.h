@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace inliner {
+
+// replaces calls of small non-recursive functions with copies of their
+// bodies working on fresh temporaries of caller, result is left in one
+void inline_calls(ast::AST* astree);
+
+} // inliner
+} // compiler
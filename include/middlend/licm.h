@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace licm {
+
+// moves call-free expressions whose operands are not assigned inside
+// WHILE into temporaries computed before the loop
+void hoist_loop_invariants(ast::AST* astree);
+
+} // licm
+} // compiler
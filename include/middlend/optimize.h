@@ -2,10 +2,20 @@
 
 #include "ast.h"
 
+#define OPTIMIZER_CONFIG_INITLIST \
+    {                             \
+        .egraph = false           \
+    }
+
 namespace compiler {
 namespace optimizer {
 
-void optimize(ast::AST* astree);
+struct Config
+{
+    bool egraph; // equality saturation over arithmetic expressions
+};
+
+void optimize(ast::AST* astree, const Config* config);
 
 } // optimizer
 } // compiler
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ast.h"
+#include "token.h"
+#include "vector.h"
+
+namespace compiler {
+namespace rewrite {
+
+/*
+ * Rule DSL, written in the same prefix form as the AST file:
+ *
+ *   (OP a b)   operator node, omitted children must be absent
+ *   {OP a b}   template only: folded to a literal at rewrite time
+ *   42         numeric literal
+ *   nil        absent child
+ *   ?x         captures any subtree
+ *   !x         captures subtree without calls and traps (may be dropped or duplicated)
+ *   #x         captures numeric literal, '#x:nz' additionally requires x != 0
+ *
+ * Repeated capture in pattern matches structurally equal subtree.
+ */
+
+enum PatternType
+{
+    PATTERN_TYPE_OPERATOR,
+    PATTERN_TYPE_FOLD,
+    PATTERN_TYPE_NUM,
+    PATTERN_TYPE_NIL,
+    PATTERN_TYPE_ANY,
+    PATTERN_TYPE_PURE,
+    PATTERN_TYPE_CONST,
+};
+
+enum Predicate
+{
+    PREDICATE_NONE,
+    PREDICATE_NONZERO,
+};
+
+struct Pattern
+{
+    PatternType         type;
+    token::OperatorType op_type;
+    int                 num;
+    int                 capture;
+    Predicate           predicate;
+
+    Pattern* left;
+    Pattern* right;
+};
+
+const int CAPTURE_CNT = 'z' - 'a' + 1;
+
+const size_t PATTERN_POOL_CAP = 64;
+
+// patterns are allocated into pool (vector of Pattern*), NULL on syntax error
+Pattern* parse_pattern(const char* str, Vector* pool);
+
+void free_patterns(Vector* pool);
+
+// parses rule table and compiles it into decision tree
+void ctor();
+
+void dtor();
+
+// rewrites subtree bottom-up until no rule matches, returns new subtree root
+ast::ASTNode* apply(ast::AST* astree, ast::ASTNode* node, bool* changed);
+
+void log_stats();
+
+} // rewrite
+} // compiler
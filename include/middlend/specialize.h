@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace specialize {
+
+// clones functions for literal arguments of call sites, literal parameters
+// become locals assigned on entry and calls pass only remaining ones,
+// returns true if any call site was retargeted
+bool specialize_functions(ast::AST* astree);
+
+} // specialize
+} // compiler
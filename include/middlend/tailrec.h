@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ast.h"
+
+namespace compiler {
+namespace tailrec {
+
+// rewrites functions whose self calls are all returned either as is or
+// combined by ADD/MUL with call-free expression into tail-recursive helper
+// carrying accumulator, original function becomes wrapper calling it
+void introduce_accumulators(ast::AST* astree);
+
+} // tailrec
+} // compiler
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+#define REG_MACHINE_INITLIST        \
+    {                               \
+        .code        = NULL,        \
+        .code_size   = 0,           \
+        .consts      = NULL,        \
+        .consts_size = 0,           \
+        .frame_size  = 0,           \
+        .memory      = NULL,        \
+        .calls       = NULL,        \
+        .ret         = 0,           \
+        .executed    = 0,           \
+        .in          = NULL,        \
+        .out         = NULL,        \
+    }
+
+namespace compiler {
+namespace regvm {
+
+// immediates are moved to constant pool on load, so every operand
+// is read the same way, as bases[base][off]
+enum Base
+{
+    BASE_CONST = 0,
+    BASE_FRAME = 1,
+};
+
+struct Operand
+{
+    uint8_t base;
+    int32_t off;
+};
+
+// pre-decoded instruction, jump targets are indices into code
+struct Instr
+{
+    const void* handler; // set by run, address of dispatch label
+    uint8_t     opcode;  // regcode::Opcode
+    Operand     dst;
+    Operand     a;
+    Operand     b;
+    uint32_t    target;
+    uint32_t    frame;   // CALL, offset of callee frame
+};
+
+struct Frame
+{
+    Instr*   ret;
+    int32_t* fp;
+    int32_t* dst;
+};
+
+struct Machine
+{
+    Instr* code;
+    size_t code_size;
+
+    int32_t* consts;
+    size_t   consts_size;
+
+    size_t frame_size; // highest slot used by any function plus one
+
+    int32_t* memory; // VRAM followed by frames
+    Frame*   calls;
+
+    int32_t ret; // last returned value
+
+    size_t executed;
+
+    FILE* in;
+    FILE* out;
+};
+
+vm::VmErr ctor(Machine* machine, FILE* in, FILE* out);
+
+void dtor(Machine* machine);
+
+// decodes regcode image, resolves byte offsets of jumps to instruction indices
+vm::VmErr load(Machine* machine, const uint8_t* image, size_t size);
+
+// runs loaded program from the first instruction until HLT
+vm::VmErr run(Machine* machine);
+
+} // regvm
+} // compiler
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MACHINE_INITLIST        \
+    {                           \
+        .code      = NULL,      \
+        .code_size = 0,         \
+        .memory    = NULL,      \
+        .stack     = NULL,      \
+        .calls     = NULL,      \
+        .regs      = {},        \
+        .executed  = 0,         \
+        .in        = NULL,      \
+        .out       = NULL,      \
+    }
+
+namespace compiler {
+namespace vm {
+
+// cells below VRAM_BASE are reserved, ramset writes to VRAM_BASE + address
+const size_t VRAM_BASE   = 20;
+const size_t VRAM_WIDTH  = 100;
+const size_t VRAM_HEIGHT = 100;
+
+// frames grow upwards starting right after VRAM
+const size_t MEMORY_SIZE = 1 << 20;
+const size_t STACK_SIZE  = 1 << 16;
+const size_t CALL_DEPTH  = 1 << 16;
+
+enum VmErr
+{
+    VM_ERR_NONE,
+    VM_ERR_ALLOC_FAIL,
+    VM_ERR_BAD_IMAGE,
+    VM_ERR_BAD_ADDRESS,
+    VM_ERR_STACK_OVERFLOW,
+    VM_ERR_STACK_UNDERFLOW,
+    VM_ERR_CALL_OVERFLOW,
+    VM_ERR_DIV_BY_ZERO,
+    VM_ERR_INPUT,
+};
+
+// pre-decoded instruction, jump targets are indices into code
+struct Instr
+{
+    const void* handler; // set by run, address of dispatch label
+    uint8_t     opcode;  // bytecode::Opcode
+    uint8_t     reg;
+    uint8_t     reg2;    // second memory operand of PUSHM2
+    int32_t     arg;     // value, memory offset or target
+    int32_t     arg2;    // second memory offset or value compared by JccI
+};
+
+struct Machine
+{
+    Instr* code;
+    size_t code_size;
+
+    int32_t* memory;
+    int32_t* stack;
+    Instr**  calls;
+
+    int32_t regs[4]; // indexed by instr::Register
+
+    size_t executed;
+
+    FILE* in;
+    FILE* out;
+};
+
+VmErr ctor(Machine* machine, FILE* in, FILE* out);
+
+void dtor(Machine* machine);
+
+// decodes bytecode image, resolves byte offsets of jumps to instruction indices
+VmErr load(Machine* machine, const uint8_t* image, size_t size);
+
+// runs loaded program from the first instruction until HLT
+VmErr run(Machine* machine);
+
+// prints VRAM when anything was drawn
+void draw(const int32_t* memory, FILE* out);
+
+const char* strerr(VmErr err);
+
+} // vm
+} // compiler
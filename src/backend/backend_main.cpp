@@ -1,12 +1,16 @@
 #include <cstdlib>
 #include <error.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "ast.h"
 #include "ioutils.h"
+#include "jit.h"
 #include "optutils.h"
 #include "utils.h"
 #include "logutils.h"
+#include "regtranslator.h"
 #include "translator.h"
 
 ATTR_UNUSED static const char* LOG_OPT = "OPTIONS";
@@ -17,8 +21,14 @@ static utils_long_opt_t long_opts[] =
     { OPT_ARG_REQUIRED, "log",    NULL, 0, 0 },
     { OPT_ARG_REQUIRED, "in" ,    NULL, 0, 0 },
     { OPT_ARG_REQUIRED, "out" ,   NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "emit",   NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "target", NULL, 0, 0 },
 };
 
+static bool run_jit_(compiler::RegTranslator* tr);
+
+static double elapsed_ms_(struct timespec* begin, struct timespec* end);
+
 #ifdef _DEBUG
 
 static void log_html_style();
@@ -44,6 +54,9 @@ int main(int argc, char* argv[])
     Translator tr = TRANSLATOR_INILIST;
     tr.astree = &astree;
 
+    RegTranslator reg_tr = REG_TRANSLATOR_INITLIST;
+    reg_tr.astree = &astree;
+
     bool err_occured = false;
 
     BEGIN {
@@ -63,14 +76,36 @@ int main(int argc, char* argv[])
             GOTO_END;
         }
 
-        FILE* file_asm = open_file(long_opts[2].arg, "w");
-        if(!file_ast) {
+        // compiled to memory and run right away, nothing is written
+        if(long_opts[4].arg && !strcmp(long_opts[4].arg, "jit")) {
+            err_occured = !run_jit_(&reg_tr);
+            GOTO_END;
+        }
+
+        bool bytecode = long_opts[3].arg && !strcmp(long_opts[3].arg, "bytecode");
+        tr.format = bytecode ? OUTPUT_FORMAT_BYTECODE : OUTPUT_FORMAT_ASM;
+
+        FILE* file_asm = open_file(long_opts[2].arg, bytecode ? "wb" : "w");
+        if(!file_asm) {
             err_occured = true;
             GOTO_END;
         }
-        tr.file = file_asm;
 
-        emit_program(&tr);
+        // stack machine unless register one or native code is asked for
+        bool reg    = long_opts[4].arg && !strcmp(long_opts[4].arg, "reg");
+        bool x86_64 = long_opts[4].arg && !strcmp(long_opts[4].arg, "x86-64");
+
+        if(reg || x86_64) {
+            reg_tr.format = x86_64 ? OUTPUT_FORMAT_X86_64 : tr.format;
+            reg_tr.file   = file_asm;
+
+            emit_register_program(&reg_tr);
+        }
+        else {
+            tr.file = file_asm;
+
+            emit_program(&tr);
+        }
 
         fclose(file_asm);
 
@@ -83,6 +118,54 @@ int main(int argc, char* argv[])
     return err_occured ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+static bool run_jit_(compiler::RegTranslator* tr)
+{
+    using namespace compiler;
+
+    struct timespec begin   = {};
+    struct timespec compile = {};
+    struct timespec end     = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    lower_register_program(tr);
+
+    jit::Jit jit = JIT_INITLIST;
+    jit::JitErr err = jit::compile(&jit, &tr->program);
+
+    regcode::dtor(&tr->program);
+
+    clock_gettime(CLOCK_MONOTONIC, &compile);
+
+    if(err == jit::JIT_ERR_NONE) {
+        err = jit::run(&jit, stdin, stdout);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        fflush(stdout);
+
+        fprintf(stderr, "compiled %lu bytes in %.3f ms, ran in %.3f ms\n",
+                jit.code_size, elapsed_ms_(&begin, &compile), elapsed_ms_(&compile, &end));
+    }
+
+    jit::dtor(&jit);
+
+    if(err != jit::JIT_ERR_NONE) {
+        UTILS_LOGE(LOG_APP, "%s, exit...", jit::strerr(err));
+        return false;
+    }
+
+    return true;
+}
+
+static double elapsed_ms_(struct timespec* begin, struct timespec* end)
+{
+    const double ms_in_s  = 1e3;
+    const double ns_in_ms = 1e6;
+
+    return (double) (end->tv_sec - begin->tv_sec) * ms_in_s
+           + (double) (end->tv_nsec - begin->tv_nsec) / ns_in_ms;
+}
+
 #ifdef _DEBUG
 
 static void log_html_style()
@@ -0,0 +1,511 @@
+#include "bytecode.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "instr.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace bytecode {
+
+ATTR_UNUSED static const char* LOG_BYTECODE = "BYTECODE";
+
+// one encoded instruction, possibly covering several source instructions
+struct Item
+{
+    Opcode opcode;
+    size_t width;
+
+    int32_t imm;
+    uint8_t reg;
+    int32_t offset;
+    uint8_t reg2;
+    int32_t offset2;
+    size_t  label;
+};
+
+typedef bool (*MatchFunc) (instr::Instr* window, Item* item);
+
+struct Rule
+{
+    const char* name;
+    size_t      width;
+    MatchFunc   match;
+
+    size_t hits;
+};
+
+static bool frame_enter_   (instr::Instr* window, Item* item);
+static bool frame_leave_   (instr::Instr* window, Item* item);
+static bool push_mem_pair_ (instr::Instr* window, Item* item);
+static bool arith_imm_     (instr::Instr* window, Item* item);
+static bool branch_imm_    (instr::Instr* window, Item* item);
+
+#define MAKE_RULE(name, width, match) \
+    Rule { name, width, match, 0 }
+
+// chosen by dynamic pair frequencies on example programs
+static Rule rules_[] =
+{
+    MAKE_RULE("frame-enter"  , 4, frame_enter_  ),
+    MAKE_RULE("frame-leave"  , 4, frame_leave_  ),
+    MAKE_RULE("push-mem-pair", 2, push_mem_pair_),
+    MAKE_RULE("arith-imm"    , 2, arith_imm_    ),
+    MAKE_RULE("branch-imm"   , 2, branch_imm_   ),
+};
+
+#undef MAKE_RULE
+
+static Rule* select_(instr::Program* program, size_t ind, Item* item);
+
+static size_t encoded_size_(Opcode opcode);
+
+static uint8_t* encode_(uint8_t* pos, Item* item, size_t* label_offset);
+
+static Opcode encode_opcode_(instr::Opcode opcode);
+
+static Opcode with_imm_(instr::Opcode opcode);
+
+static bool is_reg_(instr::Instr* instr, instr::Opcode opcode, instr::Register reg);
+
+static uint8_t* put_u8_(uint8_t* pos, uint8_t val);
+
+static uint8_t* put_u32_(uint8_t* pos, uint32_t val);
+
+void write(instr::Program* program, FILE* stream)
+{
+    utils_assert(program);
+    utils_assert(stream);
+
+    Item item = {};
+
+    // first pass places labels
+    size_t* label_offset = TYPED_CALLOC(program->labels.size + 1, size_t);
+    utils_assert(label_offset);
+
+    size_t code_size = 0;
+    for(size_t i = 0; i < program->code.size; ) {
+        instr::Instr* instr = instr::instr_at(program, i);
+
+        if(instr->opcode == instr::OPCODE_LABEL) {
+            label_offset[instr->label] = code_size;
+            i++;
+            continue;
+        }
+
+        select_(program, i, &item);
+        code_size += encoded_size_(item.opcode);
+        i += item.width;
+    }
+
+    uint8_t* image = TYPED_CALLOC(HEADER_SIZE + code_size, uint8_t);
+    utils_assert(image);
+
+    uint8_t* pos = image;
+
+    memcpy(pos, MAGIC, sizeof(MAGIC) - 1);
+    pos += sizeof(MAGIC) - 1;
+    pos = put_u32_(pos, VERSION);
+    pos = put_u32_(pos, (uint32_t) code_size);
+
+    // second pass makes same selection and encodes with resolved jump targets
+    size_t items_cnt = 0;
+    for(size_t i = 0; i < program->code.size; ) {
+        if(instr::instr_at(program, i)->opcode == instr::OPCODE_LABEL) {
+            i++;
+            continue;
+        }
+
+        Rule* rule = select_(program, i, &item);
+        if(rule)
+            rule->hits++;
+
+        pos = encode_(pos, &item, label_offset);
+        i += item.width;
+        items_cnt++;
+    }
+
+    utils_assert((size_t)(pos - image) == HEADER_SIZE + code_size);
+
+    fwrite(image, 1, HEADER_SIZE + code_size, stream);
+
+    UTILS_LOGD(LOG_BYTECODE, "%lu instructions encoded as %lu in %lu bytes",
+               program->code.size, items_cnt, code_size);
+
+    NFREE(image);
+    NFREE(label_offset);
+}
+
+void log_stats()
+{
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        if(rules_[i].hits)
+            UTILS_LOGD(LOG_BYTECODE, "%-16s %lu hits", rules_[i].name, rules_[i].hits);
+    }
+}
+
+// returns matched rule or NULL when instruction is encoded alone
+static Rule* select_(instr::Program* program, size_t ind, Item* item)
+{
+    instr::Instr* instr = instr::instr_at(program, ind);
+
+    // labels are never matched, so jump targets stay on item boundaries
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        Rule* rule = &rules_[i];
+        if(ind + rule->width > program->code.size)
+            continue;
+
+        *item = {};
+        if(rule->match(instr, item)) {
+            item->width = rule->width;
+            return rule;
+        }
+    }
+
+    *item = {
+        .opcode  = encode_opcode_(instr->opcode),
+        .width   = 1,
+        .imm     = instr->imm,
+        .reg     = (uint8_t) instr->reg,
+        .offset  = instr->imm,
+        .reg2    = 0,
+        .offset2 = 0,
+        .label   = instr->label,
+    };
+
+    return NULL;
+}
+
+// PUSH n; PUSHR SP; ADD; POPR SP
+static bool frame_enter_(instr::Instr* window, Item* item)
+{
+    if(window[0].opcode != instr::OPCODE_PUSH
+       || !is_reg_(&window[1], instr::OPCODE_PUSHR, instr::REGISTER_SP)
+       || window[2].opcode != instr::OPCODE_ADD
+       || !is_reg_(&window[3], instr::OPCODE_POPR, instr::REGISTER_SP))
+        return false;
+
+    item->opcode = OPCODE_ADDSP;
+    item->imm    = window[0].imm;
+    return true;
+}
+
+// PUSHR SP; PUSH n; SUB or ADD; POPR SP
+static bool frame_leave_(instr::Instr* window, Item* item)
+{
+    if(!is_reg_(&window[0], instr::OPCODE_PUSHR, instr::REGISTER_SP)
+       || window[1].opcode != instr::OPCODE_PUSH
+       || (window[2].opcode != instr::OPCODE_SUB && window[2].opcode != instr::OPCODE_ADD)
+       || !is_reg_(&window[3], instr::OPCODE_POPR, instr::REGISTER_SP))
+        return false;
+
+    // negated as unsigned, wraps like VM arithmetic
+    uint32_t imm = (uint32_t) window[1].imm;
+    if(window[2].opcode == instr::OPCODE_SUB)
+        imm = 0u - imm;
+
+    item->opcode = OPCODE_ADDSP;
+    item->imm    = (int32_t) imm;
+    return true;
+}
+
+// PUSHM m1; PUSHM m2
+static bool push_mem_pair_(instr::Instr* window, Item* item)
+{
+    if(window[0].opcode != instr::OPCODE_PUSHM || window[1].opcode != instr::OPCODE_PUSHM)
+        return false;
+
+    item->opcode  = OPCODE_PUSHM2;
+    item->reg     = (uint8_t) window[0].reg;
+    item->offset  = window[0].imm;
+    item->reg2    = (uint8_t) window[1].reg;
+    item->offset2 = window[1].imm;
+    return true;
+}
+
+// PUSH n; ADD, SUB, MUL or DIV, division by 0 and -1 is left to DIV
+static bool arith_imm_(instr::Instr* window, Item* item)
+{
+    if(window[0].opcode != instr::OPCODE_PUSH)
+        return false;
+
+    switch(window[1].opcode) {
+        case instr::OPCODE_ADD:
+        case instr::OPCODE_SUB:
+        case instr::OPCODE_MUL:
+            break;
+
+        case instr::OPCODE_DIV:
+            if(window[0].imm == 0 || window[0].imm == -1)
+                return false;
+            break;
+
+        case instr::OPCODE_LABEL:
+        case instr::OPCODE_PUSH:
+        case instr::OPCODE_PUSHR:
+        case instr::OPCODE_POPR:
+        case instr::OPCODE_PUSHM:
+        case instr::OPCODE_POPM:
+        case instr::OPCODE_POW:
+        case instr::OPCODE_SQR:
+        case instr::OPCODE_IN:
+        case instr::OPCODE_OUT:
+        case instr::OPCODE_DRAW:
+        case instr::OPCODE_HLT:
+        case instr::OPCODE_CALL:
+        case instr::OPCODE_RET:
+        case instr::OPCODE_JMP:
+        case instr::OPCODE_JE:
+        case instr::OPCODE_JNE:
+        case instr::OPCODE_JA:
+        case instr::OPCODE_JB:
+        case instr::OPCODE_JAE:
+        case instr::OPCODE_JBE:
+        default:
+            return false;
+    }
+
+    item->opcode = with_imm_(window[1].opcode);
+    item->imm    = window[0].imm;
+    return true;
+}
+
+// PUSH n; Jcc
+static bool branch_imm_(instr::Instr* window, Item* item)
+{
+    if(window[0].opcode != instr::OPCODE_PUSH
+       || !instr::is_jump(window[1].opcode) || window[1].opcode == instr::OPCODE_JMP)
+        return false;
+
+    item->opcode = with_imm_(window[1].opcode);
+    item->imm    = window[0].imm;
+    item->label  = window[1].label;
+    return true;
+}
+
+static size_t encoded_size_(Opcode opcode)
+{
+    const size_t opcode_size = 1;
+    const size_t reg_size    = 1;
+    const size_t imm_size    = 4;
+
+    switch(opcode) {
+        case OPCODE_PUSH:
+        case OPCODE_CALL:
+        case OPCODE_JMP:
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+        case OPCODE_ADDSP:
+        case OPCODE_ADDI:
+        case OPCODE_SUBI:
+        case OPCODE_MULI:
+        case OPCODE_DIVI:
+            return opcode_size + imm_size;
+
+        case OPCODE_PUSHR:
+        case OPCODE_POPR:
+            return opcode_size + reg_size;
+
+        case OPCODE_PUSHM:
+        case OPCODE_POPM:
+            return opcode_size + reg_size + imm_size;
+
+        case OPCODE_PUSHM2:
+            return opcode_size + 2 * (reg_size + imm_size);
+
+        case OPCODE_JEI:
+        case OPCODE_JNEI:
+        case OPCODE_JAI:
+        case OPCODE_JBI:
+        case OPCODE_JAEI:
+        case OPCODE_JBEI:
+            return opcode_size + 2 * imm_size;
+
+        case OPCODE_HLT:
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+        case OPCODE_SQR:
+        case OPCODE_IN:
+        case OPCODE_OUT:
+        case OPCODE_DRAW:
+        case OPCODE_RET:
+        default:
+            return opcode_size;
+    }
+}
+
+static uint8_t* encode_(uint8_t* pos, Item* item, size_t* label_offset)
+{
+    pos = put_u8_(pos, (uint8_t) item->opcode);
+
+    switch(item->opcode) {
+        case OPCODE_PUSH:
+        case OPCODE_ADDSP:
+        case OPCODE_ADDI:
+        case OPCODE_SUBI:
+        case OPCODE_MULI:
+        case OPCODE_DIVI:
+            pos = put_u32_(pos, (uint32_t) item->imm);
+            break;
+
+        case OPCODE_PUSHR:
+        case OPCODE_POPR:
+            pos = put_u8_(pos, item->reg);
+            break;
+
+        case OPCODE_PUSHM:
+        case OPCODE_POPM:
+            pos = put_u8_ (pos, item->reg);
+            pos = put_u32_(pos, (uint32_t) item->offset);
+            break;
+
+        case OPCODE_PUSHM2:
+            pos = put_u8_ (pos, item->reg);
+            pos = put_u32_(pos, (uint32_t) item->offset);
+            pos = put_u8_ (pos, item->reg2);
+            pos = put_u32_(pos, (uint32_t) item->offset2);
+            break;
+
+        case OPCODE_CALL:
+        case OPCODE_JMP:
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+            pos = put_u32_(pos, (uint32_t) label_offset[item->label]);
+            break;
+
+        case OPCODE_JEI:
+        case OPCODE_JNEI:
+        case OPCODE_JAI:
+        case OPCODE_JBI:
+        case OPCODE_JAEI:
+        case OPCODE_JBEI:
+            pos = put_u32_(pos, (uint32_t) item->imm);
+            pos = put_u32_(pos, (uint32_t) label_offset[item->label]);
+            break;
+
+        case OPCODE_HLT:
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+        case OPCODE_SQR:
+        case OPCODE_IN:
+        case OPCODE_OUT:
+        case OPCODE_DRAW:
+        case OPCODE_RET:
+        default:
+            break;
+    }
+
+    return pos;
+}
+
+static Opcode encode_opcode_(instr::Opcode opcode)
+{
+    switch(opcode) {
+        case instr::OPCODE_PUSH:  return OPCODE_PUSH;
+        case instr::OPCODE_PUSHR: return OPCODE_PUSHR;
+        case instr::OPCODE_POPR:  return OPCODE_POPR;
+        case instr::OPCODE_PUSHM: return OPCODE_PUSHM;
+        case instr::OPCODE_POPM:  return OPCODE_POPM;
+        case instr::OPCODE_ADD:   return OPCODE_ADD;
+        case instr::OPCODE_SUB:   return OPCODE_SUB;
+        case instr::OPCODE_MUL:   return OPCODE_MUL;
+        case instr::OPCODE_DIV:   return OPCODE_DIV;
+        case instr::OPCODE_POW:   return OPCODE_POW;
+        case instr::OPCODE_SQR:   return OPCODE_SQR;
+        case instr::OPCODE_IN:    return OPCODE_IN;
+        case instr::OPCODE_OUT:   return OPCODE_OUT;
+        case instr::OPCODE_DRAW:  return OPCODE_DRAW;
+        case instr::OPCODE_HLT:   return OPCODE_HLT;
+        case instr::OPCODE_CALL:  return OPCODE_CALL;
+        case instr::OPCODE_RET:   return OPCODE_RET;
+        case instr::OPCODE_JMP:   return OPCODE_JMP;
+        case instr::OPCODE_JE:    return OPCODE_JE;
+        case instr::OPCODE_JNE:   return OPCODE_JNE;
+        case instr::OPCODE_JA:    return OPCODE_JA;
+        case instr::OPCODE_JB:    return OPCODE_JB;
+        case instr::OPCODE_JAE:   return OPCODE_JAE;
+        case instr::OPCODE_JBE:   return OPCODE_JBE;
+
+        case instr::OPCODE_LABEL:
+        default:
+            utils_assert(0 && "label has no encoding");
+            return OPCODE_HLT;
+    }
+}
+
+// form of arithmetic or conditional jump taking immediate right operand
+static Opcode with_imm_(instr::Opcode opcode)
+{
+    switch(opcode) {
+        case instr::OPCODE_ADD: return OPCODE_ADDI;
+        case instr::OPCODE_SUB: return OPCODE_SUBI;
+        case instr::OPCODE_MUL: return OPCODE_MULI;
+        case instr::OPCODE_DIV: return OPCODE_DIVI;
+        case instr::OPCODE_JE:  return OPCODE_JEI;
+        case instr::OPCODE_JNE: return OPCODE_JNEI;
+        case instr::OPCODE_JA:  return OPCODE_JAI;
+        case instr::OPCODE_JB:  return OPCODE_JBI;
+        case instr::OPCODE_JAE: return OPCODE_JAEI;
+        case instr::OPCODE_JBE: return OPCODE_JBEI;
+
+        case instr::OPCODE_LABEL:
+        case instr::OPCODE_PUSH:
+        case instr::OPCODE_PUSHR:
+        case instr::OPCODE_POPR:
+        case instr::OPCODE_PUSHM:
+        case instr::OPCODE_POPM:
+        case instr::OPCODE_POW:
+        case instr::OPCODE_SQR:
+        case instr::OPCODE_IN:
+        case instr::OPCODE_OUT:
+        case instr::OPCODE_DRAW:
+        case instr::OPCODE_HLT:
+        case instr::OPCODE_CALL:
+        case instr::OPCODE_RET:
+        case instr::OPCODE_JMP:
+        default:
+            utils_assert(0 && "no immediate form");
+            return OPCODE_HLT;
+    }
+}
+
+static bool is_reg_(instr::Instr* instr, instr::Opcode opcode, instr::Register reg)
+{
+    return instr->opcode == opcode && instr->reg == reg;
+}
+
+static uint8_t* put_u8_(uint8_t* pos, uint8_t val)
+{
+    *pos = val;
+    return pos + 1;
+}
+
+static uint8_t* put_u32_(uint8_t* pos, uint32_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        pos[i] = (uint8_t) (val >> (8 * i));
+
+    return pos + sizeof(val);
+}
+
+} // bytecode
+} // compiler
@@ -0,0 +1,312 @@
+#include "instr.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "memutils.h"
+#include "text.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace instr {
+
+void ctor(Program* program)
+{
+    utils_assert(program);
+
+    const size_t code_cap   = 256;
+    const size_t labels_cap = 32;
+    vector_ctor(&program->code,   code_cap,   sizeof(Instr));
+    vector_ctor(&program->labels, labels_cap, sizeof(char*));
+}
+
+void dtor(Program* program)
+{
+    utils_assert(program);
+
+    for(size_t i = 0; i < program->labels.size; ++i)
+        NFREE(*(char**)vector_at(&program->labels, i));
+
+    vector_dtor(&program->code);
+    vector_dtor(&program->labels);
+}
+
+size_t label(Program* program, const char* fmt, ...)
+{
+    utils_assert(program);
+    utils_assert(fmt);
+
+    const size_t name_size = 128;
+    char buffer[name_size] = "";
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, name_size, fmt, args);
+    va_end(args);
+
+    for(size_t i = 0; i < program->labels.size; ++i)
+        if(strcmp(*(char**)vector_at(&program->labels, i), buffer) == 0)
+            return i;
+
+    char* name = TYPED_CALLOC(strlen(buffer) + 1, char);
+    utils_assert(name);
+
+    strcpy(name, buffer);
+    vector_push(&program->labels, &name);
+
+    return program->labels.size - 1;
+}
+
+const char* label_name(Program* program, size_t label)
+{
+    utils_assert(program);
+
+    return *(char**)vector_at(&program->labels, label);
+}
+
+void emit(Program* program, Opcode opcode)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .imm = 0, .reg = REGISTER_NONE, .label = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_imm(Program* program, Opcode opcode, int imm)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .imm = imm, .reg = REGISTER_NONE, .label = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_reg(Program* program, Opcode opcode, Register reg)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .imm = 0, .reg = reg, .label = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_mem(Program* program, Opcode opcode, Register reg, int offset)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .imm = offset, .reg = reg, .label = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_label(Program* program, Opcode opcode, size_t label)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .imm = 0, .reg = REGISTER_NONE, .label = label };
+    vector_push(&program->code, &instr);
+}
+
+Instr* instr_at(Program* program, size_t ind)
+{
+    utils_assert(program);
+
+    return (Instr*)vector_at(&program->code, ind);
+}
+
+bool is_jump(Opcode opcode)
+{
+    switch(opcode) {
+        case OPCODE_JMP:
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+            return true;
+
+        case OPCODE_LABEL:
+        case OPCODE_PUSH:
+        case OPCODE_PUSHR:
+        case OPCODE_POPR:
+        case OPCODE_PUSHM:
+        case OPCODE_POPM:
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+        case OPCODE_SQR:
+        case OPCODE_IN:
+        case OPCODE_OUT:
+        case OPCODE_DRAW:
+        case OPCODE_HLT:
+        case OPCODE_CALL:
+        case OPCODE_RET:
+        default:
+            return false;
+    }
+}
+
+bool is_terminator(Opcode opcode)
+{
+    return opcode == OPCODE_JMP || opcode == OPCODE_RET || opcode == OPCODE_HLT;
+}
+
+Opcode invert_jump(Opcode opcode)
+{
+    switch(opcode) {
+        case OPCODE_JE:  return OPCODE_JNE;
+        case OPCODE_JNE: return OPCODE_JE;
+        case OPCODE_JA:  return OPCODE_JBE;
+        case OPCODE_JBE: return OPCODE_JA;
+        case OPCODE_JB:  return OPCODE_JAE;
+        case OPCODE_JAE: return OPCODE_JB;
+
+        case OPCODE_LABEL:
+        case OPCODE_PUSH:
+        case OPCODE_PUSHR:
+        case OPCODE_POPR:
+        case OPCODE_PUSHM:
+        case OPCODE_POPM:
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+        case OPCODE_SQR:
+        case OPCODE_IN:
+        case OPCODE_OUT:
+        case OPCODE_DRAW:
+        case OPCODE_HLT:
+        case OPCODE_CALL:
+        case OPCODE_RET:
+        case OPCODE_JMP:
+        default:
+            utils_assert(0 && "not a conditional jump");
+            return opcode;
+    }
+}
+
+const char* opcode_str(Opcode opcode)
+{
+    switch(opcode) {
+        case OPCODE_LABEL: return "";
+        case OPCODE_PUSH:  return "PUSH";
+        case OPCODE_PUSHR: return "PUSHR";
+        case OPCODE_POPR:  return "POPR";
+        case OPCODE_PUSHM: return "PUSHM";
+        case OPCODE_POPM:  return "POPM";
+        case OPCODE_ADD:   return "ADD";
+        case OPCODE_SUB:   return "SUB";
+        case OPCODE_MUL:   return "MUL";
+        case OPCODE_DIV:   return "DIV";
+        case OPCODE_POW:   return "POW";
+        case OPCODE_SQR:   return "SQR";
+        case OPCODE_IN:    return "IN";
+        case OPCODE_OUT:   return "OUT";
+        case OPCODE_DRAW:  return "DRAW";
+        case OPCODE_HLT:   return "HLT";
+        case OPCODE_CALL:  return "CALL";
+        case OPCODE_RET:   return "RET";
+        case OPCODE_JMP:   return "JMP";
+        case OPCODE_JE:    return "JE";
+        case OPCODE_JNE:   return "JNE";
+        case OPCODE_JA:    return "JA";
+        case OPCODE_JB:    return "JB";
+        case OPCODE_JAE:   return "JAE";
+        case OPCODE_JBE:   return "JBE";
+        default:           return "UNKNOWN";
+    }
+}
+
+const char* register_str(Register reg)
+{
+    switch(reg) {
+        case REGISTER_SP:   return "SP";
+        case REGISTER_A0:   return "A0";
+        case REGISTER_T0:   return "T0";
+        case REGISTER_NONE:
+        default:            return "NONE";
+    }
+}
+
+void write(Program* program, FILE* stream)
+{
+    utils_assert(program);
+    utils_assert(stream);
+
+    // most lines are shorter, buffer grows otherwise
+    const size_t line_len = 16;
+
+    text::Text text = TEXT_INITLIST;
+    text::reserve(&text, program->code.size * line_len);
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        switch(instr->opcode) {
+            case OPCODE_LABEL:
+                text::put_str(&text, "\n:");
+                text::put_str(&text, label_name(program, instr->label));
+                break;
+
+            case OPCODE_PUSH:
+                text::put_str(&text, "PUSH ");
+                text::put_int(&text, instr->imm, false);
+                break;
+
+            case OPCODE_PUSHR:
+            case OPCODE_POPR:
+                text::put_str(&text, opcode_str(instr->opcode));
+                text::put_str(&text, " ");
+                text::put_str(&text, register_str(instr->reg));
+                break;
+
+            case OPCODE_PUSHM:
+            case OPCODE_POPM:
+                text::put_str(&text, opcode_str(instr->opcode));
+                text::put_str(&text, " [");
+                text::put_str(&text, register_str(instr->reg));
+                text::put_int(&text, instr->imm, true);
+                text::put_str(&text, "]");
+                break;
+
+            case OPCODE_CALL:
+            case OPCODE_JMP:
+            case OPCODE_JE:
+            case OPCODE_JNE:
+            case OPCODE_JA:
+            case OPCODE_JB:
+            case OPCODE_JAE:
+            case OPCODE_JBE:
+                text::put_str(&text, opcode_str(instr->opcode));
+                text::put_str(&text, " :");
+                text::put_str(&text, label_name(program, instr->label));
+                break;
+
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_POW:
+            case OPCODE_SQR:
+            case OPCODE_IN:
+            case OPCODE_OUT:
+            case OPCODE_DRAW:
+            case OPCODE_HLT:
+            case OPCODE_RET:
+            default:
+                text::put_str(&text, opcode_str(instr->opcode));
+                break;
+        }
+
+        text::put_str(&text, "\n");
+    }
+
+    text::flush(&text, stream);
+}
+
+} // instr
+} // compiler
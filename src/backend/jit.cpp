@@ -0,0 +1,648 @@
+#include "jit.h"
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+#include "vector.h"
+#include "x86.h"
+
+namespace compiler {
+namespace jit {
+
+ATTR_UNUSED static const char* LOG_JIT = "JIT";
+
+using regcode::Operand;
+
+const size_t NO_OFFSET = (size_t) -1;
+
+const size_t SLOT_SIZE = 4;
+const size_t PUSH_SIZE = 8;
+
+const size_t VRAM_WIDTH  = 100;
+const size_t VRAM_HEIGHT = 100;
+
+// numbers as in ModRM
+enum Register
+{
+    REGISTER_EAX = 0,
+    REGISTER_ECX = 1,
+    REGISTER_EDX = 2,
+    REGISTER_ESI = 6,
+    REGISTER_EDI = 7,
+    REGISTER_R8D = 8,
+    REGISTER_R9D = 9,
+};
+
+const size_t ARG_REGISTERS_CNT = 6;
+static const Register ARG_REGISTERS[ARG_REGISTERS_CNT] =
+    { REGISTER_EDI, REGISTER_ESI, REGISTER_EDX, REGISTER_ECX, REGISTER_R8D, REGISTER_R9D };
+
+// rel32 field waiting for its target
+struct Fixup
+{
+    size_t pos;
+    size_t label;
+    bool   is_call; // target is function entry, not label after prologue
+};
+
+struct Encoder
+{
+    uint8_t* buf;
+    size_t   size;
+    size_t   cap;
+
+    Vector fixups; // Fixup
+
+    size_t* label_offset; // by label, code after prologue for function labels
+    size_t* func_offset;  // by label, prologue of function
+    size_t* params_of;    // by label, parameter count of function
+};
+
+// reached by runtime functions called from generated code
+struct Runtime
+{
+    FILE* in;
+    FILE* out;
+
+    int32_t vram[VRAM_WIDTH * VRAM_HEIGHT];
+
+    jmp_buf fail;
+    JitErr  err;
+};
+
+static Runtime runtime_;
+
+static void encode_instr_   (Encoder* enc, regcode::Instr* instr);
+static void encode_call_    (Encoder* enc, regcode::Instr* instr);
+static void encode_prologue_(Encoder* enc, size_t frame_bytes);
+static void encode_params_  (Encoder* enc, size_t params);
+static void encode_load_    (Encoder* enc, Operand operand, Register reg);
+static void encode_store_   (Encoder* enc, Register reg, Operand operand);
+static void encode_arith_   (Encoder* enc, uint8_t imm_opcode, uint8_t mem_opcode, Operand operand);
+static void encode_mem_     (Encoder* enc, Register reg, int32_t disp);
+static void encode_rel32_   (Encoder* enc, size_t label, bool is_call);
+static void encode_runtime_ (Encoder* enc, uintptr_t func);
+
+static void    reserve_(Encoder* enc, size_t add);
+static void    put_u8_ (Encoder* enc, uint8_t val);
+static void    put_u32_(Encoder* enc, uint32_t val);
+static void    put_u64_(Encoder* enc, uint64_t val);
+static int32_t slot_disp_(Operand operand);
+static uint8_t jump_cmd_(regcode::Opcode opcode);
+
+static int32_t rt_in_     ();
+static void    rt_out_    (int32_t val);
+static int32_t rt_div_    (int32_t a, int32_t b);
+static int32_t rt_pow_    (int32_t a, int32_t b);
+static int32_t rt_sqrt_   (int32_t a);
+static void    rt_ramset_ (int32_t addr, int32_t val);
+static void    rt_draw_   ();
+static void    rt_fail_   (JitErr err) __attribute__((noreturn));
+
+JitErr compile(Jit* jit, regcode::Program* program)
+{
+    utils_assert(jit);
+    utils_assert(program);
+
+    const size_t bytes_per_instr = 24;
+
+    Encoder enc = {};
+    vector_ctor(&enc.fixups, program->code.size, sizeof(Fixup));
+
+    enc.label_offset = TYPED_CALLOC(program->labels.size + 1, size_t);
+    enc.func_offset  = TYPED_CALLOC(program->labels.size + 1, size_t);
+    enc.params_of    = TYPED_CALLOC(program->labels.size + 1, size_t);
+    utils_assert(enc.label_offset && enc.func_offset && enc.params_of);
+
+    for(size_t i = 0; i <= program->labels.size; ++i) {
+        enc.label_offset[i] = NO_OFFSET;
+        enc.func_offset [i] = NO_OFFSET;
+    }
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(program, i);
+
+        if(instr->opcode == regcode::OPCODE_FUNC)
+            enc.params_of[instr->label] = instr->params;
+    }
+
+    reserve_(&enc, program->code.size * bytes_per_instr);
+
+    // code before first function is entry
+    encode_prologue_(&enc, x86::frame_size(program, 0, 0));
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(program, i);
+
+        if(instr->opcode == regcode::OPCODE_FUNC) {
+            enc.func_offset[instr->label] = enc.size;
+
+            encode_prologue_(&enc, x86::frame_size(program, i + 1, instr->params));
+            encode_params_  (&enc, instr->params);
+            continue;
+        }
+
+        encode_instr_(&enc, instr);
+    }
+
+    // targets are known only now
+    for(size_t i = 0; i < enc.fixups.size; ++i) {
+        Fixup* fixup = (Fixup*) vector_at(&enc.fixups, i);
+
+        size_t target = fixup->is_call ? enc.func_offset[fixup->label] : enc.label_offset[fixup->label];
+        utils_assert(target != NO_OFFSET);
+
+        uint32_t rel = (uint32_t) target - (uint32_t) (fixup->pos + sizeof(rel));
+        memcpy(enc.buf + fixup->pos, &rel, sizeof(rel));
+    }
+
+    JitErr err = JIT_ERR_NONE;
+
+    // written while mapped writable, then made executable
+    void* mem = mmap(NULL, enc.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        err = JIT_ERR_MAP_FAIL;
+    }
+    else {
+        memcpy(mem, enc.buf, enc.size);
+
+        if(mprotect(mem, enc.size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, enc.size);
+            err = JIT_ERR_MAP_FAIL;
+        }
+    }
+
+    if(err == JIT_ERR_NONE) {
+        dtor(jit);
+
+        jit->code      = (uint8_t*) mem;
+        jit->code_size = enc.size;
+
+        UTILS_LOGD(LOG_JIT, "%lu instructions encoded in %lu bytes", program->code.size, enc.size);
+    }
+
+    vector_dtor(&enc.fixups);
+    NFREE(enc.buf);
+    NFREE(enc.label_offset);
+    NFREE(enc.func_offset);
+    NFREE(enc.params_of);
+
+    return err;
+}
+
+JitErr run(Jit* jit, FILE* in, FILE* out)
+{
+    utils_assert(jit);
+    utils_assert(jit->code);
+    utils_assert(in);
+    utils_assert(out);
+
+    typedef int (*Entry)();
+
+    memset(runtime_.vram, 0, sizeof(runtime_.vram));
+    runtime_.in  = in;
+    runtime_.out = out;
+    runtime_.err = JIT_ERR_NONE;
+
+    Entry entry = (Entry) (uintptr_t) jit->code;
+
+    // runtime error jumps back here, generated frames need no unwinding
+    if(setjmp(runtime_.fail) == 0)
+        entry();
+
+    return runtime_.err;
+}
+
+void dtor(Jit* jit)
+{
+    utils_assert(jit);
+
+    if(jit->code)
+        munmap(jit->code, jit->code_size);
+
+    jit->code      = NULL;
+    jit->code_size = 0;
+}
+
+const char* strerr(JitErr err)
+{
+    switch(err) {
+        case JIT_ERR_NONE:        return "none";
+        case JIT_ERR_MAP_FAIL:    return "failed to map executable memory";
+        case JIT_ERR_BAD_ADDRESS: return "memory access out of bounds";
+        case JIT_ERR_DIV_BY_ZERO: return "division by zero";
+        case JIT_ERR_INPUT:       return "failed to read input";
+        default:                  return "unknown";
+    }
+}
+
+// same lowering as x86::write
+static void encode_instr_(Encoder* enc, regcode::Instr* instr)
+{
+    using namespace regcode;
+
+    switch(instr->opcode) {
+        case OPCODE_LABEL:
+            enc->label_offset[instr->label] = enc->size;
+            break;
+
+        case OPCODE_HLT:
+            put_u8_(enc, 0x31); put_u8_(enc, 0xC0); // xor eax, eax
+            put_u8_(enc, 0xC9);                     // leave
+            put_u8_(enc, 0xC3);                     // ret
+            break;
+
+        case OPCODE_MOV:
+            if(instr->a.kind == OPERAND_IMM) {
+                put_u8_    (enc, 0xC7);             // mov dword [rbp + disp], imm32
+                encode_mem_(enc, REGISTER_EAX, slot_disp_(instr->dst));
+                put_u32_   (enc, (uint32_t) instr->a.val);
+                break;
+            }
+            encode_load_ (enc, instr->a, REGISTER_EAX);
+            encode_store_(enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_ADD:
+            encode_load_ (enc, instr->a, REGISTER_EAX);
+            encode_arith_(enc, 0x05, 0x03, instr->b);
+            encode_store_(enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_SUB:
+            encode_load_ (enc, instr->a, REGISTER_EAX);
+            encode_arith_(enc, 0x2D, 0x2B, instr->b);
+            encode_store_(enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_MUL:
+            encode_load_(enc, instr->a, REGISTER_EAX);
+            if(instr->b.kind == OPERAND_IMM) {
+                put_u8_ (enc, 0x69); put_u8_(enc, 0xC0); // imul eax, eax, imm32
+                put_u32_(enc, (uint32_t) instr->b.val);
+            }
+            else {
+                put_u8_    (enc, 0x0F); put_u8_(enc, 0xAF); // imul eax, [rbp + disp]
+                encode_mem_(enc, REGISTER_EAX, slot_disp_(instr->b));
+            }
+            encode_store_(enc, REGISTER_EAX, instr->dst);
+            break;
+
+        // runtime checks divisor unless it is known to be safe
+        case OPCODE_DIV:
+            if(instr->b.kind == OPERAND_IMM && instr->b.val != 0 && instr->b.val != -1) {
+                encode_load_(enc, instr->a, REGISTER_EAX);
+                encode_load_(enc, instr->b, REGISTER_ECX);
+                put_u8_(enc, 0x99);                     // cdq
+                put_u8_(enc, 0xF7); put_u8_(enc, 0xF9); // idiv ecx
+            }
+            else {
+                encode_load_   (enc, instr->a, REGISTER_EDI);
+                encode_load_   (enc, instr->b, REGISTER_ESI);
+                encode_runtime_(enc, (uintptr_t) &rt_div_);
+            }
+            encode_store_(enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_POW:
+            encode_load_   (enc, instr->a, REGISTER_EDI);
+            encode_load_   (enc, instr->b, REGISTER_ESI);
+            encode_runtime_(enc, (uintptr_t) &rt_pow_);
+            encode_store_  (enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_SQR:
+            encode_load_   (enc, instr->a, REGISTER_EDI);
+            encode_runtime_(enc, (uintptr_t) &rt_sqrt_);
+            encode_store_  (enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_IN:
+            encode_runtime_(enc, (uintptr_t) &rt_in_);
+            encode_store_  (enc, REGISTER_EAX, instr->dst);
+            break;
+
+        case OPCODE_OUT:
+            encode_load_   (enc, instr->a, REGISTER_EDI);
+            encode_runtime_(enc, (uintptr_t) &rt_out_);
+            break;
+
+        case OPCODE_DRAW:
+            encode_runtime_(enc, (uintptr_t) &rt_draw_);
+            break;
+
+        case OPCODE_STORE:
+            encode_load_   (enc, instr->a, REGISTER_EDI);
+            encode_load_   (enc, instr->b, REGISTER_ESI);
+            encode_runtime_(enc, (uintptr_t) &rt_ramset_);
+            break;
+
+        case OPCODE_CALL:
+            encode_call_(enc, instr);
+            break;
+
+        case OPCODE_RET:
+            encode_load_(enc, instr->a, REGISTER_EAX);
+            put_u8_(enc, 0xC9); // leave
+            put_u8_(enc, 0xC3); // ret
+            break;
+
+        case OPCODE_JMP:
+            put_u8_      (enc, 0xE9);
+            encode_rel32_(enc, instr->label, false);
+            break;
+
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+            encode_load_ (enc, instr->a, REGISTER_EAX);
+            encode_arith_(enc, 0x3D, 0x3B, instr->b); // cmp
+            put_u8_      (enc, 0x0F);
+            put_u8_      (enc, jump_cmd_(instr->opcode));
+            encode_rel32_(enc, instr->label, false);
+            break;
+
+        case OPCODE_FUNC:
+        default:
+            UTILS_LOGE(LOG_JIT, "unexpected opcode %s", opcode_str(instr->opcode));
+            break;
+    }
+}
+
+// arguments are read from callee frame slots of caller, stack ones are
+// pushed last to first with padding keeping call aligned
+static void encode_call_(Encoder* enc, regcode::Instr* instr)
+{
+    size_t params   = enc->params_of[instr->label];
+    size_t on_stack = params > ARG_REGISTERS_CNT ? params - ARG_REGISTERS_CNT : 0;
+    size_t padding  = on_stack % 2;
+
+    if(padding) {
+        put_u8_(enc, 0x48); put_u8_(enc, 0x83); put_u8_(enc, 0xEC); // sub rsp, imm8
+        put_u8_(enc, (uint8_t) PUSH_SIZE);
+    }
+
+    for(size_t i = params; i-- > ARG_REGISTERS_CNT;) {
+        encode_load_(enc, regcode::slot((int32_t) (instr->frame + i)), REGISTER_EAX);
+        put_u8_(enc, 0x50); // push rax
+    }
+
+    for(size_t i = 0; i < params && i < ARG_REGISTERS_CNT; ++i)
+        encode_load_(enc, regcode::slot((int32_t) (instr->frame + i)), ARG_REGISTERS[i]);
+
+    put_u8_      (enc, 0xE8);
+    encode_rel32_(enc, instr->label, true);
+
+    if(on_stack + padding) {
+        put_u8_ (enc, 0x48); put_u8_(enc, 0x81); put_u8_(enc, 0xC4); // add rsp, imm32
+        put_u32_(enc, (uint32_t) ((on_stack + padding) * PUSH_SIZE));
+    }
+
+    encode_store_(enc, REGISTER_EAX, instr->dst);
+}
+
+static void encode_prologue_(Encoder* enc, size_t frame_bytes)
+{
+    put_u8_(enc, 0x55);                                         // push rbp
+    put_u8_(enc, 0x48); put_u8_(enc, 0x89); put_u8_(enc, 0xE5); // mov rbp, rsp
+
+    if(frame_bytes) {
+        put_u8_ (enc, 0x48); put_u8_(enc, 0x81); put_u8_(enc, 0xEC); // sub rsp, imm32
+        put_u32_(enc, (uint32_t) frame_bytes);
+    }
+}
+
+// parameters are spilled to their slots, stack ones lie above return address
+static void encode_params_(Encoder* enc, size_t params)
+{
+    for(size_t i = 0; i < params; ++i) {
+        if(i < ARG_REGISTERS_CNT) {
+            encode_store_(enc, ARG_REGISTERS[i], regcode::slot((int32_t) i));
+            continue;
+        }
+
+        put_u8_    (enc, 0x8B); // mov eax, [rbp + disp]
+        encode_mem_(enc, REGISTER_EAX, (int32_t) (2 * PUSH_SIZE + (i - ARG_REGISTERS_CNT) * PUSH_SIZE));
+
+        encode_store_(enc, REGISTER_EAX, regcode::slot((int32_t) i));
+    }
+}
+
+static void encode_load_(Encoder* enc, Operand operand, Register reg)
+{
+    if(operand.kind == regcode::OPERAND_IMM) {
+        if(reg >= REGISTER_R8D)
+            put_u8_(enc, 0x41);                     // REX.B
+        put_u8_ (enc, (uint8_t) (0xB8 + (reg & 7))); // mov r32, imm32
+        put_u32_(enc, (uint32_t) operand.val);
+        return;
+    }
+
+    if(reg >= REGISTER_R8D)
+        put_u8_(enc, 0x44);                         // REX.R
+    put_u8_    (enc, 0x8B);                         // mov r32, [rbp + disp]
+    encode_mem_(enc, reg, slot_disp_(operand));
+}
+
+static void encode_store_(Encoder* enc, Register reg, Operand operand)
+{
+    if(reg >= REGISTER_R8D)
+        put_u8_(enc, 0x44);                         // REX.R
+    put_u8_    (enc, 0x89);                         // mov [rbp + disp], r32
+    encode_mem_(enc, reg, slot_disp_(operand));
+}
+
+// eax op= operand, imm_opcode takes imm32 with eax implied
+static void encode_arith_(Encoder* enc, uint8_t imm_opcode, uint8_t mem_opcode, Operand operand)
+{
+    if(operand.kind == regcode::OPERAND_IMM) {
+        put_u8_ (enc, imm_opcode);
+        put_u32_(enc, (uint32_t) operand.val);
+        return;
+    }
+
+    put_u8_    (enc, mem_opcode);
+    encode_mem_(enc, REGISTER_EAX, slot_disp_(operand));
+}
+
+// ModRM with rbp base and disp32
+static void encode_mem_(Encoder* enc, Register reg, int32_t disp)
+{
+    put_u8_ (enc, (uint8_t) (0x85 | (reg & 7) << 3));
+    put_u32_(enc, (uint32_t) disp);
+}
+
+static void encode_rel32_(Encoder* enc, size_t label, bool is_call)
+{
+    Fixup fixup = { .pos = enc->size, .label = label, .is_call = is_call };
+    vector_push(&enc->fixups, &fixup);
+
+    put_u32_(enc, 0);
+}
+
+// runtime is too far for rel32, called through rax
+static void encode_runtime_(Encoder* enc, uintptr_t func)
+{
+    put_u8_ (enc, 0x48); put_u8_(enc, 0xB8); // mov rax, imm64
+    put_u64_(enc, func);
+    put_u8_ (enc, 0xFF); put_u8_(enc, 0xD0); // call rax
+}
+
+static void reserve_(Encoder* enc, size_t add)
+{
+    if(enc->size + add <= enc->cap)
+        return;
+
+    size_t cap = enc->cap ? enc->cap : 1;
+    while(cap < enc->size + add)
+        cap *= 2;
+
+    uint8_t* buf = (uint8_t*) realloc(enc->buf, cap);
+    utils_assert(buf);
+
+    enc->buf = buf;
+    enc->cap = cap;
+}
+
+static void put_u8_(Encoder* enc, uint8_t val)
+{
+    reserve_(enc, sizeof(val));
+    enc->buf[enc->size++] = val;
+}
+
+static void put_u32_(Encoder* enc, uint32_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        put_u8_(enc, (uint8_t) (val >> (8 * i)));
+}
+
+static void put_u64_(Encoder* enc, uint64_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        put_u8_(enc, (uint8_t) (val >> (8 * i)));
+}
+
+static int32_t slot_disp_(Operand operand)
+{
+    utils_assert(operand.kind == regcode::OPERAND_SLOT);
+
+    return -(int32_t) (((size_t) operand.val + 1) * SLOT_SIZE);
+}
+
+// second byte of jcc rel32, comparisons are signed
+static uint8_t jump_cmd_(regcode::Opcode opcode)
+{
+    switch(opcode) {
+        case regcode::OPCODE_JE:  return 0x84;
+        case regcode::OPCODE_JNE: return 0x85;
+        case regcode::OPCODE_JA:  return 0x8F;
+        case regcode::OPCODE_JB:  return 0x8C;
+        case regcode::OPCODE_JAE: return 0x8D;
+        case regcode::OPCODE_JBE: return 0x8E;
+
+        case regcode::OPCODE_LABEL:
+        case regcode::OPCODE_FUNC:
+        case regcode::OPCODE_HLT:
+        case regcode::OPCODE_MOV:
+        case regcode::OPCODE_ADD:
+        case regcode::OPCODE_SUB:
+        case regcode::OPCODE_MUL:
+        case regcode::OPCODE_DIV:
+        case regcode::OPCODE_POW:
+        case regcode::OPCODE_SQR:
+        case regcode::OPCODE_IN:
+        case regcode::OPCODE_OUT:
+        case regcode::OPCODE_DRAW:
+        case regcode::OPCODE_STORE:
+        case regcode::OPCODE_CALL:
+        case regcode::OPCODE_RET:
+        case regcode::OPCODE_JMP:
+        default:
+            utils_assert(0 && "not a conditional jump");
+            return 0;
+    }
+}
+
+static int32_t rt_in_()
+{
+    int val = 0;
+    if(fscanf(runtime_.in, "%d", &val) != 1)
+        rt_fail_(JIT_ERR_INPUT);
+
+    return val;
+}
+
+static void rt_out_(int32_t val)
+{
+    fprintf(runtime_.out, "%d\n", val);
+}
+
+// INT_MIN / -1 wraps instead of trapping
+static int32_t rt_div_(int32_t a, int32_t b)
+{
+    if(b == 0)
+        rt_fail_(JIT_ERR_DIV_BY_ZERO);
+
+    if(b == -1)
+        return (int32_t) (0u - (uint32_t) a);
+
+    return a / b;
+}
+
+// same rounding as constant folding in middlend
+static int32_t rt_pow_(int32_t a, int32_t b)
+{
+    return (int32_t) pown(a, b);
+}
+
+static int32_t rt_sqrt_(int32_t a)
+{
+    return a > 0 ? (int32_t) sqrt(a) : 0;
+}
+
+static void rt_ramset_(int32_t addr, int32_t val)
+{
+    if((uint32_t) addr >= VRAM_WIDTH * VRAM_HEIGHT)
+        rt_fail_(JIT_ERR_BAD_ADDRESS);
+
+    runtime_.vram[addr] = val;
+}
+
+// prints VRAM when anything was drawn
+static void rt_draw_()
+{
+    bool empty = true;
+    for(size_t i = 0; i < VRAM_WIDTH * VRAM_HEIGHT && empty; ++i)
+        empty = runtime_.vram[i] == 0;
+
+    if(empty)
+        return;
+
+    for(size_t y = 0; y < VRAM_HEIGHT; ++y) {
+        for(size_t x = 0; x < VRAM_WIDTH; ++x) {
+            int32_t cell = runtime_.vram[y * VRAM_WIDTH + x];
+            fputc(cell ? (char) cell : '.', runtime_.out);
+        }
+        fputc('\n', runtime_.out);
+    }
+}
+
+static void rt_fail_(JitErr err)
+{
+    runtime_.err = err;
+    longjmp(runtime_.fail, 1);
+}
+
+} // jit
+} // compiler
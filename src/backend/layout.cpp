@@ -0,0 +1,307 @@
+#include "layout.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "instr.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace layout {
+
+using namespace instr;
+
+ATTR_UNUSED static const char* LOG_LAYOUT = "LAYOUT";
+
+const size_t NO_POS = (size_t) -1;
+
+struct Context
+{
+    Program* program;
+
+    size_t* label_pos; // index of LABEL instruction
+    size_t* refs;      // jumps and calls to label
+
+    size_t threaded;
+    size_t inverted;
+    size_t placed;
+    size_t removed;
+};
+
+static void index_labels_(Context* ctx);
+
+static bool thread_jumps_(Context* ctx);
+
+static bool invert_branches_(Context* ctx);
+
+static bool place_blocks_(Context* ctx);
+
+static void move_block_(Context* ctx, size_t jump, size_t begin, size_t end);
+
+static bool remove_dead_(Context* ctx);
+
+static size_t skip_labels_(Context* ctx, size_t ind);
+
+static Instr* code_(Context* ctx);
+
+void optimize(Program* program)
+{
+    utils_assert(program);
+
+    size_t labels_cnt = program->labels.size;
+
+    Context ctx = {
+        .program   = program,
+        .label_pos = TYPED_CALLOC(labels_cnt + 1, size_t),
+        .refs      = TYPED_CALLOC(labels_cnt + 1, size_t),
+        .threaded  = 0,
+        .inverted  = 0,
+        .placed    = 0,
+        .removed   = 0,
+    };
+
+    utils_assert(ctx.label_pos && ctx.refs);
+
+    size_t before = program->code.size;
+
+    // every step removes jumps or instructions or shortens jump chain
+    bool changed = true;
+    while(changed) {
+        index_labels_(&ctx);
+        changed = thread_jumps_(&ctx);
+
+        index_labels_(&ctx);
+        changed |= invert_branches_(&ctx);
+
+        index_labels_(&ctx);
+        changed |= place_blocks_(&ctx);
+
+        index_labels_(&ctx);
+        changed |= remove_dead_(&ctx);
+    }
+
+    UTILS_LOGD(LOG_LAYOUT, "%lu jumps threaded, %lu inverted, %lu blocks placed, "
+               "%lu instructions removed, %lu -> %lu",
+               ctx.threaded, ctx.inverted, ctx.placed, ctx.removed, before, program->code.size);
+
+    NFREE(ctx.label_pos);
+    NFREE(ctx.refs);
+}
+
+static void index_labels_(Context* ctx)
+{
+    size_t labels_cnt = ctx->program->labels.size;
+
+    for(size_t i = 0; i < labels_cnt; ++i) {
+        ctx->label_pos[i] = NO_POS;
+        ctx->refs[i]      = 0;
+    }
+
+    Instr* code = code_(ctx);
+    for(size_t i = 0; i < ctx->program->code.size; ++i) {
+        if(code[i].opcode == OPCODE_LABEL)
+            ctx->label_pos[code[i].label] = i;
+        else if(is_jump(code[i].opcode) || code[i].opcode == OPCODE_CALL)
+            ctx->refs[code[i].label]++;
+    }
+}
+
+// jump to :L where :L is followed by JMP :M goes to :M directly
+static bool thread_jumps_(Context* ctx)
+{
+    Instr* code = code_(ctx);
+    size_t size = ctx->program->code.size;
+    size_t labels_cnt = ctx->program->labels.size;
+
+    bool changed = false;
+
+    for(size_t i = 0; i < size; ++i) {
+        if(!is_jump(code[i].opcode))
+            continue;
+
+        size_t target = code[i].label;
+
+        // bounded, cycle of jumps never ends
+        for(size_t step = 0; step < labels_cnt; ++step) {
+            size_t pos = ctx->label_pos[target];
+            if(pos == NO_POS)
+                break;
+
+            size_t next = skip_labels_(ctx, pos);
+            if(next >= size || code[next].opcode != OPCODE_JMP || code[next].label == target)
+                break;
+
+            target = code[next].label;
+        }
+
+        if(target != code[i].label) {
+            code[i].label = target;
+            ctx->threaded++;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Jcc :L; JMP :M; :L  becomes  J!cc :M; :L
+static bool invert_branches_(Context* ctx)
+{
+    Instr* code = code_(ctx);
+    size_t size = ctx->program->code.size;
+
+    bool changed = false;
+
+    for(size_t i = 0; i + 2 < size; ++i) {
+        if(!is_jump(code[i].opcode) || code[i].opcode == OPCODE_JMP || code[i + 1].opcode != OPCODE_JMP)
+            continue;
+
+        size_t pos = ctx->label_pos[code[i].label];
+        if(pos == NO_POS || pos < i + 2 || skip_labels_(ctx, i + 2) <= pos)
+            continue;
+
+        size_t fallthrough = code[i].label;
+
+        code[i].opcode = invert_jump(code[i].opcode);
+        code[i].label  = code[i + 1].label;
+
+        // becomes jump to next, dropped by remove_dead_
+        code[i + 1].label = fallthrough;
+
+        ctx->inverted++;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// block not fallen into and ending with terminator is moved right
+// after JMP to it, which is then dropped, labels move along with it
+static bool place_blocks_(Context* ctx)
+{
+    Instr* code = code_(ctx);
+    size_t size = ctx->program->code.size;
+
+    for(size_t i = 0; i < size; ++i) {
+        if(code[i].opcode != OPCODE_JMP)
+            continue;
+
+        size_t pos = ctx->label_pos[code[i].label];
+        if(pos == NO_POS)
+            continue;
+
+        size_t begin = pos;
+        while(begin > 0 && code[begin - 1].opcode == OPCODE_LABEL)
+            begin--;
+
+        if(begin == 0 || !is_terminator(code[begin - 1].opcode) || begin == i + 1)
+            continue;
+
+        size_t end = pos;
+        while(end < size && !is_terminator(code[end].opcode))
+            end++;
+
+        if(end >= size || (begin <= i && i <= end))
+            continue;
+
+        move_block_(ctx, i, begin, end);
+        ctx->placed++;
+
+        return true;
+    }
+
+    return false;
+}
+
+// [begin, end] is placed instead of jump at given index
+static void move_block_(Context* ctx, size_t jump, size_t begin, size_t end)
+{
+    Instr* code = code_(ctx);
+    size_t size = ctx->program->code.size;
+
+    Instr* moved = TYPED_CALLOC(size, Instr);
+    utils_assert(moved);
+
+    size_t len = end - begin + 1;
+    size_t cnt = 0;
+
+    for(size_t i = 0; i < size; ++i) {
+        if(i == jump) {
+            memcpy(moved + cnt, code + begin, len * sizeof(Instr));
+            cnt += len;
+            continue;
+        }
+
+        if(begin <= i && i <= end)
+            continue;
+
+        moved[cnt++] = code[i];
+    }
+
+    memcpy(code, moved, cnt * sizeof(Instr));
+    ctx->program->code.size = cnt;
+
+    NFREE(moved);
+}
+
+// code after terminator up to referenced label, labels nobody
+// jumps to and jumps to label right after them
+static bool remove_dead_(Context* ctx)
+{
+    Instr* code = code_(ctx);
+    size_t size = ctx->program->code.size;
+
+    size_t cnt = 0;
+    bool reachable = true;
+
+    for(size_t i = 0; i < size; ++i) {
+        Instr* instr = &code[i];
+
+        if(instr->opcode == OPCODE_LABEL) {
+            if(ctx->refs[instr->label] == 0)
+                continue;
+
+            reachable = true;
+        }
+
+        if(!reachable)
+            continue;
+
+        if(instr->opcode == OPCODE_JMP) {
+            size_t pos = ctx->label_pos[instr->label];
+            if(pos != NO_POS && pos > i && skip_labels_(ctx, i + 1) > pos)
+                continue;
+        }
+
+        if(is_terminator(instr->opcode))
+            reachable = false;
+
+        code[cnt++] = *instr;
+    }
+
+    ctx->removed += size - cnt;
+    ctx->program->code.size = cnt;
+
+    return cnt != size;
+}
+
+static size_t skip_labels_(Context* ctx, size_t ind)
+{
+    Instr* code = code_(ctx);
+
+    while(ind < ctx->program->code.size && code[ind].opcode == OPCODE_LABEL)
+        ind++;
+
+    return ind;
+}
+
+static Instr* code_(Context* ctx)
+{
+    return (Instr*) ctx->program->code.buffer;
+}
+
+} // layout
+} // compiler
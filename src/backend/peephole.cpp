@@ -0,0 +1,341 @@
+#include "peephole.h"
+
+#include "assertutils.h"
+#include "instr.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace peephole {
+
+using namespace instr;
+
+ATTR_UNUSED static const char* LOG_PEEPHOLE = "PEEPHOLE";
+
+const size_t MAX_WINDOW = 3;
+
+// window holds last width instructions, replacement is at most width long
+typedef bool (*RuleFunc) (Instr* window, Instr* out, size_t* out_cnt);
+
+struct Rule
+{
+    const char* name;
+    size_t      width;
+    RuleFunc    apply;
+
+    size_t hits;
+};
+
+static bool neutral_operand_ (Instr* window, Instr* out, size_t* out_cnt);
+static bool add_zero_left_   (Instr* window, Instr* out, size_t* out_cnt);
+static bool fold_constants_  (Instr* window, Instr* out, size_t* out_cnt);
+static bool load_store_      (Instr* window, Instr* out, size_t* out_cnt);
+static bool compare_zero_    (Instr* window, Instr* out, size_t* out_cnt);
+static bool jump_to_next_    (Instr* window, Instr* out, size_t* out_cnt);
+static bool unreachable_     (Instr* window, Instr* out, size_t* out_cnt);
+
+#define MAKE_RULE(name, width, apply) \
+    Rule { name, width, apply, 0 }
+
+static Rule rules_[] =
+{
+    MAKE_RULE("neutral-operand", 2, neutral_operand_),
+    MAKE_RULE("add-zero-left"  , 3, add_zero_left_  ),
+    MAKE_RULE("fold-constants" , 3, fold_constants_ ),
+    MAKE_RULE("load-store"     , 2, load_store_     ),
+    MAKE_RULE("compare-zero"   , 3, compare_zero_   ),
+    MAKE_RULE("jump-to-next"   , 2, jump_to_next_   ),
+    MAKE_RULE("unreachable"    , 2, unreachable_    ),
+};
+
+#undef MAKE_RULE
+
+static size_t drop_dead_scratch_(Program* program);
+
+static bool is_scratch_dead_(Program* program, size_t ind);
+
+static void push_(Instr* out, size_t* size, Instr* instr);
+
+static bool is_single_push_(Instr* instr);
+
+void optimize(Program* program)
+{
+    utils_assert(program);
+
+    size_t before = program->code.size;
+
+    size_t dropped = drop_dead_scratch_(program);
+
+    // rules never grow code, so output fits in size of input
+    Instr* out = TYPED_CALLOC(before + 1, Instr);
+    utils_assert(out);
+
+    size_t size = 0;
+    for(size_t i = 0; i < program->code.size; ++i)
+        push_(out, &size, instr_at(program, i));
+
+    vector_free(&program->code);
+    for(size_t i = 0; i < size; ++i)
+        vector_push(&program->code, &out[i]);
+
+    NFREE(out);
+
+    UTILS_LOGD(LOG_PEEPHOLE, "%lu instructions, %lu after peephole (%lu dead discards)",
+               before, size, dropped);
+}
+
+void log_stats()
+{
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        if(rules_[i].hits)
+            UTILS_LOGD(LOG_PEEPHOLE, "%-16s %lu hits", rules_[i].name, rules_[i].hits);
+    }
+}
+
+// value pushed only to be popped into T0, which is not read afterwards,
+// is dropped together with its push, compacts code in place
+static size_t drop_dead_scratch_(Program* program)
+{
+    size_t size    = 0;
+    size_t dropped = 0;
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        bool discard = instr->opcode == OPCODE_POPR && instr->reg == REGISTER_T0
+                       && size > 0 && is_single_push_(instr_at(program, size - 1))
+                       && is_scratch_dead_(program, i);
+
+        if(discard) {
+            size--;
+            dropped++;
+            continue;
+        }
+
+        *instr_at(program, size++) = *instr;
+    }
+
+    program->code.size = size;
+
+    return dropped;
+}
+
+// T0 is scratch register, it does not survive return,
+// at labels, jumps and calls it is conservatively considered live
+static bool is_scratch_dead_(Program* program, size_t ind)
+{
+    for(size_t i = ind + 1; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        switch(instr->opcode) {
+            case OPCODE_POPR:
+                if(instr->reg == REGISTER_T0)
+                    return true;
+                break;
+
+            case OPCODE_PUSHR:
+            case OPCODE_PUSHM:
+            case OPCODE_POPM:
+                if(instr->reg == REGISTER_T0)
+                    return false;
+                break;
+
+            case OPCODE_RET:
+            case OPCODE_HLT:
+                return true;
+
+            // ramset may pop address into T0 before evaluating call
+            case OPCODE_CALL:
+            case OPCODE_LABEL:
+            case OPCODE_JMP:
+            case OPCODE_JE:
+            case OPCODE_JNE:
+            case OPCODE_JA:
+            case OPCODE_JB:
+            case OPCODE_JAE:
+            case OPCODE_JBE:
+                return false;
+
+            case OPCODE_PUSH:
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_POW:
+            case OPCODE_SQR:
+            case OPCODE_IN:
+            case OPCODE_OUT:
+            case OPCODE_DRAW:
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+static void push_(Instr* out, size_t* size, Instr* instr)
+{
+    out[(*size)++] = *instr;
+
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        Rule* rule = &rules_[i];
+        if(*size < rule->width)
+            continue;
+
+        Instr  repl[MAX_WINDOW] = {};
+        size_t repl_cnt = 0;
+
+        if(!rule->apply(out + *size - rule->width, repl, &repl_cnt))
+            continue;
+
+        rule->hits++;
+        *size -= rule->width;
+
+        for(size_t j = 0; j < repl_cnt; ++j)
+            push_(out, size, &repl[j]);
+
+        return;
+    }
+}
+
+// PUSH 0; ADD, PUSH 0; SUB, PUSH 1; MUL, PUSH 1; DIV
+static bool neutral_operand_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    (void) out;
+
+    if(window[0].opcode != OPCODE_PUSH)
+        return false;
+
+    int imm = window[0].imm;
+    Opcode op = window[1].opcode;
+
+    if(!(imm == 0 && (op == OPCODE_ADD || op == OPCODE_SUB))
+       && !(imm == 1 && (op == OPCODE_MUL || op == OPCODE_DIV)))
+        return false;
+
+    *out_cnt = 0;
+    return true;
+}
+
+// PUSH 0; <push>; ADD
+static bool add_zero_left_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    if(window[0].opcode != OPCODE_PUSH || window[0].imm != 0
+       || !is_single_push_(&window[1]) || window[2].opcode != OPCODE_ADD)
+        return false;
+
+    out[0] = window[1];
+    *out_cnt = 1;
+    return true;
+}
+
+// PUSH a; PUSH b; ADD, SUB or MUL, wraps around like VM does
+static bool fold_constants_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    if(window[0].opcode != OPCODE_PUSH || window[1].opcode != OPCODE_PUSH)
+        return false;
+
+    unsigned a = (unsigned) window[0].imm;
+    unsigned b = (unsigned) window[1].imm;
+    unsigned res = 0;
+
+    switch(window[2].opcode) {
+        case OPCODE_ADD: res = a + b; break;
+        case OPCODE_SUB: res = a - b; break;
+        case OPCODE_MUL: res = a * b; break;
+
+        case OPCODE_LABEL:
+        case OPCODE_PUSH:
+        case OPCODE_PUSHR:
+        case OPCODE_POPR:
+        case OPCODE_PUSHM:
+        case OPCODE_POPM:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+        case OPCODE_SQR:
+        case OPCODE_IN:
+        case OPCODE_OUT:
+        case OPCODE_DRAW:
+        case OPCODE_HLT:
+        case OPCODE_CALL:
+        case OPCODE_RET:
+        case OPCODE_JMP:
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+        default:
+            return false;
+    }
+
+    out[0] = window[0];
+    out[0].imm = (int) res;
+    *out_cnt = 1;
+    return true;
+}
+
+// PUSHM m; POPM m and PUSHR r; POPR r store value back where it was
+static bool load_store_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    (void) out;
+
+    bool mem = window[0].opcode == OPCODE_PUSHM && window[1].opcode == OPCODE_POPM
+               && window[0].imm == window[1].imm;
+    bool reg = window[0].opcode == OPCODE_PUSHR && window[1].opcode == OPCODE_POPR;
+
+    if(!(mem || reg) || window[0].reg != window[1].reg)
+        return false;
+
+    *out_cnt = 0;
+    return true;
+}
+
+// SUB; PUSH 0; JE/JNE compares difference with zero, JE/JNE compares operands;
+// a - b may wrap, so only equality survives, ordered jumps are kept
+static bool compare_zero_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    if(window[0].opcode != OPCODE_SUB
+       || window[1].opcode != OPCODE_PUSH || window[1].imm != 0
+       || (window[2].opcode != OPCODE_JE && window[2].opcode != OPCODE_JNE))
+        return false;
+
+    out[0] = window[2];
+    *out_cnt = 1;
+    return true;
+}
+
+// JMP :L; :L
+static bool jump_to_next_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    if(window[0].opcode != OPCODE_JMP || window[1].opcode != OPCODE_LABEL
+       || window[0].label != window[1].label)
+        return false;
+
+    out[0] = window[1];
+    *out_cnt = 1;
+    return true;
+}
+
+// anything after JMP, RET or HLT up to next label
+static bool unreachable_(Instr* window, Instr* out, size_t* out_cnt)
+{
+    if(!is_terminator(window[0].opcode) || window[1].opcode == OPCODE_LABEL)
+        return false;
+
+    out[0] = window[0];
+    *out_cnt = 1;
+    return true;
+}
+
+static bool is_single_push_(Instr* instr)
+{
+    return instr->opcode == OPCODE_PUSH || instr->opcode == OPCODE_PUSHR || instr->opcode == OPCODE_PUSHM;
+}
+
+} // peephole
+} // compiler
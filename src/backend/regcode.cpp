@@ -0,0 +1,417 @@
+#include "regcode.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace regcode {
+
+ATTR_UNUSED static const char* LOG_REGCODE = "REGCODE";
+
+static size_t encoded_size_(Opcode opcode);
+
+static void write_operand_(FILE* stream, Operand operand);
+
+static uint8_t* put_operand_(uint8_t* pos, Operand operand);
+
+static uint8_t* put_u8_(uint8_t* pos, uint8_t val);
+
+static uint8_t* put_u32_(uint8_t* pos, uint32_t val);
+
+void ctor(Program* program)
+{
+    utils_assert(program);
+
+    const size_t code_cap   = 256;
+    const size_t labels_cap = 32;
+    vector_ctor(&program->code,   code_cap,   sizeof(Instr));
+    vector_ctor(&program->labels, labels_cap, sizeof(char*));
+}
+
+void dtor(Program* program)
+{
+    utils_assert(program);
+
+    for(size_t i = 0; i < program->labels.size; ++i)
+        NFREE(*(char**)vector_at(&program->labels, i));
+
+    vector_dtor(&program->code);
+    vector_dtor(&program->labels);
+}
+
+size_t label(Program* program, const char* fmt, ...)
+{
+    utils_assert(program);
+    utils_assert(fmt);
+
+    const size_t name_size = 128;
+    char buffer[name_size] = "";
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, name_size, fmt, args);
+    va_end(args);
+
+    for(size_t i = 0; i < program->labels.size; ++i)
+        if(strcmp(*(char**)vector_at(&program->labels, i), buffer) == 0)
+            return i;
+
+    char* name = TYPED_CALLOC(strlen(buffer) + 1, char);
+    utils_assert(name);
+
+    strcpy(name, buffer);
+    vector_push(&program->labels, &name);
+
+    return program->labels.size - 1;
+}
+
+const char* label_name(Program* program, size_t label)
+{
+    utils_assert(program);
+
+    return *(char**)vector_at(&program->labels, label);
+}
+
+void emit(Program* program, Opcode opcode, Operand dst, Operand a, Operand b)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .dst = dst, .a = a, .b = b, .label = 0, .frame = 0, .params = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_label(Program* program, Opcode opcode, size_t label)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .dst = {}, .a = {}, .b = {}, .label = label, .frame = 0, .params = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_branch(Program* program, Opcode opcode, Operand a, Operand b, size_t label)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = opcode, .dst = {}, .a = a, .b = b, .label = label, .frame = 0, .params = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_call(Program* program, Operand dst, size_t label)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = OPCODE_CALL, .dst = dst, .a = {}, .b = {}, .label = label, .frame = 0, .params = 0 };
+    vector_push(&program->code, &instr);
+}
+
+void emit_func(Program* program, size_t label, size_t params)
+{
+    utils_assert(program);
+
+    Instr instr = { .opcode = OPCODE_FUNC, .dst = {}, .a = {}, .b = {}, .label = label, .frame = 0, .params = params };
+    vector_push(&program->code, &instr);
+}
+
+Instr* instr_at(Program* program, size_t ind)
+{
+    utils_assert(program);
+
+    return (Instr*)vector_at(&program->code, ind);
+}
+
+Operand imm(int32_t val)
+{
+    return { .kind = OPERAND_IMM, .val = val };
+}
+
+Operand slot(int32_t ind)
+{
+    return { .kind = OPERAND_SLOT, .val = ind };
+}
+
+bool operand_equal(Operand a, Operand b)
+{
+    return a.kind == b.kind && a.val == b.val;
+}
+
+const char* opcode_str(Opcode opcode)
+{
+    switch(opcode) {
+        case OPCODE_LABEL: return "";
+        case OPCODE_FUNC:  return "FUNC";
+        case OPCODE_HLT:   return "HLT";
+        case OPCODE_MOV:   return "MOV";
+        case OPCODE_ADD:   return "ADD";
+        case OPCODE_SUB:   return "SUB";
+        case OPCODE_MUL:   return "MUL";
+        case OPCODE_DIV:   return "DIV";
+        case OPCODE_POW:   return "POW";
+        case OPCODE_SQR:   return "SQR";
+        case OPCODE_IN:    return "IN";
+        case OPCODE_OUT:   return "OUT";
+        case OPCODE_DRAW:  return "DRAW";
+        case OPCODE_STORE: return "STORE";
+        case OPCODE_CALL:  return "CALL";
+        case OPCODE_RET:   return "RET";
+        case OPCODE_JMP:   return "JMP";
+        case OPCODE_JE:    return "JE";
+        case OPCODE_JNE:   return "JNE";
+        case OPCODE_JA:    return "JA";
+        case OPCODE_JB:    return "JB";
+        case OPCODE_JAE:   return "JAE";
+        case OPCODE_JBE:   return "JBE";
+        default:           return "UNKNOWN";
+    }
+}
+
+void write_asm(Program* program, FILE* stream)
+{
+    utils_assert(program);
+    utils_assert(stream);
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        if(instr->opcode == OPCODE_LABEL) {
+            fprintf(stream, "\n:%s\n", label_name(program, instr->label));
+            continue;
+        }
+
+        if(instr->opcode == OPCODE_FUNC)
+            continue;
+
+        fprintf(stream, "%s", opcode_str(instr->opcode));
+
+        const char* sep = " ";
+        Operand operands[] = { instr->dst, instr->a, instr->b };
+
+        for(size_t j = 0; j < SIZEOF(operands); ++j) {
+            if(operands[j].kind == OPERAND_NONE)
+                continue;
+
+            fputs(sep, stream);
+            write_operand_(stream, operands[j]);
+            sep = ", ";
+        }
+
+        if(instr->opcode == OPCODE_CALL || instr->opcode == OPCODE_JMP
+           || (OPCODE_JE <= instr->opcode && instr->opcode <= OPCODE_JBE))
+            fprintf(stream, "%s:%s", sep, label_name(program, instr->label));
+
+        if(instr->opcode == OPCODE_CALL)
+            fprintf(stream, ", %lu", instr->frame);
+
+        fputc('\n', stream);
+    }
+}
+
+void write_image(Program* program, FILE* stream)
+{
+    utils_assert(program);
+    utils_assert(stream);
+
+    // first pass places labels
+    size_t* label_offset = TYPED_CALLOC(program->labels.size + 1, size_t);
+    utils_assert(label_offset);
+
+    size_t code_size = 0;
+    for(size_t i = 0; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        if(instr->opcode == OPCODE_LABEL)
+            label_offset[instr->label] = code_size;
+        else
+            code_size += encoded_size_(instr->opcode);
+    }
+
+    uint8_t* image = TYPED_CALLOC(HEADER_SIZE + code_size, uint8_t);
+    utils_assert(image);
+
+    uint8_t* pos = image;
+
+    memcpy(pos, MAGIC, sizeof(MAGIC) - 1);
+    pos += sizeof(MAGIC) - 1;
+    pos = put_u32_(pos, VERSION);
+    pos = put_u32_(pos, (uint32_t) code_size);
+
+    // second pass encodes with resolved jump targets
+    for(size_t i = 0; i < program->code.size; ++i) {
+        Instr* instr = instr_at(program, i);
+
+        switch(instr->opcode) {
+            case OPCODE_LABEL:
+            case OPCODE_FUNC:
+                continue;
+
+            case OPCODE_MOV:
+            case OPCODE_SQR:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->dst);
+                pos = put_operand_(pos, instr->a);
+                break;
+
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_POW:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->dst);
+                pos = put_operand_(pos, instr->a);
+                pos = put_operand_(pos, instr->b);
+                break;
+
+            case OPCODE_JMP:
+                pos = put_u8_ (pos, (uint8_t) instr->opcode);
+                pos = put_u32_(pos, (uint32_t) label_offset[instr->label]);
+                break;
+
+            case OPCODE_JE:
+            case OPCODE_JNE:
+            case OPCODE_JA:
+            case OPCODE_JB:
+            case OPCODE_JAE:
+            case OPCODE_JBE:
+                pos = put_u8_     (pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->a);
+                pos = put_operand_(pos, instr->b);
+                pos = put_u32_    (pos, (uint32_t) label_offset[instr->label]);
+                break;
+
+            case OPCODE_CALL:
+                pos = put_u8_     (pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->dst);
+                pos = put_u32_    (pos, (uint32_t) label_offset[instr->label]);
+                pos = put_u32_    (pos, (uint32_t) instr->frame);
+                break;
+
+            case OPCODE_RET:
+            case OPCODE_OUT:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->a);
+                break;
+
+            case OPCODE_IN:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->dst);
+                break;
+
+            case OPCODE_STORE:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                pos = put_operand_(pos, instr->a);
+                pos = put_operand_(pos, instr->b);
+                break;
+
+            case OPCODE_DRAW:
+            case OPCODE_HLT:
+            default:
+                pos = put_u8_(pos, (uint8_t) instr->opcode);
+                break;
+        }
+    }
+
+    utils_assert((size_t)(pos - image) == HEADER_SIZE + code_size);
+
+    fwrite(image, 1, HEADER_SIZE + code_size, stream);
+
+    UTILS_LOGD(LOG_REGCODE, "%lu instructions encoded in %lu bytes", program->code.size, code_size);
+
+    NFREE(image);
+    NFREE(label_offset);
+}
+
+static size_t encoded_size_(Opcode opcode)
+{
+    const size_t opcode_size  = 1;
+    const size_t operand_size = 5;
+    const size_t target_size  = 4;
+
+    switch(opcode) {
+        case OPCODE_LABEL:
+        case OPCODE_FUNC:
+            return 0;
+
+        case OPCODE_MOV:
+        case OPCODE_SQR:
+        case OPCODE_STORE:
+            return opcode_size + 2 * operand_size;
+
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_POW:
+            return opcode_size + 3 * operand_size;
+
+        case OPCODE_JMP:
+            return opcode_size + target_size;
+
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+            return opcode_size + 2 * operand_size + target_size;
+
+        case OPCODE_CALL:
+            return opcode_size + operand_size + 2 * target_size;
+
+        case OPCODE_RET:
+        case OPCODE_OUT:
+        case OPCODE_IN:
+            return opcode_size + operand_size;
+
+        case OPCODE_DRAW:
+        case OPCODE_HLT:
+        default:
+            return opcode_size;
+    }
+}
+
+static void write_operand_(FILE* stream, Operand operand)
+{
+    switch(operand.kind) {
+        case OPERAND_IMM:  fprintf(stream, "#%d", operand.val); break;
+        case OPERAND_SLOT: fprintf(stream, "s%d", operand.val); break;
+        case OPERAND_TEMP: fprintf(stream, "t%d", operand.val); break;
+        case OPERAND_ARG:  fprintf(stream, "a%d", operand.val); break;
+        case OPERAND_NONE:
+        default:
+            break;
+    }
+}
+
+static uint8_t* put_operand_(uint8_t* pos, Operand operand)
+{
+    utils_assert(operand.kind == OPERAND_IMM || operand.kind == OPERAND_SLOT);
+
+    pos = put_u8_ (pos, (uint8_t) operand.kind);
+    pos = put_u32_(pos, (uint32_t) operand.val);
+
+    return pos;
+}
+
+static uint8_t* put_u8_(uint8_t* pos, uint8_t val)
+{
+    *pos = val;
+    return pos + 1;
+}
+
+static uint8_t* put_u32_(uint8_t* pos, uint32_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        pos[i] = (uint8_t) (val >> (8 * i));
+
+    return pos + sizeof(val);
+}
+
+} // regcode
+} // compiler
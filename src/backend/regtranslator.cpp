@@ -0,0 +1,660 @@
+#include "regtranslator.h"
+
+#include <stdio.h>
+
+#include "ast.h"
+#include "logutils.h"
+#include "regcode.h"
+#include "symbol.h"
+#include "token.h"
+#include "x86.h"
+
+namespace compiler {
+
+ATTR_UNUSED static const char* LOG_REGTRANSLATOR = "REGTRANSLATOR";
+
+using regcode::Operand;
+
+const size_t MAX_ARGS = 64;
+
+static void    emit_node_       (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_keyword_    (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_function_   (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_if_         (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_while_      (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_return_     (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_assignment_ (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_in_         (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_out_        (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_ramset_     (RegTranslator* tr, ast::ASTNode* node);
+static void    emit_tail_call_  (RegTranslator* tr, ast::ASTNode* node);
+static Operand emit_expression_ (RegTranslator* tr, ast::ASTNode* node, Operand* dst);
+static Operand emit_call_       (RegTranslator* tr, ast::ASTNode* node, Operand* dst);
+static Operand emit_condition_  (RegTranslator* tr, ast::ASTNode* node, Operand* dst);
+
+static void    emit_jump_if_    (RegTranslator* tr, ast::ASTNode* cond, bool when,
+                                 const char* label, int lid);
+static size_t  collect_arguments_(ast::ASTNode* node, ast::ASTNode** args, size_t cnt);
+static void    resolve_frame_   (RegTranslator* tr, size_t begin, size_t frame_size);
+static void    resolve_operand_ (Operand* operand, size_t frame_size, size_t temps);
+static Operand new_temp_        (RegTranslator* tr);
+static Operand get_dst_         (RegTranslator* tr, Operand* dst);
+static Operand variable_        (ast::ASTNode* node);
+static size_t  get_func_label_  (RegTranslator* tr, ast::ASTNode* node);
+static size_t  count_parameters_(ast::ASTNode* node);
+static regcode::Opcode get_arith_cmd_(ast::ASTNode* node);
+static regcode::Opcode get_jump_cmd_ (ast::ASTNode* node, bool when);
+static int     get_new_label_id_(RegTranslator* tr);
+static bool    is_logical_      (ast::ASTNode* node);
+static bool    is_self_call_    (RegTranslator* tr, ast::ASTNode* node);
+
+void emit_register_program(RegTranslator* tr)
+{
+    utils_assert(tr);
+
+    lower_register_program(tr);
+
+    switch(tr->format) {
+        case OUTPUT_FORMAT_BYTECODE:
+            regcode::write_image(&tr->program, tr->file);
+            break;
+
+        case OUTPUT_FORMAT_X86_64:
+            x86::write(&tr->program, tr->file);
+            break;
+
+        case OUTPUT_FORMAT_ASM:
+        default:
+            regcode::write_asm(&tr->program, tr->file);
+            break;
+    }
+
+    regcode::dtor(&tr->program);
+}
+
+void lower_register_program(RegTranslator* tr)
+{
+    utils_assert(tr);
+
+    using namespace regcode;
+
+    ctor(&tr->program);
+
+    // main gets frame right above root one, which holds its result
+    emit_call(&tr->program, slot(0), label(&tr->program, "func_main"));
+    instr_at(&tr->program, 0)->frame = 1;
+
+    emit(&tr->program, OPCODE_DRAW, {}, {}, {});
+    emit(&tr->program, OPCODE_HLT,  {}, {}, {});
+
+    emit_node_(tr, tr->astree->root);
+}
+
+#define LOG_TRACE                                   \
+    UTILS_LOGD(LOG_REGTRANSLATOR, "token %s %s",    \
+               token::type_str(node->token.type),   \
+               token::value_str(&node->token))
+
+static void emit_node_(RegTranslator* tr, ast::ASTNode* node)
+{
+    utils_assert(tr);
+    utils_assert(node);
+
+    LOG_TRACE;
+
+    switch(node->token.type) {
+        case token::TYPE_OPERATOR:
+            if(node->token.val.op_type == token::OPERATOR_TYPE_ASSIGN)
+                emit_assignment_(tr, node);
+            else
+                emit_expression_(tr, node, NULL);
+            break;
+
+        case token::TYPE_KEYWORD:
+            emit_keyword_(tr, node);
+            break;
+
+        case token::TYPE_SEPARATOR:
+            if(node->left)  emit_node_(tr, node->left);
+            if(node->right) emit_node_(tr, node->right);
+            break;
+
+        case token::TYPE_IDENTIFIER: {
+            Env* env = get_enviroment(tr->astree, node->token.scope_id);
+            if(symbol_at(env, node->token.inner_scope_id)->type == SYMBOL_TYPE_FUNCTION)
+                emit_function_(tr, node);
+            break;
+        }
+
+        // value of expression statement is not used
+        case token::TYPE_CALL:
+        case token::TYPE_NUM_LITERAL:
+            emit_expression_(tr, node, NULL);
+            break;
+
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            UTILS_LOGE(LOG_REGTRANSLATOR, "unsupported token");
+            break;
+    }
+
+    // temporaries never outlive statement
+    tr->temps = 0;
+}
+
+static void emit_keyword_(RegTranslator* tr, ast::ASTNode* node)
+{
+    utils_assert(tr);
+    utils_assert(node);
+
+    LOG_TRACE;
+
+    using namespace token;
+
+    switch(node->token.val.kw_type) {
+        case KEYWORD_TYPE_WHILE:
+            emit_while_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_IF:
+            emit_if_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_RETURN:
+            emit_return_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_IN:
+            emit_in_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_OUT:
+            emit_out_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_RAMSET:
+            emit_ramset_(tr, node);
+            break;
+
+        case KEYWORD_TYPE_ELSE:
+        case KEYWORD_TYPE_DEFUN:
+        default:
+            break;
+    }
+}
+
+// temporaries and outgoing arguments get their slots once whole body is known
+static void emit_function_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    tr->current_env = get_enviroment(tr->astree, node->token.scope_id);
+    tr->temps       = 0;
+    tr->max_temps   = 0;
+
+    size_t begin = tr->program.code.size;
+
+    emit_func (&tr->program, get_func_label_(tr, node), count_parameters_(node->left));
+    emit_label(&tr->program, OPCODE_LABEL, get_func_label_(tr, node));
+
+    emit_node_(tr, node->right);
+
+    // falling off the end returns 0
+    Opcode last = instr_at(&tr->program, tr->program.code.size - 1)->opcode;
+    if(last != OPCODE_RET && last != OPCODE_JMP)
+        emit(&tr->program, OPCODE_RET, {}, imm(0), {});
+
+    resolve_frame_(tr, begin, tr->current_env->symbol_table.size - 1);
+}
+
+static void emit_if_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    int lid = get_new_label_id_(tr);
+
+    if(node->right->token.val.kw_type == token::KEYWORD_TYPE_ELSE) {
+        emit_jump_if_(tr, node->left, false, "else", lid);
+
+        emit_node_(tr, node->right->left);
+
+        emit_label(&tr->program, OPCODE_JMP,   label(&tr->program, "endif_%d", lid));
+        emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "else_%d", lid));
+
+        emit_node_(tr, node->right->right);
+    }
+    else {
+        emit_jump_if_(tr, node->left, false, "endif", lid);
+
+        emit_node_(tr, node->right);
+    }
+
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "endif_%d", lid));
+}
+
+// rotated to guard and do-while, same as stack translator
+static void emit_while_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    int lid = get_new_label_id_(tr);
+
+    emit_jump_if_(tr, node->left, false, "endwhile", lid);
+
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "beginwhile_%d", lid));
+
+    emit_node_(tr, node->right);
+
+    emit_jump_if_(tr, node->left, true, "beginwhile", lid);
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "endwhile_%d", lid));
+}
+
+static void emit_return_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    if(is_self_call_(tr, node->left)) {
+        emit_tail_call_(tr, node->left);
+        return;
+    }
+
+    Operand val = emit_expression_(tr, node->left, NULL);
+    regcode::emit(&tr->program, regcode::OPCODE_RET, {}, val, {});
+}
+
+static void emit_assignment_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    Operand dst = variable_(node->left);
+    Operand val = emit_expression_(tr, node->right, &dst);
+
+    if(!regcode::operand_equal(val, dst))
+        regcode::emit(&tr->program, regcode::OPCODE_MOV, dst, val, {});
+}
+
+static void emit_in_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    regcode::emit(&tr->program, regcode::OPCODE_IN, variable_(node->left), {}, {});
+}
+
+static void emit_out_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    Operand val = emit_expression_(tr, node->left, NULL);
+    regcode::emit(&tr->program, regcode::OPCODE_OUT, {}, val, {});
+}
+
+static void emit_ramset_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    Operand addr = emit_expression_(tr, node->left,  NULL);
+    Operand val  = emit_expression_(tr, node->right, NULL);
+
+    regcode::emit(&tr->program, regcode::OPCODE_STORE, {}, addr, val);
+}
+
+// frame is reused, arguments are moved to parameter slots, argument
+// reading parameter already overwritten is saved to temporary first
+static void emit_tail_call_(RegTranslator* tr, ast::ASTNode* node)
+{
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    ast::ASTNode* args[MAX_ARGS] = {};
+    size_t argcnt = collect_arguments_(node->right, args, 0);
+
+    Operand vals[MAX_ARGS] = {};
+    for(size_t i = 0; i < argcnt; ++i)
+        vals[i] = emit_expression_(tr, args[i], NULL);
+
+    for(size_t i = 0; i < argcnt; ++i) {
+        if(vals[i].kind != OPERAND_SLOT || (size_t) vals[i].val >= i)
+            continue;
+
+        Operand tmp = new_temp_(tr);
+        emit(&tr->program, OPCODE_MOV, tmp, vals[i], {});
+        vals[i] = tmp;
+    }
+
+    for(size_t i = 0; i < argcnt; ++i) {
+        if(!operand_equal(vals[i], slot((int32_t) i)))
+            emit(&tr->program, OPCODE_MOV, slot((int32_t) i), vals[i], {});
+    }
+
+    emit_label(&tr->program, OPCODE_JMP, get_func_label_(tr, node->left));
+}
+
+// result goes to dst if it is given and instruction computing it
+// allows that, returned operand holds value in any case
+static Operand emit_expression_(RegTranslator* tr, ast::ASTNode* node, Operand* dst)
+{
+    utils_assert(tr);
+    utils_assert(node);
+
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            return imm(node->token.val.num);
+
+        case token::TYPE_IDENTIFIER:
+            return variable_(node);
+
+        case token::TYPE_CALL:
+            return emit_call_(tr, node, dst);
+
+        case token::TYPE_OPERATOR:
+            break;
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            UTILS_LOGE(LOG_REGTRANSLATOR, "unsupported token in expression");
+            return imm(0);
+    }
+
+    Opcode cmd = get_arith_cmd_(node);
+    if(cmd == OPCODE_LABEL)
+        return emit_condition_(tr, node, dst);
+
+    // operands are read before result is written, so their temporaries are reused
+    size_t temps = tr->temps;
+
+    Operand a = node->left ? emit_expression_(tr, node->left, NULL) : imm(0); // unary minus
+    Operand b = {};
+    if(cmd != OPCODE_SQR)
+        b = emit_expression_(tr, node->right, NULL);
+
+    tr->temps = temps;
+
+    Operand res = get_dst_(tr, dst);
+    emit(&tr->program, cmd, res, a, b);
+
+    return res;
+}
+
+// arguments go straight to outgoing slots unless another call could clobber them
+static Operand emit_call_(RegTranslator* tr, ast::ASTNode* node, Operand* dst)
+{
+    LOG_TRACE;
+
+    using namespace regcode;
+
+    ast::ASTNode* args[MAX_ARGS] = {};
+    size_t argcnt = collect_arguments_(node->right, args, 0);
+
+    size_t temps = tr->temps;
+
+    if(!ast::holds_call(node->right)) {
+        for(size_t i = 0; i < argcnt; ++i) {
+            Operand arg = { .kind = OPERAND_ARG, .val = (int32_t) i };
+            Operand val = emit_expression_(tr, args[i], &arg);
+
+            if(!operand_equal(val, arg))
+                emit(&tr->program, OPCODE_MOV, arg, val, {});
+
+            tr->temps = temps;
+        }
+    }
+    else {
+        Operand vals[MAX_ARGS] = {};
+        for(size_t i = 0; i < argcnt; ++i)
+            vals[i] = emit_expression_(tr, args[i], NULL);
+
+        for(size_t i = 0; i < argcnt; ++i)
+            emit(&tr->program, OPCODE_MOV, { .kind = OPERAND_ARG, .val = (int32_t) i }, vals[i], {});
+
+        tr->temps = temps;
+    }
+
+    Operand res = get_dst_(tr, dst);
+    emit_call(&tr->program, res, get_func_label_(tr, node->left));
+
+    return res;
+}
+
+// comparison and logical operator values are 0 or 1
+static Operand emit_condition_(RegTranslator* tr, ast::ASTNode* node, Operand* dst)
+{
+    using namespace regcode;
+
+    int lid = get_new_label_id_(tr);
+
+    emit_jump_if_(tr, node, false, "cond_false", lid);
+
+    Operand res = get_dst_(tr, dst);
+
+    emit      (&tr->program, OPCODE_MOV, res, imm(1), {});
+    emit_label(&tr->program, OPCODE_JMP,   label(&tr->program, "cond_end_%d", lid));
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "cond_false_%d", lid));
+    emit      (&tr->program, OPCODE_MOV, res, imm(0), {});
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "cond_end_%d", lid));
+
+    return res;
+}
+
+// jumps to :<label>_<lid> if truth of cond equals when, falls through otherwise
+static void emit_jump_if_(RegTranslator* tr, ast::ASTNode* cond, bool when, const char* label, int lid)
+{
+    using namespace regcode;
+
+    size_t temps = tr->temps;
+    size_t target = regcode::label(&tr->program, "%s_%d", label, lid);
+
+    Opcode cmd = get_jump_cmd_(cond, when);
+    if(cmd != OPCODE_LABEL) {
+        Operand a = emit_expression_(tr, cond->left,  NULL);
+        Operand b = emit_expression_(tr, cond->right, NULL);
+        emit_branch(&tr->program, cmd, a, b, target);
+
+        tr->temps = temps;
+        return;
+    }
+
+    if(!is_logical_(cond)) {
+        Operand val = emit_expression_(tr, cond, NULL);
+        emit_branch(&tr->program, when ? OPCODE_JNE : OPCODE_JE, val, imm(0), target);
+
+        tr->temps = temps;
+        return;
+    }
+
+    bool is_and = cond->token.val.op_type == token::OPERATOR_TYPE_AND;
+
+    // a & b is false as soon as a is, a | b is true as soon as a is
+    if(is_and != when) {
+        emit_jump_if_(tr, cond->left,  when, label, lid);
+        emit_jump_if_(tr, cond->right, when, label, lid);
+        return;
+    }
+
+    int skip_lid = get_new_label_id_(tr);
+
+    emit_jump_if_(tr, cond->left,  !when, "logic_skip", skip_lid);
+    emit_jump_if_(tr, cond->right, when,  label, lid);
+    emit_label(&tr->program, OPCODE_LABEL, regcode::label(&tr->program, "logic_skip_%d", skip_lid));
+}
+
+static size_t collect_arguments_(ast::ASTNode* node, ast::ASTNode** args, size_t cnt)
+{
+    if(!node) return cnt;
+
+    if(node->token.type == token::TYPE_SEPARATOR)
+        return collect_arguments_(node->right, args, collect_arguments_(node->left, args, cnt));
+
+    utils_assert(cnt < MAX_ARGS);
+    args[cnt] = node;
+    return cnt + 1;
+}
+
+static void resolve_frame_(RegTranslator* tr, size_t begin, size_t frame_size)
+{
+    for(size_t i = begin; i < tr->program.code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(&tr->program, i);
+
+        resolve_operand_(&instr->dst, frame_size, tr->max_temps);
+        resolve_operand_(&instr->a,   frame_size, tr->max_temps);
+        resolve_operand_(&instr->b,   frame_size, tr->max_temps);
+
+        if(instr->opcode == regcode::OPCODE_CALL)
+            instr->frame = frame_size + tr->max_temps;
+    }
+}
+
+static void resolve_operand_(Operand* operand, size_t frame_size, size_t temps)
+{
+    switch(operand->kind) {
+        case regcode::OPERAND_TEMP:
+            *operand = regcode::slot((int32_t) (frame_size + (size_t) operand->val));
+            break;
+
+        case regcode::OPERAND_ARG:
+            *operand = regcode::slot((int32_t) (frame_size + temps + (size_t) operand->val));
+            break;
+
+        case regcode::OPERAND_NONE:
+        case regcode::OPERAND_IMM:
+        case regcode::OPERAND_SLOT:
+        default:
+            break;
+    }
+}
+
+static Operand new_temp_(RegTranslator* tr)
+{
+    Operand temp = { .kind = regcode::OPERAND_TEMP, .val = (int32_t) tr->temps++ };
+
+    if(tr->temps > tr->max_temps)
+        tr->max_temps = tr->temps;
+
+    return temp;
+}
+
+static Operand get_dst_(RegTranslator* tr, Operand* dst)
+{
+    return dst ? *dst : new_temp_(tr);
+}
+
+static Operand variable_(ast::ASTNode* node)
+{
+    utils_assert(node->token.inner_scope_id >= 1);
+
+    return regcode::slot(node->token.inner_scope_id - 1);
+}
+
+static size_t get_func_label_(RegTranslator* tr, ast::ASTNode* node)
+{
+    utils_assert(node);
+
+    return regcode::label(&tr->program, "func_%.*s",
+                          (int) node->token.val.str.len, node->token.val.str.str);
+}
+
+// parameters are first variables of function scope, listed in node->left
+static size_t count_parameters_(ast::ASTNode* node)
+{
+    if(!node) return 0;
+
+    if(node->token.type == token::TYPE_SEPARATOR)
+        return count_parameters_(node->left) + count_parameters_(node->right);
+
+    return 1;
+}
+
+// LABEL if node is not arithmetic operator
+static regcode::Opcode get_arith_cmd_(ast::ASTNode* node)
+{
+    switch(node->token.val.op_type) {
+        case token::OPERATOR_TYPE_ADD:  return regcode::OPCODE_ADD;
+        case token::OPERATOR_TYPE_SUB:  return regcode::OPCODE_SUB;
+        case token::OPERATOR_TYPE_MUL:  return regcode::OPCODE_MUL;
+        case token::OPERATOR_TYPE_DIV:  return regcode::OPCODE_DIV;
+        case token::OPERATOR_TYPE_POW:  return regcode::OPCODE_POW;
+        case token::OPERATOR_TYPE_SQRT: return regcode::OPCODE_SQR;
+
+        case token::OPERATOR_TYPE_OR:
+        case token::OPERATOR_TYPE_AND:
+        case token::OPERATOR_TYPE_EQ:
+        case token::OPERATOR_TYPE_NEQ:
+        case token::OPERATOR_TYPE_GT:
+        case token::OPERATOR_TYPE_LT:
+        case token::OPERATOR_TYPE_GEQ:
+        case token::OPERATOR_TYPE_LEQ:
+        case token::OPERATOR_TYPE_ASSIGN:
+        default:
+            return regcode::OPCODE_LABEL;
+    }
+}
+
+// jump taken when comparison is true or, with when unset, when it is false,
+// LABEL if node is not comparison
+static regcode::Opcode get_jump_cmd_(ast::ASTNode* node, bool when)
+{
+    if(node->token.type != token::TYPE_OPERATOR)
+        return regcode::OPCODE_LABEL;
+
+    switch(node->token.val.op_type) {
+        case token::OPERATOR_TYPE_EQ:  return when ? regcode::OPCODE_JE  : regcode::OPCODE_JNE;
+        case token::OPERATOR_TYPE_NEQ: return when ? regcode::OPCODE_JNE : regcode::OPCODE_JE;
+        case token::OPERATOR_TYPE_GT:  return when ? regcode::OPCODE_JA  : regcode::OPCODE_JBE;
+        case token::OPERATOR_TYPE_LT:  return when ? regcode::OPCODE_JB  : regcode::OPCODE_JAE;
+        case token::OPERATOR_TYPE_GEQ: return when ? regcode::OPCODE_JAE : regcode::OPCODE_JB;
+        case token::OPERATOR_TYPE_LEQ: return when ? regcode::OPCODE_JBE : regcode::OPCODE_JA;
+
+        case token::OPERATOR_TYPE_ADD:
+        case token::OPERATOR_TYPE_SUB:
+        case token::OPERATOR_TYPE_MUL:
+        case token::OPERATOR_TYPE_DIV:
+        case token::OPERATOR_TYPE_POW:
+        case token::OPERATOR_TYPE_SQRT:
+        case token::OPERATOR_TYPE_OR:
+        case token::OPERATOR_TYPE_AND:
+        case token::OPERATOR_TYPE_ASSIGN:
+        default:
+            return regcode::OPCODE_LABEL;
+    }
+}
+
+static int get_new_label_id_(RegTranslator* tr)
+{
+    return tr->label_id++;
+}
+
+static bool is_logical_(ast::ASTNode* node)
+{
+    return node->token.type == token::TYPE_OPERATOR
+           && (node->token.val.op_type == token::OPERATOR_TYPE_AND
+               || node->token.val.op_type == token::OPERATOR_TYPE_OR);
+}
+
+static bool is_self_call_(RegTranslator* tr, ast::ASTNode* node)
+{
+    if(!node || node->token.type != token::TYPE_CALL)
+        return false;
+
+    return ast::find_enviroment(tr->astree, &node->left->token.val.str, SYMBOL_TYPE_FUNCTION)
+           == tr->current_env;
+}
+
+#undef LOG_TRACE
+
+} // compiler
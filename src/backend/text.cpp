@@ -0,0 +1,82 @@
+#include "text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "memutils.h"
+
+namespace compiler {
+namespace text {
+
+void reserve(Text* text, size_t add)
+{
+    utils_assert(text);
+
+    if(text->size + add <= text->cap)
+        return;
+
+    size_t cap = text->cap ? text->cap : 1;
+    while(cap < text->size + add)
+        cap *= 2;
+
+    char* buf = (char*) realloc(text->buf, cap);
+    utils_assert(buf);
+
+    text->buf = buf;
+    text->cap = cap;
+}
+
+void put_str(Text* text, const char* str)
+{
+    utils_assert(text);
+    utils_assert(str);
+
+    size_t len = strlen(str);
+
+    reserve(text, len);
+    memcpy(text->buf + text->size, str, len);
+    text->size += len;
+}
+
+void put_int(Text* text, int val, bool force_sign)
+{
+    utils_assert(text);
+
+    // sign and digits of 32-bit int
+    const size_t int_len = 12;
+    char digits[int_len] = "";
+
+    // unsigned negation keeps INT_MIN representable
+    unsigned abs = val < 0 ? 0u - (unsigned) val : (unsigned) val;
+
+    size_t pos = int_len;
+    do {
+        digits[--pos] = (char) ('0' + abs % 10);
+        abs /= 10;
+    } while(abs);
+
+    if(val < 0)
+        digits[--pos] = '-';
+    else if(force_sign)
+        digits[--pos] = '+';
+
+    reserve(text, int_len - pos);
+    memcpy(text->buf + text->size, digits + pos, int_len - pos);
+    text->size += int_len - pos;
+}
+
+void flush(Text* text, FILE* stream)
+{
+    utils_assert(text);
+    utils_assert(stream);
+
+    fwrite(text->buf, 1, text->size, stream);
+
+    NFREE(text->buf);
+    text->size = 0;
+    text->cap  = 0;
+}
+
+} // text
+} // compiler
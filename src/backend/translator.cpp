@@ -3,6 +3,10 @@
 #include <stdio.h>
 
 #include "ast.h"
+#include "bytecode.h"
+#include "instr.h"
+#include "layout.h"
+#include "peephole.h"
 #include "logutils.h"
 #include "symbol.h"
 #include "token.h"
@@ -26,19 +30,52 @@ static void emit_in_          (Translator* tr, ast::ASTNode* node);
 static void emit_out_         (Translator* tr, ast::ASTNode* node);
 static void emit_ramset_      (Translator* tr, ast::ASTNode* node);
 static void emit_call_        (Translator* tr, ast::ASTNode* node);
-
-static const char* get_func_name_            (ast::ASTNode* node);
-static void        emit_comparasion_operator_(Translator* tr, ast::ASTNode* node, const char* cmd);
+static void emit_tail_call_   (Translator* tr, ast::ASTNode* node);
+
+static size_t      emit_arguments_           (Translator* tr, ast::ASTNode* node);
+static size_t      get_func_label_           (Translator* tr, ast::ASTNode* node, const char* suffix);
+static void        emit_comparasion_operator_(Translator* tr, ast::ASTNode* node, instr::Opcode cmd);
+static void        emit_logical_operator_    (Translator* tr, ast::ASTNode* node);
+static void        emit_jump_if_             (Translator* tr, ast::ASTNode* cond, bool when,
+                                              const char* label, int lid);
+static bool        is_logical_               (ast::ASTNode* node);
+static instr::Opcode get_jump_cmd_           (ast::ASTNode* node, bool when);
 static int         get_new_label_id_         (Translator* tr);
+static bool        is_expression_            (ast::ASTNode* node);
+static bool        is_self_call_             (Translator* tr, ast::ASTNode* node);
 
 void emit_program(Translator* tr)
 {
-    fprintf(tr->file, "CALL :func_main\n");
-    fprintf(tr->file, "PUSHR A0\n");
-    fprintf(tr->file, "DRAW\n");
-    fprintf(tr->file, "HLT\n\n");
+    using namespace instr;
+
+    ctor(&tr->program);
+
+    emit_label(&tr->program, OPCODE_CALL, label(&tr->program, "func_main"));
+    emit_reg  (&tr->program, OPCODE_PUSHR, REGISTER_A0);
+    emit      (&tr->program, OPCODE_DRAW);
+    emit      (&tr->program, OPCODE_HLT);
 
     emit_node_(tr, tr->astree->root);
+
+    peephole::optimize(&tr->program);
+    peephole::log_stats();
+
+    layout::optimize(&tr->program);
+
+    switch(tr->format) {
+        case OUTPUT_FORMAT_BYTECODE:
+            bytecode::write(&tr->program, tr->file);
+            bytecode::log_stats();
+            break;
+
+        case OUTPUT_FORMAT_ASM:
+        case OUTPUT_FORMAT_X86_64:
+        default:
+            write(&tr->program, tr->file);
+            break;
+    }
+
+    dtor(&tr->program);
 }
 
 #define LOG_TRACE                                 \
@@ -64,6 +101,12 @@ void emit_node_(Translator* tr, ast::ASTNode* node)
 
         case token::TYPE_SEPARATOR:
             if(node->left) emit_node_(tr, node->left);
+
+            // value of expression statement is not used
+            if(node->left && node->token.val.sep_type == token::SEPARATOR_TYPE_SEMICOLON
+               && is_expression_(node->left))
+                instr::emit_reg(&tr->program, instr::OPCODE_POPR, instr::REGISTER_T0);
+
             if(node->right) emit_node_(tr, node->right);
             break;
 
@@ -102,67 +145,63 @@ void emit_operator_(Translator* tr, ast::ASTNode* node)
         case OPERATOR_TYPE_ADD:
             emit_node_(tr, node->left);
             emit_node_(tr, node->right);
-            fprintf(tr->file, "ADD\n\n");
+            instr::emit(&tr->program, instr::OPCODE_ADD);
             break;
 
         case OPERATOR_TYPE_SUB:
-            emit_node_(tr, node->left);
+            if(node->left)
+                emit_node_(tr, node->left);
+            else
+                instr::emit_imm(&tr->program, instr::OPCODE_PUSH, 0); // unary minus
             emit_node_(tr, node->right);
-            fprintf(tr->file, "SUB\n\n");
+            instr::emit(&tr->program, instr::OPCODE_SUB);
             break;
 
         case OPERATOR_TYPE_MUL:
             emit_node_(tr, node->left);
             emit_node_(tr, node->right);
-            fprintf(tr->file, "MUL\n\n");
+            instr::emit(&tr->program, instr::OPCODE_MUL);
             break;
 
         case OPERATOR_TYPE_DIV:
             emit_node_(tr, node->left);
             emit_node_(tr, node->right);
-            fprintf(tr->file, "DIV\n\n");
+            instr::emit(&tr->program, instr::OPCODE_DIV);
             break;
 
         case OPERATOR_TYPE_POW:
             emit_node_(tr, node->left);
             emit_node_(tr, node->right);
-            fprintf(tr->file, "POW\n\n");
+            instr::emit(&tr->program, instr::OPCODE_POW);
             break;
 
         case OPERATOR_TYPE_OR:
-            // emit_node_(tr, node->left);
-            // emit_node_(tr, node->right);
-            // fprintf(tr->file, "MUL\n");
-            break;
-
         case OPERATOR_TYPE_AND:
-            // emit_node_(tr, node->left);
-            // emit_node_(tr, node->right);
-            // fprintf(tr->file, "MUL\n");
+            emit_logical_operator_(tr, node);
             break;
 
         case OPERATOR_TYPE_EQ:
-            emit_comparasion_operator_(tr, node, "JE");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JE);
             break;
 
         case OPERATOR_TYPE_NEQ:
-            emit_comparasion_operator_(tr, node, "JNE");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JNE);
             break;
 
         case OPERATOR_TYPE_GT:
-            emit_comparasion_operator_(tr, node, "JA");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JA);
             break;
 
         case OPERATOR_TYPE_LT:
-            emit_comparasion_operator_(tr, node, "JB");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JB);
             break;
 
         case OPERATOR_TYPE_GEQ:
-            emit_comparasion_operator_(tr, node, "JAE");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JAE);
             break;
 
         case OPERATOR_TYPE_LEQ:
-            emit_comparasion_operator_(tr, node, "JBE");
+            emit_comparasion_operator_(tr, node, instr::OPCODE_JBE);
             break;
 
         case OPERATOR_TYPE_ASSIGN:
@@ -171,7 +210,7 @@ void emit_operator_(Translator* tr, ast::ASTNode* node)
 
         case OPERATOR_TYPE_SQRT:
             emit_node_(tr, node->left);
-            fprintf(tr->file, "SQR\n");
+            instr::emit(&tr->program, instr::OPCODE_SQR);
             break;
 
         default:
@@ -179,20 +218,76 @@ void emit_operator_(Translator* tr, ast::ASTNode* node)
     }
 }
 
-static void emit_comparasion_operator_(Translator* tr, ast::ASTNode* node, const char* cmd)
+static void emit_comparasion_operator_(Translator* tr, ast::ASTNode* node, instr::Opcode cmd)
 {
+    using namespace instr;
+
     int lid = get_new_label_id_(tr);
+    size_t true_label  = label(&tr->program, "%s_true_%d",  opcode_str(cmd), lid);
+    size_t false_label = label(&tr->program, "%s_false_%d", opcode_str(cmd), lid);
 
     emit_node_(tr, node->left);
     emit_node_(tr, node->right);
-    fprintf(tr->file, "SUB\n");
-    fprintf(tr->file, "PUSH 0\n");
-    fprintf(tr->file, "%s :%s_true_%d\n", cmd, cmd, lid);
-    fprintf(tr->file, "PUSH 0\n");
-    fprintf(tr->file, "JMP :%s_false_%d\n", cmd, lid);
-    fprintf(tr->file, ":%s_true_%d\n", cmd, lid);
-    fprintf(tr->file, "PUSH 1\n");
-    fprintf(tr->file, ":%s_false_%d\n\n", cmd, lid);
+    emit      (&tr->program, OPCODE_SUB);
+    emit_imm  (&tr->program, OPCODE_PUSH, 0);
+    emit_label(&tr->program, cmd, true_label);
+    emit_imm  (&tr->program, OPCODE_PUSH, 0);
+    emit_label(&tr->program, OPCODE_JMP, false_label);
+    emit_label(&tr->program, OPCODE_LABEL, true_label);
+    emit_imm  (&tr->program, OPCODE_PUSH, 1);
+    emit_label(&tr->program, OPCODE_LABEL, false_label);
+}
+
+// value of logical operator is 0 or 1, right operand
+// is evaluated only if left one does not decide it
+static void emit_logical_operator_(Translator* tr, ast::ASTNode* node)
+{
+    using namespace instr;
+
+    int lid = get_new_label_id_(tr);
+
+    emit_jump_if_(tr, node, false, "logic_false", lid);
+    emit_imm  (&tr->program, OPCODE_PUSH, 1);
+    emit_label(&tr->program, OPCODE_JMP, label(&tr->program, "logic_end_%d", lid));
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "logic_false_%d", lid));
+    emit_imm  (&tr->program, OPCODE_PUSH, 0);
+    emit_label(&tr->program, OPCODE_LABEL, label(&tr->program, "logic_end_%d", lid));
+}
+
+// jumps to :<label>_<lid> if truth of cond equals when, falls through otherwise
+static void emit_jump_if_(Translator* tr, ast::ASTNode* cond, bool when, const char* label, int lid)
+{
+    // comparison jumps on its operands directly, without materializing 0/1
+    instr::Opcode cmd = get_jump_cmd_(cond, when);
+    if(cmd != instr::OPCODE_LABEL) {
+        emit_node_(tr, cond->left);
+        emit_node_(tr, cond->right);
+        instr::emit_label(&tr->program, cmd, instr::label(&tr->program, "%s_%d", label, lid));
+        return;
+    }
+
+    if(!is_logical_(cond)) {
+        emit_node_(tr, cond);
+        instr::emit_imm  (&tr->program, instr::OPCODE_PUSH, 0);
+        instr::emit_label(&tr->program, when ? instr::OPCODE_JNE : instr::OPCODE_JE,
+                          instr::label(&tr->program, "%s_%d", label, lid));
+        return;
+    }
+
+    bool is_and = cond->token.val.op_type == token::OPERATOR_TYPE_AND;
+
+    // a & b is false as soon as a is, a | b is true as soon as a is
+    if(is_and != when) {
+        emit_jump_if_(tr, cond->left,  when, label, lid);
+        emit_jump_if_(tr, cond->right, when, label, lid);
+        return;
+    }
+
+    int skip_lid = get_new_label_id_(tr);
+
+    emit_jump_if_(tr, cond->left,  !when, "logic_skip", skip_lid);
+    emit_jump_if_(tr, cond->right, when,  label, lid);
+    instr::emit_label(&tr->program, instr::OPCODE_LABEL, instr::label(&tr->program, "logic_skip_%d", skip_lid));
 }
 
 void emit_keyword_(Translator* tr, ast::ASTNode* node)
@@ -249,17 +344,16 @@ void emit_while_(Translator* tr, ast::ASTNode* node)
 
     int lid = get_new_label_id_(tr);
 
-    fprintf(tr->file, ":beginwhile_%d\n", lid);
+    // rotated to guard and do-while, iteration ends with single
+    // backward branch instead of condition jump plus JMP
+    emit_jump_if_(tr, node->left, false, "endwhile", lid);
 
-    emit_node_(tr, node->left);
+    instr::emit_label(&tr->program, instr::OPCODE_LABEL, instr::label(&tr->program, "beginwhile_%d", lid));
 
-    fprintf(tr->file, "PUSH 0\n");
-    fprintf(tr->file, "JE :endwhile_%d\n", lid);
-    
     emit_node_(tr, node->right);
 
-    fprintf(tr->file, "JMP :beginwhile_%d\n", lid);
-    fprintf(tr->file, ":endwhile_%d\n\n", lid);
+    emit_jump_if_(tr, node->left, true, "beginwhile", lid);
+    instr::emit_label(&tr->program, instr::OPCODE_LABEL, instr::label(&tr->program, "endwhile_%d", lid));
 }
 
 void emit_if_(Translator* tr, ast::ASTNode* node)
@@ -271,45 +365,49 @@ void emit_if_(Translator* tr, ast::ASTNode* node)
 
     int lid = get_new_label_id_(tr);
 
-    emit_node_(tr, node->left);
-    
-    fprintf(tr->file, "PUSH 0\n");
-
     if(node->right->token.val.kw_type == token::KEYWORD_TYPE_ELSE) {
-        fprintf(tr->file, "JE :else_%d\n", lid);
+        emit_jump_if_(tr, node->left, false, "else", lid);
 
         emit_node_(tr, node->right->left);
 
-        fprintf(tr->file, "JMP :endif_%d\n", lid);
-        fprintf(tr->file, ":else_%d\n", lid);
+        instr::emit_label(&tr->program, instr::OPCODE_JMP,   instr::label(&tr->program, "endif_%d", lid));
+        instr::emit_label(&tr->program, instr::OPCODE_LABEL, instr::label(&tr->program, "else_%d", lid));
 
         emit_node_(tr, node->right->right);
 
     }
     else {
-        fprintf(tr->file, "JE :endif_%d\n", lid);
+        emit_jump_if_(tr, node->left, false, "endif", lid);
 
         emit_node_(tr, node->right);
     }
 
-    fprintf(tr->file, ":endif_%d\n\n", lid);;
+    instr::emit_label(&tr->program, instr::OPCODE_LABEL, instr::label(&tr->program, "endif_%d", lid));
 }
 
 static void emit_return_(Translator* tr, ast::ASTNode* node)
 {
+    if(is_self_call_(tr, node->left)) {
+        emit_tail_call_(tr, node->left);
+        return;
+    }
+
     emit_node_(tr, node->left);
 
-    tr->current_env = get_enviroment(tr->astree, node->token.scope_id);
+    // RET token carries no scope, frame is the one of enclosing function
+    utils_assert(tr->current_env);
     size_t stackframe_size = tr->current_env->symbol_table.size - 1;
 
-    fprintf(tr->file, "POPR A0\n");
+    using namespace instr;
+
+    emit_reg(&tr->program, OPCODE_POPR, REGISTER_A0);
 
-    fprintf(tr->file, "PUSHR SP\n");
-    fprintf(tr->file, "PUSH %lu\n", stackframe_size);
-    fprintf(tr->file, "SUB\n");
-    fprintf(tr->file, "POPR SP\n");
+    emit_reg(&tr->program, OPCODE_PUSHR, REGISTER_SP);
+    emit_imm(&tr->program, OPCODE_PUSH, (int) stackframe_size);
+    emit    (&tr->program, OPCODE_SUB);
+    emit_reg(&tr->program, OPCODE_POPR, REGISTER_SP);
 
-    fprintf(tr->file, "RET\n\n");
+    emit(&tr->program, OPCODE_RET);
 }
 
 static void emit_num_literal_(Translator* tr, ast::ASTNode* node)
@@ -319,7 +417,7 @@ static void emit_num_literal_(Translator* tr, ast::ASTNode* node)
 
     LOG_TRACE;
 
-    fprintf(tr->file, "PUSH %d\n\n", node->token.val.num);
+    instr::emit_imm(&tr->program, instr::OPCODE_PUSH, node->token.val.num);
 }
 
 static void emit_identifier_(Translator* tr, ast::ASTNode* node)
@@ -361,12 +459,16 @@ static void emit_function_(Translator* tr, ast::ASTNode* node)
     tr->current_env = get_enviroment(tr->astree, node->token.scope_id);
     size_t stackframe_size = tr->current_env->symbol_table.size - 1;
 
-    fprintf(tr->file, "%s\n", get_func_name_(node));
+    using namespace instr;
+
+    emit_label(&tr->program, OPCODE_LABEL, get_func_label_(tr, node, ""));
 
-    fprintf(tr->file, "PUSH %lu\n", stackframe_size);
-    fprintf(tr->file, "PUSHR SP\n");
-    fprintf(tr->file, "ADD\n");
-    fprintf(tr->file, "POPR SP\n\n");
+    emit_imm(&tr->program, OPCODE_PUSH, (int) stackframe_size);
+    emit_reg(&tr->program, OPCODE_PUSHR, REGISTER_SP);
+    emit    (&tr->program, OPCODE_ADD);
+    emit_reg(&tr->program, OPCODE_POPR, REGISTER_SP);
+
+    emit_label(&tr->program, OPCODE_LABEL, get_func_label_(tr, node, "_entry"));
 
     emit_node_(tr, node->right);
 }
@@ -382,7 +484,7 @@ static void emit_variable_(Translator* tr, ast::ASTNode* node)
 
     // value
     utils_assert(node->token.inner_scope_id >= 0);
-    fprintf(tr->file, "PUSHM [SP-%d]\n\n", node->token.inner_scope_id - 1);
+    instr::emit_mem(&tr->program, instr::OPCODE_PUSHM, instr::REGISTER_SP, -(node->token.inner_scope_id - 1));
 }
 
 static void emit_assignment_(Translator* tr, ast::ASTNode* node)
@@ -395,7 +497,7 @@ static void emit_assignment_(Translator* tr, ast::ASTNode* node)
     emit_node_(tr, node->right);
 
     utils_assert(node->left->token.inner_scope_id >= 0);
-    fprintf(tr->file, "POPM [SP-%d]\n\n", node->left->token.inner_scope_id - 1);
+    instr::emit_mem(&tr->program, instr::OPCODE_POPM, instr::REGISTER_SP, -(node->left->token.inner_scope_id - 1));
 }
 
 static void emit_in_(Translator* tr, ast::ASTNode* node)
@@ -405,10 +507,10 @@ static void emit_in_(Translator* tr, ast::ASTNode* node)
 
     LOG_TRACE;
 
-    fprintf(tr->file, "IN\n");
+    instr::emit(&tr->program, instr::OPCODE_IN);
 
     utils_assert(node->left->token.inner_scope_id >= 0);
-    fprintf(tr->file, "POPM [SP-%d]\n\n", node->left->token.inner_scope_id - 1);
+    instr::emit_mem(&tr->program, instr::OPCODE_POPM, instr::REGISTER_SP, -(node->left->token.inner_scope_id - 1));
 }
 
 static void emit_out_(Translator* tr, ast::ASTNode* node)
@@ -420,7 +522,7 @@ static void emit_out_(Translator* tr, ast::ASTNode* node)
     
     emit_node_(tr, node->left);
 
-    fprintf(tr->file, "OUT\n\n");
+    instr::emit(&tr->program, instr::OPCODE_OUT);
 }
 
 static void emit_ramset_(Translator* tr, ast::ASTNode* node)
@@ -430,11 +532,11 @@ static void emit_ramset_(Translator* tr, ast::ASTNode* node)
 
     LOG_TRACE;
     emit_node_(tr, node->left);
-    fprintf(tr->file, "POPR T0\n");
+    instr::emit_reg(&tr->program, instr::OPCODE_POPR, instr::REGISTER_T0);
 
     static const int RAM_STACK_SIZE = 20;
     emit_node_(tr, node->right);
-    fprintf(tr->file, "POPM [T0+%d]\n\n", RAM_STACK_SIZE);
+    instr::emit_mem(&tr->program, instr::OPCODE_POPM, instr::REGISTER_T0, RAM_STACK_SIZE);
 }
 
 static void emit_call_(Translator* tr, ast::ASTNode* node)
@@ -444,37 +546,55 @@ static void emit_call_(Translator* tr, ast::ASTNode* node)
 
     LOG_TRACE;
     
-    Env* func_env = get_enviroment(tr->astree, node->token.scope_id);
+    Env* func_env = ast::find_enviroment(tr->astree, &node->left->token.val.str, SYMBOL_TYPE_FUNCTION);
+    utils_assert(func_env);
+
     size_t stackframe_size = func_env->symbol_table.size - 1;
 
-    ast::ASTNode* arg = node->right;
-    int argcnt = 0;
-    while(arg && arg->token.type == token::TYPE_SEPARATOR) {
-        emit_node_(tr, arg->right);
-        fprintf(tr->file, "POPM [SP+%lu]\n", stackframe_size - (size_t) argcnt);
-        arg = arg->left;
-        argcnt++;
-    }
-    if(arg) {
-        emit_node_(tr, arg);
-        fprintf(tr->file, "POPM [SP+%lu]\n", stackframe_size - (size_t) argcnt);
-    }
+    // arguments are evaluated first, so nested calls can not clobber
+    // slots already filled, then popped into parameters last to first
+    size_t argcnt = emit_arguments_(tr, node->right);
+
+    for(size_t i = argcnt; i-- > 0;)
+        instr::emit_mem(&tr->program, instr::OPCODE_POPM, instr::REGISTER_SP, (int)(stackframe_size - i));
 
-    fprintf(tr->file, "CALL %s\n", get_func_name_(node->left));
-    fprintf(tr->file, "PUSHR A0\n\n");
+    instr::emit_label(&tr->program, instr::OPCODE_CALL, get_func_label_(tr, node->left, ""));
+    instr::emit_reg  (&tr->program, instr::OPCODE_PUSHR, instr::REGISTER_A0);
 }
 
-static const char* get_func_name_(ast::ASTNode* node)
+// frame is reused, arguments go straight to parameter slots
+static void emit_tail_call_(Translator* tr, ast::ASTNode* node)
 {
+    utils_assert(tr);
     utils_assert(node);
 
-    const size_t buf_size = 100;
-    static char buffer[buf_size] = "";
-    
-    snprintf(buffer, buf_size, ":func_%.*s", 
-             (int) node->token.val.str.len, node->token.val.str.str);
+    LOG_TRACE;
+
+    size_t argcnt = emit_arguments_(tr, node->right);
+
+    for(size_t i = argcnt; i-- > 0;)
+        instr::emit_mem(&tr->program, instr::OPCODE_POPM, instr::REGISTER_SP, -(int) i);
+
+    instr::emit_label(&tr->program, instr::OPCODE_JMP, get_func_label_(tr, node->left, "_entry"));
+}
+
+static size_t emit_arguments_(Translator* tr, ast::ASTNode* node)
+{
+    if(!node) return 0;
+
+    if(node->token.type == token::TYPE_SEPARATOR)
+        return emit_arguments_(tr, node->left) + emit_arguments_(tr, node->right);
 
-    return buffer;
+    emit_node_(tr, node);
+    return 1;
+}
+
+static size_t get_func_label_(Translator* tr, ast::ASTNode* node, const char* suffix)
+{
+    utils_assert(node);
+
+    return instr::label(&tr->program, "func_%.*s%s",
+                        (int) node->token.val.str.len, node->token.val.str.str, suffix);
 }
 
 static int get_new_label_id_(Translator* tr)
@@ -482,6 +602,72 @@ static int get_new_label_id_(Translator* tr)
     return tr->label_id++;
 }
 
+static bool is_expression_(ast::ASTNode* node)
+{
+    switch(node->token.type) {
+        case token::TYPE_OPERATOR:
+            return node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN;
+
+        case token::TYPE_IDENTIFIER:
+        case token::TYPE_NUM_LITERAL:
+        case token::TYPE_CALL:
+            return true;
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return false;
+    }
+}
+
+static bool is_logical_(ast::ASTNode* node)
+{
+    return node->token.type == token::TYPE_OPERATOR
+           && (node->token.val.op_type == token::OPERATOR_TYPE_AND
+               || node->token.val.op_type == token::OPERATOR_TYPE_OR);
+}
+
+// jump taken when comparison is true or, with when unset, when it is false,
+// LABEL if node is not comparison
+static instr::Opcode get_jump_cmd_(ast::ASTNode* node, bool when)
+{
+    if(node->token.type != token::TYPE_OPERATOR)
+        return instr::OPCODE_LABEL;
+
+    switch(node->token.val.op_type) {
+        case token::OPERATOR_TYPE_EQ:  return when ? instr::OPCODE_JE  : instr::OPCODE_JNE;
+        case token::OPERATOR_TYPE_NEQ: return when ? instr::OPCODE_JNE : instr::OPCODE_JE;
+        case token::OPERATOR_TYPE_GT:  return when ? instr::OPCODE_JA  : instr::OPCODE_JBE;
+        case token::OPERATOR_TYPE_LT:  return when ? instr::OPCODE_JB  : instr::OPCODE_JAE;
+        case token::OPERATOR_TYPE_GEQ: return when ? instr::OPCODE_JAE : instr::OPCODE_JB;
+        case token::OPERATOR_TYPE_LEQ: return when ? instr::OPCODE_JBE : instr::OPCODE_JA;
+
+        case token::OPERATOR_TYPE_ADD:
+        case token::OPERATOR_TYPE_SUB:
+        case token::OPERATOR_TYPE_MUL:
+        case token::OPERATOR_TYPE_DIV:
+        case token::OPERATOR_TYPE_POW:
+        case token::OPERATOR_TYPE_OR:
+        case token::OPERATOR_TYPE_AND:
+        case token::OPERATOR_TYPE_ASSIGN:
+        case token::OPERATOR_TYPE_SQRT:
+        default:
+            return instr::OPCODE_LABEL;
+    }
+}
+
+static bool is_self_call_(Translator* tr, ast::ASTNode* node)
+{
+    if(!node || node->token.type != token::TYPE_CALL)
+        return false;
+
+    return ast::find_enviroment(tr->astree, &node->left->token.val.str, SYMBOL_TYPE_FUNCTION)
+           == tr->current_env;
+}
+
 #undef LOG_TRACE
 
 } // compiler
@@ -0,0 +1,530 @@
+#include "x86.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "text.h"
+#include "utils.h"
+
+namespace compiler {
+namespace x86 {
+
+ATTR_UNUSED static const char* LOG_X86 = "X86";
+
+using regcode::Operand;
+
+const size_t SLOT_SIZE   = 4;
+const size_t STACK_ALIGN = 16;
+const size_t PUSH_SIZE   = 8;
+
+const size_t ARG_REGISTERS_CNT = 6;
+static const char* ARG_REGISTERS[ARG_REGISTERS_CNT] = { "%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d" };
+
+// entered with stack aligned as after call, errors are printed
+// to stderr and end program with exit code 1, VRAM is 100x100
+static const char* RUNTIME =
+    "\n"
+    "    .section .rodata\n"
+    "rt_fmt_in:\n"
+    "    .string \"%d\"\n"
+    "rt_fmt_out:\n"
+    "    .string \"%d\\n\"\n"
+    "rt_fmt_err:\n"
+    "    .string \"%s\\n\"\n"
+    "rt_msg_div:\n"
+    "    .string \"division by zero\"\n"
+    "rt_msg_addr:\n"
+    "    .string \"memory access out of bounds\"\n"
+    "rt_msg_in:\n"
+    "    .string \"failed to read input\"\n"
+    "\n"
+    "    .bss\n"
+    "    .align 16\n"
+    "rt_vram:\n"
+    "    .zero 40000\n"
+    "\n"
+    "    .text\n"
+    "rt_fail:\n"
+    "    subq $8, %rsp\n"
+    "    movq %rdi, %rdx\n"
+    "    leaq rt_fmt_err(%rip), %rsi\n"
+    "    movl $2, %edi\n"
+    "    xorl %eax, %eax\n"
+    "    call dprintf@PLT\n"
+    "    movl $1, %edi\n"
+    "    call exit@PLT\n"
+    "\n"
+    "# eax = eax / ecx, INT_MIN / -1 wraps\n"
+    "rt_div:\n"
+    "    testl %ecx, %ecx\n"
+    "    je 2f\n"
+    "    cmpl $-1, %ecx\n"
+    "    je 1f\n"
+    "    cltd\n"
+    "    idivl %ecx\n"
+    "    ret\n"
+    "1:\n"
+    "    negl %eax\n"
+    "    ret\n"
+    "2:\n"
+    "    leaq rt_msg_div(%rip), %rdi\n"
+    "    jmp rt_fail\n"
+    "\n"
+    "# eax = (int) pow(edi, esi)\n"
+    "rt_pow:\n"
+    "    subq $8, %rsp\n"
+    "    cvtsi2sdl %edi, %xmm0\n"
+    "    cvtsi2sdl %esi, %xmm1\n"
+    "    call pow@PLT\n"
+    "    cvttsd2si %xmm0, %eax\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    "\n"
+    "# eax = edi > 0 ? (int) sqrt(edi) : 0\n"
+    "rt_sqrt:\n"
+    "    xorl %eax, %eax\n"
+    "    testl %edi, %edi\n"
+    "    jle 1f\n"
+    "    cvtsi2sdl %edi, %xmm0\n"
+    "    sqrtsd %xmm0, %xmm0\n"
+    "    cvttsd2si %xmm0, %eax\n"
+    "1:\n"
+    "    ret\n"
+    "\n"
+    "rt_in:\n"
+    "    subq $24, %rsp\n"
+    "    leaq rt_fmt_in(%rip), %rdi\n"
+    "    leaq 12(%rsp), %rsi\n"
+    "    xorl %eax, %eax\n"
+    "    call scanf@PLT\n"
+    "    cmpl $1, %eax\n"
+    "    jne 1f\n"
+    "    movl 12(%rsp), %eax\n"
+    "    addq $24, %rsp\n"
+    "    ret\n"
+    "1:\n"
+    "    leaq rt_msg_in(%rip), %rdi\n"
+    "    call rt_fail\n"
+    "\n"
+    "rt_out:\n"
+    "    subq $8, %rsp\n"
+    "    movl %edi, %esi\n"
+    "    leaq rt_fmt_out(%rip), %rdi\n"
+    "    xorl %eax, %eax\n"
+    "    call printf@PLT\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    "\n"
+    "# VRAM[edi] = esi\n"
+    "rt_ramset:\n"
+    "    cmpl $10000, %edi\n"
+    "    jae 1f\n"
+    "    movl %edi, %edi\n"
+    "    leaq rt_vram(%rip), %rax\n"
+    "    movl %esi, (%rax,%rdi,4)\n"
+    "    ret\n"
+    "1:\n"
+    "    leaq rt_msg_addr(%rip), %rdi\n"
+    "    jmp rt_fail\n"
+    "\n"
+    "# prints VRAM when anything was drawn, '.' for empty cells\n"
+    "rt_draw:\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    leaq rt_vram(%rip), %r12\n"
+    "    xorl %ebx, %ebx\n"
+    "1:\n"
+    "    cmpl $0, (%r12,%rbx,4)\n"
+    "    jne 2f\n"
+    "    incq %rbx\n"
+    "    cmpq $10000, %rbx\n"
+    "    jb 1b\n"
+    "    jmp 6f\n"
+    "2:\n"
+    "    xorl %ebx, %ebx\n"
+    "    xorl %r13d, %r13d\n"
+    "3:\n"
+    "    movl (%r12,%rbx,4), %edi\n"
+    "    testl %edi, %edi\n"
+    "    jne 4f\n"
+    "    movl $46, %edi\n"
+    "4:\n"
+    "    call putchar@PLT\n"
+    "    incl %r13d\n"
+    "    cmpl $100, %r13d\n"
+    "    jb 5f\n"
+    "    movl $10, %edi\n"
+    "    call putchar@PLT\n"
+    "    xorl %r13d, %r13d\n"
+    "5:\n"
+    "    incq %rbx\n"
+    "    cmpq $10000, %rbx\n"
+    "    jb 3b\n"
+    "6:\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    ret\n"
+    "\n"
+    "    .section .note.GNU-stack,\"\",@progbits\n";
+
+static void write_prologue_(text::Text* text, const char* name, size_t frame_bytes);
+
+static void write_params_(text::Text* text, size_t params);
+
+static void write_instr_(regcode::Program* program, regcode::Instr* instr,
+                         size_t* params_of, text::Text* text);
+
+static void write_call_(text::Text* text, regcode::Instr* instr, size_t params, const char* name);
+
+static void write_operand_(text::Text* text, Operand operand);
+
+static void load_(text::Text* text, Operand operand, const char* reg);
+
+static void store_(text::Text* text, const char* reg, Operand operand);
+
+static const char* jump_cmd_(regcode::Opcode opcode);
+
+void write(regcode::Program* program, FILE* stream)
+{
+    utils_assert(program);
+    utils_assert(stream);
+
+    // parameter counts of functions by their labels
+    size_t* params_of = TYPED_CALLOC(program->labels.size + 1, size_t);
+    utils_assert(params_of);
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(program, i);
+
+        if(instr->opcode == regcode::OPCODE_FUNC)
+            params_of[instr->label] = instr->params;
+    }
+
+    // most instructions take two lines, buffer grows otherwise
+    const size_t instr_len = 48;
+
+    text::Text text = TEXT_INITLIST;
+    text::reserve(&text, program->code.size * instr_len + strlen(RUNTIME));
+
+    text::put_str(&text, "    .text\n"
+                         "    .globl main\n");
+
+    // code before first function runs as C main
+    write_prologue_(&text, "main", frame_size(program, 0, 0));
+
+    for(size_t i = 0; i < program->code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(program, i);
+
+        if(instr->opcode == regcode::OPCODE_FUNC) {
+            write_prologue_(&text, regcode::label_name(program, instr->label),
+                            frame_size(program, i + 1, instr->params));
+            write_params_(&text, instr->params);
+            continue;
+        }
+
+        write_instr_(program, instr, params_of, &text);
+    }
+
+    text::put_str(&text, RUNTIME);
+
+    text::flush(&text, stream);
+
+    UTILS_LOGD(LOG_X86, "%lu instructions lowered", program->code.size);
+
+    NFREE(params_of);
+}
+
+size_t frame_size(regcode::Program* program, size_t begin, size_t params)
+{
+    utils_assert(program);
+
+    size_t slots = params;
+
+    for(size_t i = begin; i < program->code.size; ++i) {
+        regcode::Instr* instr = regcode::instr_at(program, i);
+
+        if(instr->opcode == regcode::OPCODE_FUNC)
+            break;
+
+        Operand operands[] = { instr->dst, instr->a, instr->b };
+        for(size_t j = 0; j < SIZEOF(operands); ++j) {
+            if(operands[j].kind == regcode::OPERAND_SLOT && (size_t) operands[j].val + 1 > slots)
+                slots = (size_t) operands[j].val + 1;
+        }
+    }
+
+    return (slots * SLOT_SIZE + STACK_ALIGN - 1) / STACK_ALIGN * STACK_ALIGN;
+}
+
+static void write_prologue_(text::Text* text, const char* name, size_t frame_bytes)
+{
+    text::put_str(text, "\n");
+    text::put_str(text, name);
+    text::put_str(text, ":\n"
+                        "    pushq %rbp\n"
+                        "    movq %rsp, %rbp\n");
+
+    if(frame_bytes) {
+        text::put_str(text, "    subq $");
+        text::put_int(text, (int) frame_bytes, false);
+        text::put_str(text, ", %rsp\n");
+    }
+}
+
+// parameters are spilled to their slots, stack ones lie above return address
+static void write_params_(text::Text* text, size_t params)
+{
+    for(size_t i = 0; i < params; ++i) {
+        if(i < ARG_REGISTERS_CNT) {
+            store_(text, ARG_REGISTERS[i], regcode::slot((int32_t) i));
+            continue;
+        }
+
+        text::put_str(text, "    movl ");
+        text::put_int(text, (int) (2 * PUSH_SIZE + (i - ARG_REGISTERS_CNT) * PUSH_SIZE), false);
+        text::put_str(text, "(%rbp), %eax\n");
+        store_(text, "%eax", regcode::slot((int32_t) i));
+    }
+}
+
+static void write_instr_(regcode::Program* program, regcode::Instr* instr,
+                         size_t* params_of, text::Text* text)
+{
+    using namespace regcode;
+
+    switch(instr->opcode) {
+        case OPCODE_LABEL:
+            text::put_str(text, ".L");
+            text::put_str(text, label_name(program, instr->label));
+            text::put_str(text, ":\n");
+            break;
+
+        case OPCODE_HLT:
+            text::put_str(text, "    xorl %eax, %eax\n"
+                                "    leave\n"
+                                "    ret\n");
+            break;
+
+        case OPCODE_MOV:
+            if(instr->a.kind == OPERAND_IMM) {
+                text::put_str(text, "    movl ");
+                write_operand_(text, instr->a);
+                text::put_str(text, ", ");
+                write_operand_(text, instr->dst);
+                text::put_str(text, "\n");
+                break;
+            }
+            load_ (text, instr->a, "%eax");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+            load_(text, instr->a, "%eax");
+            text::put_str(text, instr->opcode == OPCODE_ADD ? "    addl "
+                              : instr->opcode == OPCODE_SUB ? "    subl " : "    imull ");
+            write_operand_(text, instr->b);
+            text::put_str(text, ", %eax\n");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        // runtime checks divisor unless it is known to be safe
+        case OPCODE_DIV:
+            load_(text, instr->a, "%eax");
+            load_(text, instr->b, "%ecx");
+            if(instr->b.kind == OPERAND_IMM && instr->b.val != 0 && instr->b.val != -1)
+                text::put_str(text, "    cltd\n"
+                                    "    idivl %ecx\n");
+            else
+                text::put_str(text, "    call rt_div\n");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        case OPCODE_POW:
+            load_(text, instr->a, "%edi");
+            load_(text, instr->b, "%esi");
+            text::put_str(text, "    call rt_pow\n");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        case OPCODE_SQR:
+            load_(text, instr->a, "%edi");
+            text::put_str(text, "    call rt_sqrt\n");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        case OPCODE_IN:
+            text::put_str(text, "    call rt_in\n");
+            store_(text, "%eax", instr->dst);
+            break;
+
+        case OPCODE_OUT:
+            load_(text, instr->a, "%edi");
+            text::put_str(text, "    call rt_out\n");
+            break;
+
+        case OPCODE_DRAW:
+            text::put_str(text, "    call rt_draw\n");
+            break;
+
+        case OPCODE_STORE:
+            load_(text, instr->a, "%edi");
+            load_(text, instr->b, "%esi");
+            text::put_str(text, "    call rt_ramset\n");
+            break;
+
+        case OPCODE_CALL:
+            write_call_(text, instr, params_of[instr->label], label_name(program, instr->label));
+            break;
+
+        case OPCODE_RET:
+            load_(text, instr->a, "%eax");
+            text::put_str(text, "    leave\n"
+                                "    ret\n");
+            break;
+
+        case OPCODE_JMP:
+            text::put_str(text, "    jmp .L");
+            text::put_str(text, label_name(program, instr->label));
+            text::put_str(text, "\n");
+            break;
+
+        case OPCODE_JE:
+        case OPCODE_JNE:
+        case OPCODE_JA:
+        case OPCODE_JB:
+        case OPCODE_JAE:
+        case OPCODE_JBE:
+            load_(text, instr->a, "%eax");
+            text::put_str(text, "    cmpl ");
+            write_operand_(text, instr->b);
+            text::put_str(text, ", %eax\n"
+                                "    ");
+            text::put_str(text, jump_cmd_(instr->opcode));
+            text::put_str(text, " .L");
+            text::put_str(text, label_name(program, instr->label));
+            text::put_str(text, "\n");
+            break;
+
+        case OPCODE_FUNC:
+        default:
+            UTILS_LOGE(LOG_X86, "unexpected opcode %s", opcode_str(instr->opcode));
+            break;
+    }
+}
+
+// arguments are read from callee frame slots of caller, stack ones are
+// pushed last to first with padding keeping call aligned
+static void write_call_(text::Text* text, regcode::Instr* instr, size_t params, const char* name)
+{
+    size_t on_stack = params > ARG_REGISTERS_CNT ? params - ARG_REGISTERS_CNT : 0;
+    size_t padding  = on_stack % 2;
+
+    if(padding) {
+        text::put_str(text, "    subq $");
+        text::put_int(text, (int) PUSH_SIZE, false);
+        text::put_str(text, ", %rsp\n");
+    }
+
+    for(size_t i = params; i-- > ARG_REGISTERS_CNT;) {
+        load_(text, regcode::slot((int32_t) (instr->frame + i)), "%eax");
+        text::put_str(text, "    pushq %rax\n");
+    }
+
+    for(size_t i = 0; i < params && i < ARG_REGISTERS_CNT; ++i)
+        load_(text, regcode::slot((int32_t) (instr->frame + i)), ARG_REGISTERS[i]);
+
+    text::put_str(text, "    call ");
+    text::put_str(text, name);
+    text::put_str(text, "\n");
+
+    if(on_stack + padding) {
+        text::put_str(text, "    addq $");
+        text::put_int(text, (int) ((on_stack + padding) * PUSH_SIZE), false);
+        text::put_str(text, ", %rsp\n");
+    }
+
+    store_(text, "%eax", instr->dst);
+}
+
+static void write_operand_(text::Text* text, Operand operand)
+{
+    switch(operand.kind) {
+        case regcode::OPERAND_IMM:
+            text::put_str(text, "$");
+            text::put_int(text, operand.val, false);
+            break;
+
+        case regcode::OPERAND_SLOT:
+            text::put_int(text, -(int) (((size_t) operand.val + 1) * SLOT_SIZE), false);
+            text::put_str(text, "(%rbp)");
+            break;
+
+        case regcode::OPERAND_NONE:
+        case regcode::OPERAND_TEMP:
+        case regcode::OPERAND_ARG:
+        default:
+            UTILS_LOGE(LOG_X86, "unresolved operand");
+            break;
+    }
+}
+
+static void load_(text::Text* text, Operand operand, const char* reg)
+{
+    text::put_str(text, "    movl ");
+    write_operand_(text, operand);
+    text::put_str(text, ", ");
+    text::put_str(text, reg);
+    text::put_str(text, "\n");
+}
+
+static void store_(text::Text* text, const char* reg, Operand operand)
+{
+    text::put_str(text, "    movl ");
+    text::put_str(text, reg);
+    text::put_str(text, ", ");
+    write_operand_(text, operand);
+    text::put_str(text, "\n");
+}
+
+// values are signed, so are comparisons
+static const char* jump_cmd_(regcode::Opcode opcode)
+{
+    switch(opcode) {
+        case regcode::OPCODE_JE:  return "je";
+        case regcode::OPCODE_JNE: return "jne";
+        case regcode::OPCODE_JA:  return "jg";
+        case regcode::OPCODE_JB:  return "jl";
+        case regcode::OPCODE_JAE: return "jge";
+        case regcode::OPCODE_JBE: return "jle";
+
+        case regcode::OPCODE_LABEL:
+        case regcode::OPCODE_FUNC:
+        case regcode::OPCODE_HLT:
+        case regcode::OPCODE_MOV:
+        case regcode::OPCODE_ADD:
+        case regcode::OPCODE_SUB:
+        case regcode::OPCODE_MUL:
+        case regcode::OPCODE_DIV:
+        case regcode::OPCODE_POW:
+        case regcode::OPCODE_SQR:
+        case regcode::OPCODE_IN:
+        case regcode::OPCODE_OUT:
+        case regcode::OPCODE_DRAW:
+        case regcode::OPCODE_STORE:
+        case regcode::OPCODE_CALL:
+        case regcode::OPCODE_RET:
+        case regcode::OPCODE_JMP:
+        default:
+            return "";
+    }
+}
+
+} // x86
+} // compiler
@@ -76,6 +76,10 @@ Err ctor(AST* astree)
     
     vector_ctor(&astree->envs, env_cap, sizeof(Env*));
 
+    const size_t names_cap = 10;
+
+    vector_ctor(&astree->names, names_cap, sizeof(char*));
+
     return ERR_NONE;
 }
 
@@ -117,6 +121,11 @@ void dtor(AST* astree)
     }
 
     vector_dtor(&astree->envs);
+
+    for(size_t i = 0; i < astree->names.size; ++i)
+        free(*(char**)vector_at(&astree->names, i));
+
+    vector_dtor(&astree->names);
 }
 
 void free_subtree(ASTNode* node)
@@ -145,7 +154,12 @@ Err fwrite_infix(AST* astree, FILE* stream)
     utils_assert(stream);
     utils_assert(astree->root);
 
-    Err err = fwrite_node_(astree, astree->root->left, stream);
+    // frontend trees hang off a fake root, trees read back from file do not
+    ASTNode* root = astree->root;
+    if(root->token.type == token::TYPE_FAKE)
+        root = root->left;
+
+    Err err = fwrite_node_(astree, root, stream);
     return err;
 }
 
@@ -314,25 +328,25 @@ Err scan_token_(AST* astree, token::Token* token)
             GOTO_END;
         }
 
-        // Numeric
-        int val = 0;
-        int sign = 1;
+        // Numeric, unsigned so that folded INT_MIN reads back
+        unsigned val = 0;
+        bool negative = false;
         ssize_t pos_cur = astree->buf.pos;
         ssize_t pos_prev = pos_cur;
         if(astree->buf.ptr[astree->buf.pos] == '-') {
-            sign = -1;
+            negative = true;
             pos_cur++;
         }
         while('0' <= astree->buf.ptr[pos_cur] && astree->buf.ptr[pos_cur] <= '9') {
-            int digit = astree->buf.ptr[pos_cur] - '0';
+            unsigned digit = (unsigned) (astree->buf.ptr[pos_cur] - '0');
             val = val * 10 + digit;
             pos_cur++;
         }
 
         if(pos_prev != pos_cur) {
             token->type = token::TYPE_NUM_LITERAL;
-            token->val  = { .num = sign * val };
-            UTILS_LOGD(LOG_AST, "got num %d", val);
+            token->val  = { .num = (int) (negative ? 0u - val : val) };
+            UTILS_LOGD(LOG_AST, "got num %d", token->val.num);
             GOTO_END;
         }
 
@@ -366,6 +380,9 @@ Err scan_token_(AST* astree, token::Token* token)
 
             astree->current_env    = new_env;
             astree->current_env_id = env_id;
+
+            token->scope_id       = env_id;
+            token->inner_scope_id = func_sym_id;
             
         }
         else if(strncmp("VAR", symbol_ptr, symbol_str_len) == 0) {
@@ -449,17 +466,19 @@ ASTNode* new_node(token::Token* token, ASTNode *left, ASTNode *right, ASTNode *p
 
     if(token)
         *node = {
-            .left   = left,
-            .right  = right,
-            .parent = parent,
-            .token  = *token
+            .left    = left,
+            .right   = right,
+            .parent  = parent,
+            .token   = *token,
+            .cons_id = 0
         };
     else 
         *node = {
-            .left   = left,
-            .right  = right,
-            .parent = parent,
-            .token  = TOKEN_INITLIST
+            .left    = left,
+            .right   = right,
+            .parent  = parent,
+            .token   = TOKEN_INITLIST,
+            .cons_id = 0
         };
 
     if(right)
@@ -489,6 +508,26 @@ ASTNode* copy_subtree(AST* astree, ASTNode* node, ASTNode* parent)
     return new_node;
 }
 
+void replace_node(ASTNode* node, ASTNode* new_node)
+{
+    utils_assert(node);
+    utils_assert(new_node);
+
+    ASTNode* parent = node->parent;
+
+    if(parent) {
+        if(parent->left == node)
+            parent->left = new_node;
+        else if(parent->right == node)
+            parent->right = new_node;
+    }
+
+    new_node->parent = parent;
+
+    for(; parent && parent->cons_id; parent = parent->parent)
+        parent->cons_id = 0;
+}
+
 int add_enviroment(AST* astree, Env** enviroment)
 {
     vector_push(&astree->envs, enviroment);
@@ -500,6 +539,145 @@ Env* get_enviroment(AST* astree, int env_id)
     return *(Env**)vector_at(&astree->envs, (unsigned) env_id);
 }
 
+ASTNode* statement_of(ASTNode* node)
+{
+    utils_assert(node);
+
+    while(node->parent
+          && !(node->parent->token.type == token::TYPE_SEPARATOR
+               && node->parent->token.val.sep_type == token::SEPARATOR_TYPE_SEMICOLON
+               && node->parent->left == node))
+        node = node->parent;
+
+    utils_assert(node->parent);
+
+    return node;
+}
+
+void insert_statement_before(ASTNode* stmt, ASTNode* new_stmt)
+{
+    utils_assert(stmt);
+    utils_assert(new_stmt);
+
+    ASTNode* chain = stmt->parent;
+    utils_assert(chain && chain->left == stmt);
+
+    ASTNode* rest = new_node(&chain->token, stmt, chain->right, chain);
+
+    chain->left  = new_stmt;
+    chain->right = rest;
+
+    new_stmt->parent = chain;
+}
+
+void remove_statement(ASTNode* stmt)
+{
+    utils_assert(stmt);
+
+    ASTNode* chain = stmt->parent;
+    utils_assert(chain && chain->left == stmt);
+
+    chain->left = NULL;
+    free_subtree(stmt);
+
+    if(!chain->right)
+        return;
+
+    ASTNode* rest = chain->right;
+    chain->right = NULL;
+
+    replace_node(chain, rest);
+    free_subtree(chain);
+}
+
+utils_str_t new_name(AST* astree, const char* fmt, ...)
+{
+    utils_assert(astree);
+    utils_assert(fmt);
+
+    va_list args;
+    va_start(args, fmt);
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int name_len = vsnprintf(NULL, 0, fmt, args_copy);
+    va_end(args_copy);
+
+    utils_assert(name_len >= 0);
+
+    char* name = TYPED_CALLOC((size_t) name_len + 1, char);
+    utils_assert(name);
+
+    vsnprintf(name, (size_t) name_len + 1, fmt, args);
+    va_end(args);
+
+    vector_push(&astree->names, &name);
+
+    return { .str = name, .len = (unsigned) name_len };
+}
+
+token::Token new_temporary(AST* astree, int env_id)
+{
+    utils_assert(astree);
+
+    token::Token tok = TOKEN_INITLIST;
+    tok.type    = token::TYPE_IDENTIFIER;
+    // '.' is not allowed in identifiers by lexer
+    tok.val.str = new_name(astree, "tmp.%lu", astree->names.size);
+
+    tok.scope_id       = env_id;
+    tok.inner_scope_id = add_symbol_to_env(get_enviroment(astree, env_id), &tok.val.str, SYMBOL_TYPE_VARIABLE);
+
+    return tok;
+}
+
+void collect_list(ASTNode* node, Vector* list)
+{
+    utils_assert(list);
+
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        collect_list(node->left,  list);
+        collect_list(node->right, list);
+        return;
+    }
+
+    vector_push(list, &node);
+}
+
+size_t count_nodes(ASTNode* node)
+{
+    if(!node) return 0;
+
+    return 1 + count_nodes(node->left) + count_nodes(node->right);
+}
+
+bool holds_call(ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_CALL)
+        return true;
+
+    return holds_call(node->left) || holds_call(node->right);
+}
+
+bool may_trap(ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_OPERATOR && node->token.val.op_type == token::OPERATOR_TYPE_DIV) {
+        bool nonzero_divisor = node->right
+                               && node->right->token.type == token::TYPE_NUM_LITERAL
+                               && node->right->token.val.num != 0;
+        if(!nonzero_divisor)
+            return true;
+    }
+
+    return may_trap(node->left) || may_trap(node->right);
+}
+
 Env* find_enviroment(AST* astree, utils_str_t* str, SymbolType type)
 {
     for(size_t i = 0; i <= (unsigned) astree->current_env_id; ++i) {
@@ -0,0 +1,379 @@
+#include "callgraph.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace callgraph {
+
+ATTR_UNUSED static const char* LOG_CALLGRAPH = "CALLGRAPH";
+
+const size_t NO_INDEX = (size_t) -1;
+
+// Tarjan's algorithm state
+struct Search
+{
+    size_t* index;
+    size_t* lowlink;
+    bool*   on_stack;
+    bool*   effects; // IN, OUT, RAMSET or call of unknown function
+
+    size_t* stack;
+    size_t  stack_size;
+    size_t  next_index;
+};
+
+static void collect_functions_(CallGraph* graph, ast::ASTNode* node);
+
+static void collect_calls_(CallGraph* graph, Function* func, ast::ASTNode* node, bool* effects);
+
+static void connect_(CallGraph* graph, Search* search, size_t ind);
+
+static void close_component_(CallGraph* graph, Search* search, size_t root);
+
+static void mark_reachable_(CallGraph* graph, size_t ind);
+
+static bool has_effects_(ast::ASTNode* node);
+
+static void unlink_function_(ast::AST* astree, ast::ASTNode* func);
+
+void ctor(CallGraph* graph, ast::AST* astree)
+{
+    utils_assert(graph);
+    utils_assert(astree);
+
+    const size_t vec_cap = 8;
+    vector_ctor(&graph->functions, vec_cap, sizeof(Function));
+    vector_ctor(&graph->order,     vec_cap, sizeof(size_t));
+    graph->scc_cnt = 0;
+
+    collect_functions_(graph, astree->root);
+
+    size_t cnt = graph->functions.size;
+
+    Search search = {
+        .index      = TYPED_CALLOC(cnt + 1, size_t),
+        .lowlink    = TYPED_CALLOC(cnt + 1, size_t),
+        .on_stack   = TYPED_CALLOC(cnt + 1, bool),
+        .effects    = TYPED_CALLOC(cnt + 1, bool),
+        .stack      = TYPED_CALLOC(cnt + 1, size_t),
+        .stack_size = 0,
+        .next_index = 0,
+    };
+
+    utils_assert(search.index && search.lowlink && search.on_stack && search.effects && search.stack);
+
+    // callees are resolved only after all functions are known
+    for(size_t i = 0; i < cnt; ++i) {
+        Function* func = get_function(graph, i);
+        search.index[i] = NO_INDEX;
+        collect_calls_(graph, func, func->node->right, &search.effects[i]);
+    }
+
+    for(size_t i = 0; i < cnt; ++i)
+        if(search.index[i] == NO_INDEX)
+            connect_(graph, &search, i);
+
+    for(size_t i = 0; i < cnt; ++i)
+        if(is_main(get_function(graph, i)->node))
+            mark_reachable_(graph, i);
+
+    UTILS_LOGD(LOG_CALLGRAPH, "%lu functions, %lu components", cnt, graph->scc_cnt);
+
+    NFREE(search.index);
+    NFREE(search.lowlink);
+    NFREE(search.on_stack);
+    NFREE(search.effects);
+    NFREE(search.stack);
+}
+
+void dtor(CallGraph* graph)
+{
+    utils_assert(graph);
+
+    for(size_t i = 0; i < graph->functions.size; ++i)
+        vector_dtor(&get_function(graph, i)->callees);
+
+    vector_dtor(&graph->functions);
+    vector_dtor(&graph->order);
+}
+
+Function* get_function(CallGraph* graph, size_t ind)
+{
+    utils_assert(graph);
+
+    return (Function*)vector_at(&graph->functions, ind);
+}
+
+size_t function_index(CallGraph* graph, Function* func)
+{
+    utils_assert(graph);
+    utils_assert(func);
+
+    return (size_t)(func - get_function(graph, 0));
+}
+
+Function* find_function(CallGraph* graph, utils_str_t* name)
+{
+    utils_assert(graph);
+    utils_assert(name);
+
+    for(size_t i = 0; i < graph->functions.size; ++i) {
+        Function* func = get_function(graph, i);
+        utils_str_t* func_name = &func->node->token.val.str;
+
+        if(func_name->len == name->len && strncmp(func_name->str, name->str, name->len) == 0)
+            return func;
+    }
+
+    return NULL;
+}
+
+bool is_main(ast::ASTNode* func)
+{
+    utils_assert(func);
+
+    static const char main_name[] = "main";
+
+    return func->token.val.str.len == sizeof(main_name) - 1
+           && strncmp(func->token.val.str.str, main_name, sizeof(main_name) - 1) == 0;
+}
+
+size_t remove_unreachable(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    CallGraph graph = {};
+    ctor(&graph, astree);
+
+    size_t removed = 0;
+
+    // without main everything is kept, program is probably a library
+    bool has_main = false;
+    for(size_t i = 0; i < graph.functions.size; ++i)
+        has_main |= get_function(&graph, i)->reachable;
+
+    for(size_t i = 0; has_main && i < graph.functions.size; ++i) {
+        Function* func = get_function(&graph, i);
+
+        if(!func->reachable) {
+            UTILS_LOGD(LOG_CALLGRAPH, "removing %.*s",
+                       (int) func->node->token.val.str.len, func->node->token.val.str.str);
+
+            unlink_function_(astree, func->node);
+            removed++;
+        }
+    }
+
+    dtor(&graph);
+
+    return removed;
+}
+
+static void collect_functions_(CallGraph* graph, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        collect_functions_(graph, node->left);
+        collect_functions_(graph, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    Function func = {
+        .node      = node,
+        .callees   = VECTOR_INITLIST,
+        .scc       = 0,
+        .recursive = false,
+        .reachable = false,
+        .pure      = false,
+    };
+
+    const size_t callees_cap = 4;
+    vector_ctor(&func.callees, callees_cap, sizeof(size_t));
+
+    vector_push(&graph->functions, &func);
+}
+
+static void collect_calls_(CallGraph* graph, Function* func, ast::ASTNode* node, bool* effects)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_CALL) {
+        Function* callee = find_function(graph, &node->left->token.val.str);
+
+        if(callee) {
+            size_t ind = function_index(graph, callee);
+
+            bool known = false;
+            for(size_t i = 0; i < func->callees.size && !known; ++i)
+                known = *(size_t*)vector_at(&func->callees, i) == ind;
+
+            if(!known)
+                vector_push(&func->callees, &ind);
+        }
+        else
+            *effects = true;
+    }
+    else if(has_effects_(node))
+        *effects = true;
+
+    collect_calls_(graph, func, node->left,  effects);
+    collect_calls_(graph, func, node->right, effects);
+}
+
+static void connect_(CallGraph* graph, Search* search, size_t ind)
+{
+    search->index[ind]    = search->next_index;
+    search->lowlink[ind]  = search->next_index;
+    search->on_stack[ind] = true;
+    search->next_index++;
+
+    search->stack[search->stack_size++] = ind;
+
+    Function* func = get_function(graph, ind);
+
+    for(size_t i = 0; i < func->callees.size; ++i) {
+        size_t callee = *(size_t*)vector_at(&func->callees, i);
+
+        if(search->index[callee] == NO_INDEX) {
+            connect_(graph, search, callee);
+            if(search->lowlink[callee] < search->lowlink[ind])
+                search->lowlink[ind] = search->lowlink[callee];
+        }
+        else if(search->on_stack[callee] && search->index[callee] < search->lowlink[ind])
+            search->lowlink[ind] = search->index[callee];
+    }
+
+    if(search->lowlink[ind] == search->index[ind])
+        close_component_(graph, search, ind);
+}
+
+// components are closed callees first, so purity of
+// everything outside of current one is already known
+static void close_component_(CallGraph* graph, Search* search, size_t root)
+{
+    size_t first = graph->order.size;
+    size_t scc   = graph->scc_cnt++;
+
+    size_t ind = 0;
+    do {
+        ind = search->stack[--search->stack_size];
+
+        search->on_stack[ind] = false;
+        get_function(graph, ind)->scc = scc;
+        vector_push(&graph->order, &ind);
+    } while(ind != root);
+
+    size_t members = graph->order.size - first;
+    bool   pure    = true;
+
+    for(size_t i = first; i < graph->order.size; ++i) {
+        ind = *(size_t*)vector_at(&graph->order, i);
+        Function* func = get_function(graph, ind);
+
+        if(search->effects[ind])
+            pure = false;
+
+        for(size_t j = 0; j < func->callees.size; ++j) {
+            Function* callee = get_function(graph, *(size_t*)vector_at(&func->callees, j));
+
+            if(callee->scc != scc && !callee->pure)
+                pure = false;
+
+            if(callee == func)
+                func->recursive = true;
+        }
+
+        if(members > 1)
+            func->recursive = true;
+    }
+
+    for(size_t i = first; i < graph->order.size; ++i)
+        get_function(graph, *(size_t*)vector_at(&graph->order, i))->pure = pure;
+}
+
+static void mark_reachable_(CallGraph* graph, size_t ind)
+{
+    Function* func = get_function(graph, ind);
+    if(func->reachable)
+        return;
+
+    func->reachable = true;
+
+    for(size_t i = 0; i < func->callees.size; ++i)
+        mark_reachable_(graph, *(size_t*)vector_at(&func->callees, i));
+}
+
+static bool has_effects_(ast::ASTNode* node)
+{
+    if(node->token.type != token::TYPE_KEYWORD)
+        return false;
+
+    switch(node->token.val.kw_type) {
+        case token::KEYWORD_TYPE_IN:
+        case token::KEYWORD_TYPE_OUT:
+        case token::KEYWORD_TYPE_RAMSET:
+            return true;
+
+        case token::KEYWORD_TYPE_IF:
+        case token::KEYWORD_TYPE_ELSE:
+        case token::KEYWORD_TYPE_WHILE:
+        case token::KEYWORD_TYPE_RETURN:
+        case token::KEYWORD_TYPE_DEFUN:
+        default:
+            return false;
+    }
+}
+
+// separator holding function is replaced with its other child
+static void unlink_function_(ast::AST* astree, ast::ASTNode* func)
+{
+    ast::ASTNode* parent = func->parent;
+
+    if(!parent) {
+        astree->root = NULL;
+        ast::free_subtree(func);
+        return;
+    }
+
+    ast::ASTNode* sibling = parent->left == func ? parent->right : parent->left;
+
+    if(sibling) {
+        if(parent->parent)
+            ast::replace_node(parent, sibling);
+        else {
+            astree->root    = sibling;
+            sibling->parent = NULL;
+        }
+
+        parent->left  = NULL;
+        parent->right = NULL;
+        func->parent  = NULL;
+
+        ast::free_subtree(parent);
+        ast::free_subtree(func);
+    }
+    else {
+        if(parent->left == func)
+            parent->left = NULL;
+        else
+            parent->right = NULL;
+
+        func->parent = NULL;
+        ast::free_subtree(func);
+    }
+}
+
+} // callgraph
+} // compiler
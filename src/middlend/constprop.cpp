@@ -0,0 +1,457 @@
+#include "constprop.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "evaluate.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+
+namespace compiler {
+namespace constprop {
+
+ATTR_UNUSED static const char* LOG_CONSTPROP = "CONSTPROP";
+
+enum ValueKind
+{
+    VALUE_UNKNOWN,
+    VALUE_CONST,
+    VALUE_COPY,
+};
+
+struct Value
+{
+    ValueKind    kind;
+    int          num; // VALUE_CONST
+    token::Token var; // VALUE_COPY, variable currently holding same value
+};
+
+struct State
+{
+    bool   reachable;
+    size_t size;
+    Value* vals; // indexed by symbol id in function env
+};
+
+struct Context
+{
+    ast::AST* astree;
+    int       env_id;
+    size_t    size;
+
+    bool   changed;
+    size_t constants;
+    size_t copies;
+};
+
+static void function_(Context* ctx, ast::ASTNode* node);
+
+static void block_(Context* ctx, ast::ASTNode* chain, State* state, bool rewrite);
+
+static void statement_(Context* ctx, ast::ASTNode* stmt, State* state, bool rewrite);
+
+static void loop_(Context* ctx, ast::ASTNode* loop, State* state, bool rewrite);
+
+static void substitute_(Context* ctx, ast::ASTNode* node, State* state);
+
+static Value value_of_(Context* ctx, ast::ASTNode* node, State* state);
+
+static bool evaluate_(Context* ctx, ast::ASTNode* node, State* state, int* res);
+
+static void assign_(Context* ctx, State* state, ast::ASTNode* var, Value val);
+
+static bool tracked_(Context* ctx, ast::ASTNode* node);
+
+static void state_ctor_(Context* ctx, State* state);
+
+static void state_dtor_(State* state);
+
+static void state_copy_(State* dst, State* src);
+
+static void state_join_(State* dst, State* other);
+
+static bool state_equal_(State* a, State* b);
+
+static bool value_equal_(Value* a, Value* b);
+
+bool propagate(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree    = astree,
+        .env_id    = 0,
+        .size      = 0,
+        .changed   = false,
+        .constants = 0,
+        .copies    = 0,
+    };
+
+    function_(&ctx, astree->root);
+
+    UTILS_LOGD(LOG_CONSTPROP, "%lu uses replaced by constants, %lu by copied variables",
+               ctx.constants, ctx.copies);
+
+    return ctx.changed;
+}
+
+static void function_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        function_(ctx, node->left);
+        function_(ctx, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    Env* env = ast::get_enviroment(ctx->astree, node->token.scope_id);
+    utils_assert(env);
+
+    ctx->env_id = node->token.scope_id;
+    ctx->size   = env->symbol_table.size;
+
+    // parameters and uninitialized locals are unknown on entry
+    State state = {};
+    state_ctor_(ctx, &state);
+
+    block_(ctx, node->right, &state, true);
+
+    state_dtor_(&state);
+}
+
+static void block_(Context* ctx, ast::ASTNode* chain, State* state, bool rewrite)
+{
+    for(; chain; chain = chain->right)
+        if(chain->left)
+            statement_(ctx, chain->left, state, rewrite);
+}
+
+static void statement_(Context* ctx, ast::ASTNode* stmt, State* state, bool rewrite)
+{
+    using namespace token;
+
+    // nothing is known about code after return
+    if(!state->reachable)
+        rewrite = false;
+
+    if(stmt->token.type == TYPE_OPERATOR && stmt->token.val.op_type == OPERATOR_TYPE_ASSIGN) {
+        if(rewrite) substitute_(ctx, stmt->right, state);
+        assign_(ctx, state, stmt->left, value_of_(ctx, stmt->right, state));
+        return;
+    }
+
+    if(stmt->token.type != TYPE_KEYWORD) {
+        if(rewrite) substitute_(ctx, stmt, state);
+        return;
+    }
+
+    switch(stmt->token.val.kw_type) {
+        case KEYWORD_TYPE_IN: {
+            Value unknown = {};
+            unknown.kind = VALUE_UNKNOWN;
+            assign_(ctx, state, stmt->left, unknown);
+            break;
+        }
+
+        case KEYWORD_TYPE_OUT:
+            if(rewrite) substitute_(ctx, stmt->left, state);
+            break;
+
+        case KEYWORD_TYPE_RAMSET:
+            if(rewrite) {
+                substitute_(ctx, stmt->left,  state);
+                substitute_(ctx, stmt->right, state);
+            }
+            break;
+
+        case KEYWORD_TYPE_RETURN:
+            if(rewrite) substitute_(ctx, stmt->left, state);
+            state->reachable = false;
+            break;
+
+        case KEYWORD_TYPE_IF: {
+            if(rewrite) substitute_(ctx, stmt->left, state);
+
+            State other = {};
+            state_ctor_(ctx, &other);
+            state_copy_(&other, state);
+
+            if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+               && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                block_(ctx, stmt->right->left,  state,  rewrite);
+                block_(ctx, stmt->right->right, &other, rewrite);
+            }
+            else
+                block_(ctx, stmt->right, state, rewrite);
+
+            state_join_(state, &other);
+            state_dtor_(&other);
+            break;
+        }
+
+        case KEYWORD_TYPE_WHILE:
+            loop_(ctx, stmt, state, rewrite);
+            break;
+
+        case KEYWORD_TYPE_ELSE:
+        case KEYWORD_TYPE_DEFUN:
+        default:
+            if(rewrite) substitute_(ctx, stmt, state);
+            break;
+    }
+}
+
+// state at loop head is meet of entry state and state after body,
+// iterated until it stops changing; values only go down to unknown
+static void loop_(Context* ctx, ast::ASTNode* loop, State* state, bool rewrite)
+{
+    State head = {}, body = {};
+    state_ctor_(ctx, &head);
+    state_ctor_(ctx, &body);
+
+    state_copy_(&head, state);
+
+    for(;;) {
+        state_copy_(&body, &head);
+        block_(ctx, loop->right, &body, false);
+        state_join_(&body, state);
+
+        if(state_equal_(&body, &head))
+            break;
+
+        state_copy_(&head, &body);
+    }
+
+    if(rewrite) {
+        substitute_(ctx, loop->left, &head);
+
+        state_copy_(&body, &head);
+        block_(ctx, loop->right, &body, true);
+    }
+
+    // loop is left when condition is false at its head
+    state_copy_(state, &head);
+
+    state_dtor_(&head);
+    state_dtor_(&body);
+}
+
+static void substitute_(Context* ctx, ast::ASTNode* node, State* state)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_CALL) {
+        // left is callee name, not variable
+        substitute_(ctx, node->right, state);
+        return;
+    }
+
+    if(!tracked_(ctx, node)) {
+        substitute_(ctx, node->left,  state);
+        substitute_(ctx, node->right, state);
+        return;
+    }
+
+    Value* val = &state->vals[node->token.inner_scope_id];
+    token::Token tok = TOKEN_INITLIST;
+
+    switch(val->kind) {
+        case VALUE_CONST:
+            tok.type    = token::TYPE_NUM_LITERAL;
+            tok.val.num = val->num;
+            ctx->constants++;
+            break;
+
+        case VALUE_COPY:
+            tok = val->var;
+            ctx->copies++;
+            break;
+
+        case VALUE_UNKNOWN:
+        default:
+            return;
+    }
+
+    ast::ASTNode* new_node = ast::new_node(&tok, NULL, NULL, NULL);
+    ast::replace_node(node, new_node);
+    ast::free_subtree(node);
+
+    ctx->changed = true;
+}
+
+static Value value_of_(Context* ctx, ast::ASTNode* node, State* state)
+{
+    Value val = {};
+    val.kind = VALUE_UNKNOWN;
+
+    if(tracked_(ctx, node)) {
+        val = state->vals[node->token.inner_scope_id];
+
+        if(val.kind == VALUE_UNKNOWN) {
+            val.kind = VALUE_COPY;
+            val.var  = node->token;
+        }
+
+        return val;
+    }
+
+    int num = 0;
+    if(evaluate_(ctx, node, state, &num)) {
+        val.kind = VALUE_CONST;
+        val.num  = num;
+    }
+
+    return val;
+}
+
+static bool evaluate_(Context* ctx, ast::ASTNode* node, State* state, int* res)
+{
+    // missing operand (unary minus, sqrt) evaluates as zero
+    if(!node) {
+        *res = 0;
+        return true;
+    }
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            *res = node->token.val.num;
+            return true;
+
+        case token::TYPE_IDENTIFIER:
+            if(!tracked_(ctx, node) || state->vals[node->token.inner_scope_id].kind != VALUE_CONST)
+                return false;
+
+            *res = state->vals[node->token.inner_scope_id].num;
+            return true;
+
+        case token::TYPE_OPERATOR: {
+            if(node->token.val.op_type == token::OPERATOR_TYPE_ASSIGN)
+                return false;
+
+            int left = 0, right = 0;
+            if(!evaluate_(ctx, node->left, state, &left) || !evaluate_(ctx, node->right, state, &right))
+                return false;
+
+            // division by zero is left to trap at runtime
+            if(node->token.val.op_type == token::OPERATOR_TYPE_DIV && right == 0)
+                return false;
+
+            *res = evaluate_operator_type(node->token.val.op_type, left, right);
+            return true;
+        }
+
+        case token::TYPE_CALL:
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return false;
+    }
+}
+
+static void assign_(Context* ctx, State* state, ast::ASTNode* var, Value val)
+{
+    if(!tracked_(ctx, var))
+        return;
+
+    int id = var->token.inner_scope_id;
+
+    // x = x leaves everything as it was
+    if(val.kind == VALUE_COPY && val.var.inner_scope_id == id)
+        return;
+
+    for(size_t i = 0; i < state->size; ++i)
+        if(state->vals[i].kind == VALUE_COPY && state->vals[i].var.inner_scope_id == id)
+            state->vals[i].kind = VALUE_UNKNOWN;
+
+    state->vals[id] = val;
+}
+
+static bool tracked_(Context* ctx, ast::ASTNode* node)
+{
+    return node
+           && node->token.type == token::TYPE_IDENTIFIER
+           && node->token.scope_id == ctx->env_id
+           && node->token.inner_scope_id >= 0
+           && (size_t) node->token.inner_scope_id < ctx->size;
+}
+
+static void state_ctor_(Context* ctx, State* state)
+{
+    state->reachable = true;
+    state->size      = ctx->size;
+    state->vals      = TYPED_CALLOC(ctx->size + 1, Value);
+    utils_assert(state->vals);
+}
+
+static void state_dtor_(State* state)
+{
+    NFREE(state->vals);
+    state->size = 0;
+}
+
+static void state_copy_(State* dst, State* src)
+{
+    utils_assert(dst->size == src->size);
+
+    dst->reachable = src->reachable;
+    memcpy(dst->vals, src->vals, src->size * sizeof(Value));
+}
+
+static void state_join_(State* dst, State* other)
+{
+    if(!other->reachable)
+        return;
+
+    if(!dst->reachable) {
+        state_copy_(dst, other);
+        return;
+    }
+
+    for(size_t i = 0; i < dst->size; ++i)
+        if(!value_equal_(&dst->vals[i], &other->vals[i]))
+            dst->vals[i].kind = VALUE_UNKNOWN;
+}
+
+static bool state_equal_(State* a, State* b)
+{
+    if(a->reachable != b->reachable)
+        return false;
+
+    for(size_t i = 0; i < a->size; ++i)
+        if(!value_equal_(&a->vals[i], &b->vals[i]))
+            return false;
+
+    return true;
+}
+
+static bool value_equal_(Value* a, Value* b)
+{
+    if(a->kind != b->kind)
+        return false;
+
+    switch(a->kind) {
+        case VALUE_CONST:
+            return a->num == b->num;
+
+        case VALUE_COPY:
+            return a->var.inner_scope_id == b->var.inner_scope_id;
+
+        case VALUE_UNKNOWN:
+        default:
+            return true;
+    }
+}
+
+} // constprop
+} // compiler
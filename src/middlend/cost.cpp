@@ -0,0 +1,73 @@
+#include "cost.h"
+
+#include "ast.h"
+#include "token.h"
+
+namespace compiler {
+namespace cost {
+
+long operator_cost(token::OperatorType op_type, bool unary)
+{
+    using namespace token;
+
+    switch(op_type) {
+        case OPERATOR_TYPE_ADD:
+        case OPERATOR_TYPE_OR:
+        case OPERATOR_TYPE_AND:
+            return 1;
+
+        case OPERATOR_TYPE_SUB:
+            return unary ? 2 : 1; // PUSH 0 for unary minus
+
+        case OPERATOR_TYPE_MUL:
+            return 2;
+
+        case OPERATOR_TYPE_DIV:
+            return 4;
+
+        case OPERATOR_TYPE_POW:
+        case OPERATOR_TYPE_SQRT:
+            return 6;
+
+        case OPERATOR_TYPE_EQ:
+        case OPERATOR_TYPE_NEQ:
+        case OPERATOR_TYPE_GT:
+        case OPERATOR_TYPE_LT:
+        case OPERATOR_TYPE_GEQ:
+        case OPERATOR_TYPE_LEQ:
+            return 6; // SUB, PUSH 0, Jcc, PUSH 0/1, JMP
+
+        case OPERATOR_TYPE_ASSIGN:
+        default:
+            return 1;
+    }
+}
+
+long expression_cost(ast::ASTNode* node)
+{
+    if(!node) return 0;
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            return PUSH;
+
+        case token::TYPE_IDENTIFIER:
+            return PUSHM;
+
+        case token::TYPE_OPERATOR:
+            return operator_cost(node->token.val.op_type, !node->left)
+                   + expression_cost(node->left) + expression_cost(node->right);
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return 0;
+    }
+}
+
+} // cost
+} // compiler
@@ -0,0 +1,369 @@
+#include "cse.h"
+
+#include "assertutils.h"
+#include "ast.h"
+#include "cost.h"
+#include "hashcons.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace cse {
+
+ATTR_UNUSED static const char* LOG_CSE = "CSE";
+
+struct Entry
+{
+    int    cons_id;
+    bool   available; // no operand was reassigned since first occurrence
+    long   cost;
+    Vector occurrences; // ASTNode*, in evaluation order
+};
+
+struct Context
+{
+    ast::AST*     astree;
+    ast::ASTNode* func;
+    int           env_id;
+
+    Vector entries;  // Entry
+    Vector replaced; // ASTNode*, detached occurrences freed after block
+
+    size_t temporaries;
+    size_t loads;
+};
+
+static void function_(Context* ctx, ast::ASTNode* func);
+
+static void block_(Context* ctx, ast::ASTNode* chain);
+
+static void scan_(Context* ctx, ast::ASTNode* node);
+
+static void kill_(Context* ctx, ast::ASTNode* var);
+
+static void flush_(Context* ctx);
+
+static void eliminate_(Context* ctx, Entry* entry);
+
+static bool is_live_(Context* ctx, ast::ASTNode* node);
+
+static bool is_candidate_(ast::ASTNode* node);
+
+static bool follows_call_(ast::ASTNode* node);
+
+static bool uses_var_(ast::ASTNode* node, ast::ASTNode* var);
+
+void eliminate_common_subexpressions(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree      = astree,
+        .func        = NULL,
+        .env_id      = 0,
+        .entries     = VECTOR_INITLIST,
+        .replaced    = VECTOR_INITLIST,
+        .temporaries = 0,
+        .loads       = 0,
+    };
+
+    const size_t entries_cap = 16;
+    vector_ctor(&ctx.entries,  entries_cap, sizeof(Entry));
+    vector_ctor(&ctx.replaced, entries_cap, sizeof(ast::ASTNode*));
+
+    hashcons::ctor();
+
+    function_(&ctx, astree->root);
+
+    hashcons::dtor(astree->root);
+
+    UTILS_LOGD(LOG_CSE, "%lu temporaries, %lu recomputations replaced by loads",
+               ctx.temporaries, ctx.loads);
+
+    vector_dtor(&ctx.entries);
+    vector_dtor(&ctx.replaced);
+}
+
+static void function_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        function_(ctx, node->left);
+        function_(ctx, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    ctx->func   = node;
+    ctx->env_id = node->token.scope_id;
+
+    block_(ctx, node->right);
+    flush_(ctx);
+}
+
+static void block_(Context* ctx, ast::ASTNode* chain)
+{
+    using namespace token;
+
+    for(; chain; chain = chain->right) {
+        ast::ASTNode* stmt = chain->left;
+        if(!stmt) continue;
+
+        if(stmt->token.type == TYPE_OPERATOR && stmt->token.val.op_type == OPERATOR_TYPE_ASSIGN) {
+            scan_(ctx, stmt->right);
+            kill_(ctx, stmt->left);
+            continue;
+        }
+
+        if(stmt->token.type != TYPE_KEYWORD) {
+            flush_(ctx);
+            continue;
+        }
+
+        switch(stmt->token.val.kw_type) {
+            case KEYWORD_TYPE_IN:
+                kill_(ctx, stmt->left);
+                break;
+
+            case KEYWORD_TYPE_OUT:
+                scan_(ctx, stmt->left);
+                break;
+
+            case KEYWORD_TYPE_RAMSET:
+                scan_(ctx, stmt->left);
+                scan_(ctx, stmt->right);
+                break;
+
+            case KEYWORD_TYPE_RETURN:
+                scan_(ctx, stmt->left);
+                flush_(ctx);
+                break;
+
+            case KEYWORD_TYPE_IF:
+                // condition is evaluated right after preceding statements
+                scan_(ctx, stmt->left);
+                flush_(ctx);
+
+                if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+                   && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                    block_(ctx, stmt->right->left);
+                    flush_(ctx);
+                    block_(ctx, stmt->right->right);
+                }
+                else
+                    block_(ctx, stmt->right);
+
+                flush_(ctx);
+                break;
+
+            case KEYWORD_TYPE_WHILE:
+                flush_(ctx);
+                block_(ctx, stmt->right);
+                flush_(ctx);
+                break;
+
+            case KEYWORD_TYPE_ELSE:
+            case KEYWORD_TYPE_DEFUN:
+            default:
+                flush_(ctx);
+                break;
+        }
+    }
+}
+
+static void scan_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(is_candidate_(node)) {
+        int id = hashcons::intern(node);
+
+        Entry* entry = NULL;
+        for(size_t i = 0; i < ctx->entries.size; ++i) {
+            Entry* other = (Entry*)vector_at(&ctx->entries, i);
+            if(other->available && other->cons_id == id) {
+                entry = other;
+                break;
+            }
+        }
+
+        if(!entry) {
+            Entry new_entry = {
+                .cons_id     = id,
+                .available   = true,
+                .cost        = cost::expression_cost(node),
+                .occurrences = VECTOR_INITLIST,
+            };
+
+            const size_t occurrences_cap = 4;
+            vector_ctor(&new_entry.occurrences, occurrences_cap, sizeof(ast::ASTNode*));
+
+            vector_push(&ctx->entries, &new_entry);
+            entry = (Entry*)vector_at(&ctx->entries, ctx->entries.size - 1);
+        }
+
+        vector_push(&entry->occurrences, &node);
+    }
+
+    // right operand of logical operator may be skipped at runtime
+    if(node->token.type == token::TYPE_OPERATOR
+       && (node->token.val.op_type == token::OPERATOR_TYPE_AND
+           || node->token.val.op_type == token::OPERATOR_TYPE_OR)) {
+        scan_(ctx, node->left);
+        return;
+    }
+
+    scan_(ctx, node->left);
+    scan_(ctx, node->right);
+}
+
+static void kill_(Context* ctx, ast::ASTNode* var)
+{
+    utils_assert(var);
+
+    for(size_t i = 0; i < ctx->entries.size; ++i) {
+        Entry* entry = (Entry*)vector_at(&ctx->entries, i);
+
+        if(entry->available && uses_var_(*(ast::ASTNode**)vector_at(&entry->occurrences, 0), var))
+            entry->available = false;
+    }
+}
+
+static void flush_(Context* ctx)
+{
+    // outer expressions first, they swallow occurrences of inner ones
+    size_t size = ctx->entries.size;
+
+    size_t* order = TYPED_CALLOC(size + 1, size_t);
+    utils_assert(order);
+
+    for(size_t i = 0; i < size; ++i) {
+        long entry_cost = ((Entry*)vector_at(&ctx->entries, i))->cost;
+
+        size_t j = i;
+        for(; j > 0 && ((Entry*)vector_at(&ctx->entries, order[j - 1]))->cost < entry_cost; --j)
+            order[j] = order[j - 1];
+
+        order[j] = i;
+    }
+
+    for(size_t i = 0; i < size; ++i)
+        eliminate_(ctx, (Entry*)vector_at(&ctx->entries, order[i]));
+
+    free(order);
+
+    for(size_t i = 0; i < size; ++i)
+        vector_dtor(&((Entry*)vector_at(&ctx->entries, i))->occurrences);
+
+    for(size_t i = 0; i < ctx->replaced.size; ++i)
+        ast::free_subtree(*(ast::ASTNode**)vector_at(&ctx->replaced, i));
+
+    vector_free(&ctx->entries);
+    vector_free(&ctx->replaced);
+}
+
+static void eliminate_(Context* ctx, Entry* entry)
+{
+    Vector* occurrences = &entry->occurrences;
+
+    // drop occurrences that went away with outer expression
+    size_t live = 0;
+    for(size_t i = 0; i < occurrences->size; ++i) {
+        ast::ASTNode* node = *(ast::ASTNode**)vector_at(occurrences, i);
+        if(is_live_(ctx, node))
+            *(ast::ASTNode**)vector_at(occurrences, live++) = node;
+    }
+
+    // hoisted trap must not overtake call evaluated before it
+    ast::ASTNode* first = *(ast::ASTNode**)vector_at(occurrences, 0);
+    if(live > 1 && ast::may_trap(first) && follows_call_(first))
+        return;
+
+    long cnt = (long) live;
+    if(cnt < 2 || (cnt - 1) * entry->cost <= cost::POPM + cnt * cost::PUSHM)
+        return;
+
+    token::Token tmp_tok    = ast::new_temporary(ctx->astree, ctx->env_id);
+    token::Token assign_tok = TOKEN_INITLIST;
+    assign_tok.type        = token::TYPE_OPERATOR;
+    assign_tok.val.op_type = token::OPERATOR_TYPE_ASSIGN;
+
+    for(size_t i = 0; i < live; ++i) {
+        ast::ASTNode* node = *(ast::ASTNode**)vector_at(occurrences, i);
+        ast::ASTNode* load = ast::new_node(&tmp_tok, NULL, NULL, NULL);
+
+        ast::replace_node(node, load);
+
+        if(i == 0) {
+            ast::ASTNode* assign = ast::new_node(
+                &assign_tok,
+                ast::new_node(&tmp_tok, NULL, NULL, NULL),
+                node,
+                NULL);
+
+            ast::insert_statement_before(ast::statement_of(load), assign);
+            continue;
+        }
+
+        node->parent = NULL;
+        vector_push(&ctx->replaced, &node);
+    }
+
+    UTILS_LOGD(LOG_CSE, "%.*s holds expression of cost %ld computed %ld times",
+               (int) tmp_tok.val.str.len, tmp_tok.val.str.str, entry->cost, cnt);
+
+    ctx->temporaries++;
+    ctx->loads += live - 1;
+}
+
+// replaced occurrences are cut off from function by NULL parent
+static bool is_live_(Context* ctx, ast::ASTNode* node)
+{
+    while(node && node != ctx->func)
+        node = node->parent;
+
+    return node != NULL;
+}
+
+static bool is_candidate_(ast::ASTNode* node)
+{
+    return node->token.type == token::TYPE_OPERATOR
+           && node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN
+           && !ast::holds_call(node);
+}
+
+// true if call in same statement is evaluated before node
+static bool follows_call_(ast::ASTNode* node)
+{
+    ast::ASTNode* stmt = ast::statement_of(node);
+
+    for(; node != stmt; node = node->parent) {
+        ast::ASTNode* parent = node->parent;
+        if(parent->right == node && ast::holds_call(parent->left))
+            return true;
+    }
+
+    return false;
+}
+
+static bool uses_var_(ast::ASTNode* node, ast::ASTNode* var)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_IDENTIFIER
+       && node->token.scope_id == var->token.scope_id
+       && node->token.inner_scope_id == var->token.inner_scope_id)
+        return true;
+
+    return uses_var_(node->left, var) || uses_var_(node->right, var);
+}
+
+} // cse
+} // compiler
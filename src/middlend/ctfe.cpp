@@ -0,0 +1,371 @@
+#include "ctfe.h"
+
+#include "assertutils.h"
+#include "ast.h"
+#include "callgraph.h"
+#include "evaluate.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace ctfe {
+
+ATTR_UNUSED static const char* LOG_CTFE = "CTFE";
+
+const size_t MAX_STEPS = 100000; // per evaluated call site
+const size_t MAX_DEPTH = 64;
+
+struct Context
+{
+    ast::AST* astree;
+
+    callgraph::CallGraph graph;
+
+    size_t steps;
+    size_t depth;
+
+    size_t evaluated;
+    size_t given_up;
+};
+
+struct Frame
+{
+    callgraph::Function* func;
+    int*                 vals;
+    bool*                set; // reading unassigned slot gives garbage at runtime
+};
+
+enum Status
+{
+    STATUS_NEXT,
+    STATUS_RETURN,
+    STATUS_FAIL,
+};
+
+static bool replace_calls_(Context* ctx, ast::ASTNode* node);
+
+static bool call_(Context* ctx, callgraph::Function* func, Vector* args, int* result);
+
+static Status block_(Context* ctx, Frame* frame, ast::ASTNode* chain, int* result);
+
+static Status statement_(Context* ctx, Frame* frame, ast::ASTNode* stmt, int* result);
+
+static bool eval_(Context* ctx, Frame* frame, ast::ASTNode* node, int* res);
+
+static bool eval_arguments_(Context* ctx, Frame* frame, ast::ASTNode* node, Vector* args);
+
+static bool step_(Context* ctx);
+
+static bool literal_arguments_(ast::ASTNode* node);
+
+bool evaluate_pure_calls(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree    = astree,
+        .graph     = {},
+        .steps     = 0,
+        .depth     = 0,
+        .evaluated = 0,
+        .given_up  = 0,
+    };
+
+    callgraph::ctor(&ctx.graph, astree);
+
+    bool changed = false;
+    for(size_t i = 0; i < ctx.graph.functions.size; ++i)
+        changed |= replace_calls_(&ctx, callgraph::get_function(&ctx.graph, i)->node->right);
+
+    UTILS_LOGD(LOG_CTFE, "%lu calls evaluated, %lu gave up", ctx.evaluated, ctx.given_up);
+
+    callgraph::dtor(&ctx.graph);
+
+    return changed;
+}
+
+static bool replace_calls_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_CALL && literal_arguments_(node->right)) {
+        callgraph::Function* callee = callgraph::find_function(&ctx->graph, &node->left->token.val.str);
+
+        if(callee && callee->pure) {
+            Vector args = VECTOR_INITLIST;
+            const size_t args_cap = 4;
+            vector_ctor(&args, args_cap, sizeof(int));
+
+            Vector arg_nodes = VECTOR_INITLIST;
+            vector_ctor(&arg_nodes, args_cap, sizeof(ast::ASTNode*));
+
+            ast::collect_list(node->right, &arg_nodes);
+            for(size_t i = 0; i < arg_nodes.size; ++i)
+                vector_push(&args, &(*(ast::ASTNode**)vector_at(&arg_nodes, i))->token.val.num);
+
+            vector_dtor(&arg_nodes);
+
+            ctx->steps = 0;
+            ctx->depth = 0;
+
+            int result = 0;
+            bool done = call_(ctx, callee, &args, &result);
+
+            vector_dtor(&args);
+
+            if(done) {
+                UTILS_LOGD(LOG_CTFE, "call of %.*s evaluated to %d",
+                           (int) node->left->token.val.str.len, node->left->token.val.str.str, result);
+
+                token::Token tok = TOKEN_INITLIST;
+                tok.type    = token::TYPE_NUM_LITERAL;
+                tok.val.num = result;
+
+                ast::replace_node(node, ast::new_node(&tok, NULL, NULL, NULL));
+                ast::free_subtree(node);
+
+                ctx->evaluated++;
+                return true;
+            }
+
+            ctx->given_up++;
+        }
+    }
+
+    bool left_changed  = replace_calls_(ctx, node->left);
+    bool right_changed = replace_calls_(ctx, node->right);
+
+    return left_changed || right_changed;
+}
+
+static bool call_(Context* ctx, callgraph::Function* func, Vector* args, int* result)
+{
+    Vector params = VECTOR_INITLIST;
+    const size_t params_cap = 4;
+    vector_ctor(&params, params_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(func->node->left, &params);
+
+    if(params.size != args->size || ctx->depth >= MAX_DEPTH) {
+        vector_dtor(&params);
+        return false;
+    }
+
+    Env* env = ast::get_enviroment(ctx->astree, func->node->token.scope_id);
+    size_t size = env->symbol_table.size;
+
+    Frame frame = {
+        .func = func,
+        .vals = TYPED_CALLOC(size + 1, int),
+        .set  = TYPED_CALLOC(size + 1, bool),
+    };
+    utils_assert(frame.vals);
+    utils_assert(frame.set);
+
+    for(size_t i = 0; i < params.size; ++i) {
+        int id = (*(ast::ASTNode**)vector_at(&params, i))->token.inner_scope_id;
+
+        frame.vals[id] = *(int*)vector_at(args, i);
+        frame.set[id]  = true;
+    }
+
+    vector_dtor(&params);
+
+    ctx->depth++;
+    Status status = block_(ctx, &frame, func->node->right, result);
+    ctx->depth--;
+
+    NFREE(frame.vals);
+    NFREE(frame.set);
+
+    // falling off function end leaves stale value in A0
+    return status == STATUS_RETURN;
+}
+
+static Status block_(Context* ctx, Frame* frame, ast::ASTNode* chain, int* result)
+{
+    for(; chain; chain = chain->right) {
+        if(!chain->left) continue;
+
+        Status status = statement_(ctx, frame, chain->left, result);
+        if(status != STATUS_NEXT)
+            return status;
+    }
+
+    return STATUS_NEXT;
+}
+
+static Status statement_(Context* ctx, Frame* frame, ast::ASTNode* stmt, int* result)
+{
+    using namespace token;
+
+    if(!step_(ctx))
+        return STATUS_FAIL;
+
+    int val = 0;
+
+    if(stmt->token.type == TYPE_OPERATOR && stmt->token.val.op_type == OPERATOR_TYPE_ASSIGN) {
+        if(!eval_(ctx, frame, stmt->right, &val))
+            return STATUS_FAIL;
+
+        int id = stmt->left->token.inner_scope_id;
+        frame->vals[id] = val;
+        frame->set[id]  = true;
+
+        return STATUS_NEXT;
+    }
+
+    if(stmt->token.type != TYPE_KEYWORD)
+        return eval_(ctx, frame, stmt, &val) ? STATUS_NEXT : STATUS_FAIL;
+
+    switch(stmt->token.val.kw_type) {
+        case KEYWORD_TYPE_RETURN:
+            if(!eval_(ctx, frame, stmt->left, result))
+                return STATUS_FAIL;
+
+            return STATUS_RETURN;
+
+        case KEYWORD_TYPE_IF: {
+            if(!eval_(ctx, frame, stmt->left, &val))
+                return STATUS_FAIL;
+
+            ast::ASTNode* body = stmt->right;
+
+            if(body && body->token.type == TYPE_KEYWORD && body->token.val.kw_type == KEYWORD_TYPE_ELSE)
+                return block_(ctx, frame, val ? body->left : body->right, result);
+
+            return val ? block_(ctx, frame, body, result) : STATUS_NEXT;
+        }
+
+        case KEYWORD_TYPE_WHILE:
+            for(;;) {
+                if(!eval_(ctx, frame, stmt->left, &val))
+                    return STATUS_FAIL;
+
+                if(!val)
+                    return STATUS_NEXT;
+
+                Status status = block_(ctx, frame, stmt->right, result);
+                if(status != STATUS_NEXT)
+                    return status;
+
+                if(!step_(ctx))
+                    return STATUS_FAIL;
+            }
+
+        case KEYWORD_TYPE_IN:
+        case KEYWORD_TYPE_OUT:
+        case KEYWORD_TYPE_RAMSET:
+        case KEYWORD_TYPE_ELSE:
+        case KEYWORD_TYPE_DEFUN:
+        default:
+            return STATUS_FAIL;
+    }
+}
+
+static bool eval_(Context* ctx, Frame* frame, ast::ASTNode* node, int* res)
+{
+    // missing operand (unary minus, sqrt) evaluates as zero
+    if(!node) {
+        *res = 0;
+        return true;
+    }
+
+    if(!step_(ctx))
+        return false;
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            *res = node->token.val.num;
+            return true;
+
+        case token::TYPE_IDENTIFIER: {
+            int id = node->token.inner_scope_id;
+
+            if(node->token.scope_id != frame->func->node->token.scope_id || !frame->set[id])
+                return false;
+
+            *res = frame->vals[id];
+            return true;
+        }
+
+        case token::TYPE_OPERATOR: {
+            int left = 0, right = 0;
+            if(!eval_(ctx, frame, node->left, &left) || !eval_(ctx, frame, node->right, &right))
+                return false;
+
+            token::OperatorType op_type = node->token.val.op_type;
+
+            // division by zero is left to trap at runtime,
+            // everything else wraps as in VM
+            if((op_type == token::OPERATOR_TYPE_DIV && right == 0)
+               || op_type == token::OPERATOR_TYPE_ASSIGN)
+                return false;
+
+            *res = evaluate_operator_type(op_type, left, right);
+            return true;
+        }
+
+        case token::TYPE_CALL: {
+            callgraph::Function* callee = callgraph::find_function(&ctx->graph, &node->left->token.val.str);
+            if(!callee)
+                return false;
+
+            Vector args = VECTOR_INITLIST;
+            const size_t args_cap = 4;
+            vector_ctor(&args, args_cap, sizeof(int));
+
+            bool done = eval_arguments_(ctx, frame, node->right, &args)
+                        && call_(ctx, callee, &args, res);
+
+            vector_dtor(&args);
+            return done;
+        }
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return false;
+    }
+}
+
+static bool eval_arguments_(Context* ctx, Frame* frame, ast::ASTNode* node, Vector* args)
+{
+    if(!node) return true;
+
+    if(node->token.type == token::TYPE_SEPARATOR)
+        return eval_arguments_(ctx, frame, node->left, args)
+               && eval_arguments_(ctx, frame, node->right, args);
+
+    int val = 0;
+    if(!eval_(ctx, frame, node, &val))
+        return false;
+
+    vector_push(args, &val);
+    return true;
+}
+
+static bool step_(Context* ctx)
+{
+    return ++ctx->steps <= MAX_STEPS;
+}
+
+static bool literal_arguments_(ast::ASTNode* node)
+{
+    if(!node) return true;
+
+    if(node->token.type == token::TYPE_SEPARATOR)
+        return literal_arguments_(node->left) && literal_arguments_(node->right);
+
+    return node->token.type == token::TYPE_NUM_LITERAL;
+}
+
+} // ctfe
+} // compiler
@@ -0,0 +1,335 @@
+#include "dse.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+
+namespace compiler {
+namespace dse {
+
+ATTR_UNUSED static const char* LOG_DSE = "DSE";
+
+struct Context
+{
+    ast::AST* astree;
+    int       env_id;
+    size_t    size;
+
+    size_t removed;
+    size_t kept_exprs;
+    size_t slots;
+};
+
+static void function_(Context* ctx, ast::ASTNode* node);
+
+static void block_(Context* ctx, ast::ASTNode* chain, bool* live, bool remove);
+
+static void statement_(Context* ctx, ast::ASTNode* stmt, bool* live, bool remove);
+
+static void loop_(Context* ctx, ast::ASTNode* loop, bool* live, bool remove);
+
+static void remove_store_(Context* ctx, ast::ASTNode* stmt);
+
+static void use_(Context* ctx, ast::ASTNode* node, bool* live);
+
+static void compact_(Context* ctx, ast::ASTNode* func);
+
+static void mark_used_(Context* ctx, ast::ASTNode* node, bool* used);
+
+static void renumber_(Context* ctx, ast::ASTNode* node, int* new_id);
+
+static bool tracked_(Context* ctx, ast::ASTNode* node);
+
+static bool keeps_expression_(ast::ASTNode* node);
+
+void eliminate_dead_stores(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree     = astree,
+        .env_id     = 0,
+        .size       = 0,
+        .removed    = 0,
+        .kept_exprs = 0,
+        .slots      = 0,
+    };
+
+    function_(&ctx, astree->root);
+
+    UTILS_LOGD(LOG_DSE, "%lu dead stores removed, %lu of them kept for calls or traps, %lu frame slots freed",
+               ctx.removed + ctx.kept_exprs, ctx.kept_exprs, ctx.slots);
+}
+
+static void function_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        function_(ctx, node->left);
+        function_(ctx, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    Env* env = ast::get_enviroment(ctx->astree, node->token.scope_id);
+    utils_assert(env);
+
+    ctx->env_id = node->token.scope_id;
+    ctx->size   = env->symbol_table.size;
+
+    // nothing is live after function ends
+    bool* live = TYPED_CALLOC(ctx->size + 1, bool);
+    utils_assert(live);
+
+    block_(ctx, node->right, live, true);
+
+    NFREE(live);
+
+    compact_(ctx, node);
+}
+
+// statements are visited last to first
+static void block_(Context* ctx, ast::ASTNode* chain, bool* live, bool remove)
+{
+    if(!chain) return;
+
+    block_(ctx, chain->right, live, remove);
+
+    if(chain->left)
+        statement_(ctx, chain->left, live, remove);
+}
+
+static void statement_(Context* ctx, ast::ASTNode* stmt, bool* live, bool remove)
+{
+    using namespace token;
+
+    if(stmt->token.type == TYPE_OPERATOR && stmt->token.val.op_type == OPERATOR_TYPE_ASSIGN) {
+        ast::ASTNode* var = stmt->left;
+
+        if(!tracked_(ctx, var) || live[var->token.inner_scope_id]) {
+            if(tracked_(ctx, var))
+                live[var->token.inner_scope_id] = false;
+
+            use_(ctx, stmt->right, live);
+            return;
+        }
+
+        // value of dead store is needed only for calls and traps
+        if(keeps_expression_(stmt->right))
+            use_(ctx, stmt->right, live);
+
+        if(remove)
+            remove_store_(ctx, stmt);
+
+        return;
+    }
+
+    if(stmt->token.type != TYPE_KEYWORD) {
+        use_(ctx, stmt, live);
+        return;
+    }
+
+    switch(stmt->token.val.kw_type) {
+        case KEYWORD_TYPE_IN:
+            // input is consumed anyway, so statement itself stays
+            if(tracked_(ctx, stmt->left))
+                live[stmt->left->token.inner_scope_id] = false;
+            break;
+
+        case KEYWORD_TYPE_RETURN:
+            memset(live, 0, ctx->size * sizeof(bool));
+            use_(ctx, stmt->left, live);
+            break;
+
+        case KEYWORD_TYPE_IF: {
+            bool* other = TYPED_CALLOC(ctx->size + 1, bool);
+            utils_assert(other);
+            memcpy(other, live, ctx->size * sizeof(bool));
+
+            if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+               && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                block_(ctx, stmt->right->left,  live,  remove);
+                block_(ctx, stmt->right->right, other, remove);
+            }
+            else
+                block_(ctx, stmt->right, live, remove);
+
+            for(size_t i = 0; i < ctx->size; ++i)
+                live[i] = live[i] || other[i];
+
+            NFREE(other);
+
+            use_(ctx, stmt->left, live);
+            break;
+        }
+
+        case KEYWORD_TYPE_WHILE:
+            loop_(ctx, stmt, live, remove);
+            break;
+
+        case KEYWORD_TYPE_OUT:
+        case KEYWORD_TYPE_RAMSET:
+        case KEYWORD_TYPE_ELSE:
+        case KEYWORD_TYPE_DEFUN:
+        default:
+            use_(ctx, stmt, live);
+            break;
+    }
+}
+
+// variables live at loop head are those live after loop, read by
+// condition or live on entry to body, iterated until nothing is added
+static void loop_(Context* ctx, ast::ASTNode* loop, bool* live, bool remove)
+{
+    bool* head = TYPED_CALLOC(ctx->size + 1, bool);
+    bool* body = TYPED_CALLOC(ctx->size + 1, bool);
+    utils_assert(head);
+    utils_assert(body);
+
+    memcpy(head, live, ctx->size * sizeof(bool));
+    use_(ctx, loop->left, head);
+
+    bool grown = true;
+    while(grown) {
+        memcpy(body, head, ctx->size * sizeof(bool));
+        block_(ctx, loop->right, body, false);
+
+        grown = false;
+        for(size_t i = 0; i < ctx->size; ++i) {
+            if(body[i] && !head[i]) {
+                head[i] = true;
+                grown   = true;
+            }
+        }
+    }
+
+    if(remove) {
+        memcpy(body, head, ctx->size * sizeof(bool));
+        block_(ctx, loop->right, body, true);
+    }
+
+    memcpy(live, head, ctx->size * sizeof(bool));
+
+    NFREE(head);
+    NFREE(body);
+}
+
+static void remove_store_(Context* ctx, ast::ASTNode* stmt)
+{
+    UTILS_LOGD(LOG_DSE, "store to %.*s is never read",
+               (int) stmt->left->token.val.str.len, stmt->left->token.val.str.str);
+
+    if(!keeps_expression_(stmt->right)) {
+        ast::remove_statement(stmt);
+        ctx->removed++;
+        return;
+    }
+
+    ast::ASTNode* expr = stmt->right;
+    stmt->right = NULL;
+
+    ast::replace_node(stmt, expr);
+    ast::free_subtree(stmt);
+
+    ctx->kept_exprs++;
+}
+
+static void use_(Context* ctx, ast::ASTNode* node, bool* live)
+{
+    if(!node) return;
+
+    if(tracked_(ctx, node))
+        live[node->token.inner_scope_id] = true;
+
+    use_(ctx, node->left,  live);
+    use_(ctx, node->right, live);
+}
+
+// symbol ids are frame slots, so unused ones are squeezed out keeping
+// order; function itself and parameters come first and stay in place
+static void compact_(Context* ctx, ast::ASTNode* func)
+{
+    Env* env = ast::get_enviroment(ctx->astree, ctx->env_id);
+
+    size_t size = env->symbol_table.size;
+
+    bool* used   = TYPED_CALLOC(size + 1, bool);
+    int*  new_id = TYPED_CALLOC(size + 1, int);
+    utils_assert(used);
+    utils_assert(new_id);
+
+    mark_used_(ctx, func, used);
+
+    Symbol* kept = TYPED_CALLOC(size + 1, Symbol);
+    utils_assert(kept);
+
+    size_t kept_cnt = 0;
+    for(size_t i = 0; i < size; ++i) {
+        if(!used[i]) continue;
+
+        new_id[i] = (int) kept_cnt;
+        kept[kept_cnt++] = *symbol_at(env, (int) i);
+    }
+
+    if(kept_cnt < size) {
+        renumber_(ctx, func, new_id);
+
+        vector_free(&env->symbol_table);
+        for(size_t i = 0; i < kept_cnt; ++i)
+            vector_push(&env->symbol_table, &kept[i]);
+
+        ctx->slots += size - kept_cnt;
+    }
+
+    NFREE(kept);
+    NFREE(new_id);
+    NFREE(used);
+}
+
+static void mark_used_(Context* ctx, ast::ASTNode* node, bool* used)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_IDENTIFIER && node->token.scope_id == ctx->env_id)
+        used[node->token.inner_scope_id] = true;
+
+    mark_used_(ctx, node->left,  used);
+    mark_used_(ctx, node->right, used);
+}
+
+static void renumber_(Context* ctx, ast::ASTNode* node, int* new_id)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_IDENTIFIER && node->token.scope_id == ctx->env_id)
+        node->token.inner_scope_id = new_id[node->token.inner_scope_id];
+
+    renumber_(ctx, node->left,  new_id);
+    renumber_(ctx, node->right, new_id);
+}
+
+static bool tracked_(Context* ctx, ast::ASTNode* node)
+{
+    return node
+           && node->token.type == token::TYPE_IDENTIFIER
+           && node->token.scope_id == ctx->env_id
+           && node->token.inner_scope_id >= 0
+           && (size_t) node->token.inner_scope_id < ctx->size;
+}
+
+static bool keeps_expression_(ast::ASTNode* node)
+{
+    return ast::holds_call(node) || ast::may_trap(node);
+}
+
+} // dse
+} // compiler
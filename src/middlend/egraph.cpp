@@ -0,0 +1,856 @@
+#include "egraph.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "cost.h"
+#include "evaluate.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "rewrite.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace egraph {
+
+ATTR_UNUSED static const char* LOG_EGRAPH = "EGRAPH";
+
+static const size_t MAX_NODES      = 2000;
+static const size_t MAX_ITERATIONS = 10;
+static const size_t MAX_MATCHES    = 4096;
+
+static const int NO_CLASS = -1;
+
+struct Rule
+{
+    const char* pattern;
+    const char* templ;
+    bool        drops_operand; // not applied to expressions which may trap
+};
+
+static const Rule rules_[] =
+{
+    { "(ADD ?a ?b)"                  , "(ADD ?b ?a)"          , false },
+    { "(MUL ?a ?b)"                  , "(MUL ?b ?a)"          , false },
+    { "(ADD (ADD ?a ?b) ?c)"         , "(ADD ?a (ADD ?b ?c))" , false },
+    { "(MUL (MUL ?a ?b) ?c)"         , "(MUL ?a (MUL ?b ?c))" , false },
+    { "(ADD ?a 0)"                   , "?a"                   , false },
+    { "(SUB ?a 0)"                   , "?a"                   , false },
+    { "(MUL ?a 1)"                   , "?a"                   , false },
+    { "(DIV ?a 1)"                   , "?a"                   , false },
+    { "(MUL ?a 0)"                   , "0"                    , true  },
+    { "(SUB ?a ?a)"                  , "0"                    , true  },
+    { "(ADD ?a ?a)"                  , "(MUL ?a 2)"           , false },
+    { "(ADD (MUL ?a ?b) (MUL ?a ?c))", "(MUL ?a (ADD ?b ?c))" , false },
+    { "(SUB (MUL ?a ?b) (MUL ?a ?c))", "(MUL ?a (SUB ?b ?c))" , false },
+    { "(MUL -1 ?a)"                  , "(SUB nil ?a)"         , false },
+    { "(SUB 0 ?a)"                   , "(SUB nil ?a)"         , false },
+    { "(SUB nil (SUB nil ?a))"       , "?a"                   , false },
+    { "(ADD (SUB nil ?a) ?b)"        , "(SUB ?b ?a)"          , false },
+    { "(SUB ?a (SUB nil ?b))"        , "(ADD ?a ?b)"          , false },
+    { "(MUL (SUB nil ?a) ?b)"        , "(SUB nil (MUL ?a ?b))", false },
+    { "(SUB nil (MUL ?a ?b))"        , "(MUL (SUB nil ?a) ?b)", false },
+};
+
+enum ENodeKind
+{
+    ENODE_KIND_NUM,
+    ENODE_KIND_LEAF,
+    ENODE_KIND_OPERATOR,
+};
+
+struct ENode
+{
+    ENodeKind kind;
+    int       val;      // literal, leaf index or operator type
+    int       child[2];
+    int       eclass;
+};
+
+struct EGraph
+{
+    Vector nodes;  // ENode
+    Vector uf;     // int, union-find parent of eclass id
+    Vector leaves; // ASTNode*, identifiers in expression
+
+    int*   table;  // hashcons: node id + 1, 0 is empty slot
+    size_t table_cap;
+
+    // rebuilt before every matching round
+    int*  head;    // first node of eclass
+    int*  next;    // next node in same eclass
+    int*  const_val;
+    bool* has_const;
+};
+
+struct Subst
+{
+    int eclass[rewrite::CAPTURE_CNT];
+};
+
+struct Match
+{
+    size_t rule;
+    int    eclass;
+    Subst  subst;
+};
+
+struct Stats
+{
+    size_t expressions;
+    size_t improved;
+    long   cost_before;
+    long   cost_after;
+};
+
+static void ctor_(EGraph* eg);
+
+static void dtor_(EGraph* eg);
+
+static int  find_(EGraph* eg, int eclass);
+
+static bool union_(EGraph* eg, int a, int b);
+
+static int  add_node_(EGraph* eg, ENode node);
+
+static int  add_ast_(EGraph* eg, ast::ASTNode* node);
+
+static void rebuild_(EGraph* eg);
+
+static void build_index_(EGraph* eg);
+
+static bool fold_constants_(EGraph* eg);
+
+static void ematch_(EGraph* eg, rewrite::Pattern* pattern, int eclass, Subst* subst, Vector* out);
+
+static int  instantiate_(EGraph* eg, rewrite::Pattern* templ, const Subst* subst);
+
+static bool fold_value_(EGraph* eg, rewrite::Pattern* templ, const Subst* subst, int* val);
+
+static void saturate_(EGraph* eg, rewrite::Pattern** rules, bool may_trap);
+
+static ast::ASTNode* extract_(EGraph* eg, int root, long* root_cost);
+
+static ast::ASTNode* build_ast_(EGraph* eg, int eclass, int* best_node);
+
+static bool is_candidate_(ast::ASTNode* node);
+
+static void optimize_subtree_(ast::AST* astree, ast::ASTNode* node, rewrite::Pattern** rules, Stats* stats);
+
+void optimize_expressions(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Vector pool = VECTOR_INITLIST;
+    vector_ctor(&pool, rewrite::PATTERN_POOL_CAP, sizeof(rewrite::Pattern*));
+
+    rewrite::Pattern* rules[SIZEOF(rules_) * 2] = {};
+
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        rules[2 * i]     = rewrite::parse_pattern(rules_[i].pattern, &pool);
+        rules[2 * i + 1] = rewrite::parse_pattern(rules_[i].templ, &pool);
+
+        utils_assert(rules[2 * i]);
+        utils_assert(rules[2 * i + 1]);
+    }
+
+    Stats stats = {};
+
+    optimize_subtree_(astree, astree->root, rules, &stats);
+
+    UTILS_LOGD(LOG_EGRAPH, "expressions: %lu, improved: %lu, cost: %ld -> %ld",
+               stats.expressions, stats.improved, stats.cost_before, stats.cost_after);
+
+    rewrite::free_patterns(&pool);
+}
+
+static void optimize_subtree_(ast::AST* astree, ast::ASTNode* node, rewrite::Pattern** rules, Stats* stats)
+{
+    if(!node) return;
+
+    if(!is_candidate_(node)) {
+        optimize_subtree_(astree, node->left,  rules, stats);
+        optimize_subtree_(astree, node->right, rules, stats);
+        return;
+    }
+
+    EGraph eg = {};
+    ctor_(&eg);
+
+    int root = add_ast_(&eg, node);
+
+    saturate_(&eg, rules, ast::may_trap(node));
+
+    long cost_before = cost::expression_cost(node);
+    long cost_after  = 0;
+
+    ast::ASTNode* best = extract_(&eg, root, &cost_after);
+
+    stats->expressions++;
+    stats->cost_before += cost_before;
+
+    if(best && cost_after < cost_before) {
+        UTILS_LOGD(LOG_EGRAPH, "expression %p: cost %ld -> %ld, %lu enodes",
+                   node, cost_before, cost_after, eg.nodes.size);
+
+        ast::replace_node(node, best);
+        ast::free_subtree(node);
+
+        stats->improved++;
+        stats->cost_after += cost_after;
+    }
+    else {
+        if(best) ast::free_subtree(best);
+        stats->cost_after += cost_before;
+    }
+
+    dtor_(&eg);
+}
+
+// operator trees over literals and variables, calls stay untouched
+static bool is_pure_expression_(ast::ASTNode* node)
+{
+    if(!node) return true;
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            return true;
+
+        case token::TYPE_IDENTIFIER:
+            return !node->left && !node->right;
+
+        case token::TYPE_OPERATOR:
+            return node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN
+                   && is_pure_expression_(node->left)
+                   && is_pure_expression_(node->right);
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return false;
+    }
+}
+
+static bool is_candidate_(ast::ASTNode* node)
+{
+    return node->token.type == token::TYPE_OPERATOR
+           && node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN
+           && is_pure_expression_(node);
+}
+
+/* ---------------------------- e-graph ---------------------------- */
+
+static ENode* node_(EGraph* eg, int id)
+{
+    return (ENode*)vector_at(&eg->nodes, (size_t) id);
+}
+
+static int* uf_(EGraph* eg, int id)
+{
+    return (int*)vector_at(&eg->uf, (size_t) id);
+}
+
+static void ctor_(EGraph* eg)
+{
+    const size_t nodes_cap = 64;
+    vector_ctor(&eg->nodes,  nodes_cap, sizeof(ENode));
+    vector_ctor(&eg->uf,     nodes_cap, sizeof(int));
+
+    const size_t leaves_cap = 8;
+    vector_ctor(&eg->leaves, leaves_cap, sizeof(ast::ASTNode*));
+
+    eg->table_cap = 256; // power of two, doubled by grow_table_
+    eg->table = TYPED_CALLOC(eg->table_cap, int);
+    utils_assert(eg->table);
+}
+
+static void dtor_(EGraph* eg)
+{
+    vector_dtor(&eg->nodes);
+    vector_dtor(&eg->uf);
+    vector_dtor(&eg->leaves);
+
+    NFREE(eg->table);
+    NFREE(eg->head);
+    NFREE(eg->next);
+    NFREE(eg->const_val);
+    NFREE(eg->has_const);
+}
+
+static int find_(EGraph* eg, int eclass)
+{
+    if(eclass == NO_CLASS) return NO_CLASS;
+
+    while(*uf_(eg, eclass) != eclass) {
+        *uf_(eg, eclass) = *uf_(eg, *uf_(eg, eclass));
+        eclass = *uf_(eg, eclass);
+    }
+
+    return eclass;
+}
+
+static bool union_(EGraph* eg, int a, int b)
+{
+    a = find_(eg, a);
+    b = find_(eg, b);
+
+    if(a == b || a == NO_CLASS || b == NO_CLASS)
+        return false;
+
+    if(a > b) { int tmp = a; a = b; b = tmp; }
+
+    *uf_(eg, b) = a;
+
+    return true;
+}
+
+static size_t hash_node_(EGraph* eg, ENode* node)
+{
+    size_t hash = (size_t) node->kind * 1000003u;
+    hash = (hash ^ (size_t)(unsigned) node->val) * 1000003u;
+    hash = (hash ^ (size_t)(unsigned) find_(eg, node->child[0])) * 1000003u;
+    hash = (hash ^ (size_t)(unsigned) find_(eg, node->child[1])) * 1000003u;
+    return hash;
+}
+
+static bool node_equal_(EGraph* eg, ENode* a, ENode* b)
+{
+    return a->kind == b->kind
+           && a->val == b->val
+           && find_(eg, a->child[0]) == find_(eg, b->child[0])
+           && find_(eg, a->child[1]) == find_(eg, b->child[1]);
+}
+
+// returns slot holding equal node or empty slot to insert into
+static size_t lookup_(EGraph* eg, ENode* node)
+{
+    size_t mask = eg->table_cap - 1;
+    size_t slot = hash_node_(eg, node) & mask;
+
+    while(eg->table[slot]) {
+        if(node_equal_(eg, node_(eg, eg->table[slot] - 1), node))
+            break;
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static void grow_table_(EGraph* eg)
+{
+    if(2 * (eg->nodes.size + 1) < eg->table_cap)
+        return;
+
+    NFREE(eg->table);
+
+    eg->table_cap *= 2;
+    eg->table = TYPED_CALLOC(eg->table_cap, int);
+    utils_assert(eg->table);
+
+    for(size_t i = 0; i < eg->nodes.size; ++i) {
+        size_t slot = lookup_(eg, node_(eg, (int) i));
+        if(!eg->table[slot])
+            eg->table[slot] = (int) i + 1;
+    }
+}
+
+static int add_node_(EGraph* eg, ENode node)
+{
+    node.child[0] = find_(eg, node.child[0]);
+    node.child[1] = find_(eg, node.child[1]);
+
+    size_t slot = lookup_(eg, &node);
+    if(eg->table[slot])
+        return find_(eg, node_(eg, eg->table[slot] - 1)->eclass);
+
+    int id = (int) eg->nodes.size;
+    node.eclass = id;
+
+    vector_push(&eg->nodes, &node);
+    vector_push(&eg->uf, &id);
+
+    eg->table[slot] = id + 1;
+
+    grow_table_(eg);
+
+    return id;
+}
+
+static int add_ast_(EGraph* eg, ast::ASTNode* node)
+{
+    if(!node) return NO_CLASS;
+
+    ENode enode = { ENODE_KIND_NUM, 0, { NO_CLASS, NO_CLASS }, NO_CLASS };
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            enode.val = node->token.val.num;
+            break;
+
+        case token::TYPE_IDENTIFIER:
+        {
+            enode.kind = ENODE_KIND_LEAF;
+            enode.val  = -1;
+
+            for(size_t i = 0; i < eg->leaves.size; ++i) {
+                ast::ASTNode* leaf = *(ast::ASTNode**)vector_at(&eg->leaves, i);
+                if(leaf->token.scope_id == node->token.scope_id
+                   && leaf->token.inner_scope_id == node->token.inner_scope_id) {
+                    enode.val = (int) i;
+                    break;
+                }
+            }
+
+            if(enode.val < 0) {
+                enode.val = (int) eg->leaves.size;
+                vector_push(&eg->leaves, &node);
+            }
+            break;
+        }
+
+        case token::TYPE_OPERATOR:
+            enode.kind     = ENODE_KIND_OPERATOR;
+            enode.val      = node->token.val.op_type;
+            enode.child[0] = add_ast_(eg, node->left);
+            enode.child[1] = add_ast_(eg, node->right);
+            break;
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            utils_assert(0 && "not an expression");
+            return NO_CLASS;
+    }
+
+    return add_node_(eg, enode);
+}
+
+// restores congruence: equal nodes after unions must share eclass
+static void rebuild_(EGraph* eg)
+{
+    bool changed = true;
+
+    while(changed) {
+        changed = false;
+
+        memset(eg->table, 0, eg->table_cap * sizeof(eg->table[0]));
+
+        for(size_t i = 0; i < eg->nodes.size; ++i) {
+            ENode* node = node_(eg, (int) i);
+            node->child[0] = find_(eg, node->child[0]);
+            node->child[1] = find_(eg, node->child[1]);
+
+            size_t slot = lookup_(eg, node);
+
+            if(eg->table[slot])
+                changed |= union_(eg, node->eclass, node_(eg, eg->table[slot] - 1)->eclass);
+            else
+                eg->table[slot] = (int) i + 1;
+        }
+    }
+}
+
+static void build_index_(EGraph* eg)
+{
+    size_t size = eg->nodes.size;
+
+    NFREE(eg->head);
+    NFREE(eg->next);
+    NFREE(eg->const_val);
+    NFREE(eg->has_const);
+
+    eg->head      = TYPED_CALLOC(size, int);
+    eg->next      = TYPED_CALLOC(size, int);
+    eg->const_val = TYPED_CALLOC(size, int);
+    eg->has_const = TYPED_CALLOC(size, bool);
+
+    utils_assert(eg->head && eg->next && eg->const_val && eg->has_const);
+
+    for(size_t i = 0; i < size; ++i)
+        eg->head[i] = NO_CLASS;
+
+    for(size_t i = size; i-- > 0;) {
+        ENode* node = node_(eg, (int) i);
+        int eclass = find_(eg, node->eclass);
+
+        eg->next[i] = eg->head[eclass];
+        eg->head[eclass] = (int) i;
+
+        if(node->kind == ENODE_KIND_NUM) {
+            eg->has_const[eclass] = true;
+            eg->const_val[eclass] = node->val;
+        }
+    }
+}
+
+static bool class_const_(EGraph* eg, int eclass, int* val)
+{
+    if(eclass == NO_CLASS) {
+        *val = 0;
+        return true;
+    }
+
+    eclass = find_(eg, eclass);
+    if((size_t) eclass >= eg->nodes.size || !eg->has_const[eclass])
+        return false;
+
+    *val = eg->const_val[eclass];
+    return true;
+}
+
+// constant folding analysis: operator over constants joins literal's eclass
+static bool fold_constants_(EGraph* eg)
+{
+    bool changed = false;
+    size_t size = eg->nodes.size;
+
+    for(size_t i = 0; i < size; ++i) {
+        ENode node = *node_(eg, (int) i);
+
+        if(node.kind != ENODE_KIND_OPERATOR || eg->has_const[find_(eg, node.eclass)])
+            continue;
+
+        int left = 0, right = 0;
+        if(!class_const_(eg, node.child[0], &left) || !class_const_(eg, node.child[1], &right))
+            continue;
+
+        token::OperatorType op_type = (token::OperatorType) node.val;
+
+        if((op_type == token::OPERATOR_TYPE_DIV && right == 0)
+           || (op_type == token::OPERATOR_TYPE_POW && right < 0))
+            continue;
+
+        ENode literal = {
+            ENODE_KIND_NUM,
+            evaluate_operator_type(op_type, left, right),
+            { NO_CLASS, NO_CLASS },
+            NO_CLASS
+        };
+
+        changed |= union_(eg, node.eclass, add_node_(eg, literal));
+    }
+
+    return changed;
+}
+
+static void ematch_(EGraph* eg, rewrite::Pattern* pattern, int eclass, Subst* subst, Vector* out)
+{
+    using namespace rewrite;
+
+    if(out->size >= MAX_MATCHES)
+        return;
+
+    int val = 0;
+
+    switch(pattern->type) {
+        case PATTERN_TYPE_NIL:
+            if(eclass == NO_CLASS)
+                vector_push(out, subst);
+            return;
+
+        case PATTERN_TYPE_NUM:
+            if(eclass != NO_CLASS && class_const_(eg, eclass, &val) && val == pattern->num)
+                vector_push(out, subst);
+            return;
+
+        case PATTERN_TYPE_CONST:
+            if(eclass == NO_CLASS || !class_const_(eg, eclass, &val))
+                return;
+            if(pattern->predicate == PREDICATE_NONZERO && val == 0)
+                return;
+            // fallthrough
+
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+        {
+            if(eclass == NO_CLASS)
+                return;
+
+            int bound = subst->eclass[pattern->capture];
+            if(bound != NO_CLASS) {
+                if(find_(eg, bound) == find_(eg, eclass))
+                    vector_push(out, subst);
+                return;
+            }
+
+            Subst extended = *subst;
+            extended.eclass[pattern->capture] = find_(eg, eclass);
+            vector_push(out, &extended);
+            return;
+        }
+
+        case PATTERN_TYPE_OPERATOR:
+        {
+            if(eclass == NO_CLASS)
+                return;
+
+            Vector partial = VECTOR_INITLIST;
+            vector_ctor(&partial, 4, sizeof(Subst));
+
+            for(int id = eg->head[find_(eg, eclass)]; id != NO_CLASS; id = eg->next[id]) {
+                ENode* node = node_(eg, id);
+                if(node->kind != ENODE_KIND_OPERATOR || node->val != (int) pattern->op_type)
+                    continue;
+
+                vector_free(&partial);
+                ematch_(eg, pattern->left, node->child[0], subst, &partial);
+
+                for(size_t i = 0; i < partial.size; ++i)
+                    ematch_(eg, pattern->right, node->child[1], (Subst*)vector_at(&partial, i), out);
+            }
+
+            vector_dtor(&partial);
+            return;
+        }
+
+        case PATTERN_TYPE_FOLD:
+        default:
+            return;
+    }
+}
+
+static bool fold_value_(EGraph* eg, rewrite::Pattern* templ, const Subst* subst, int* val)
+{
+    using namespace rewrite;
+
+    int left = 0, right = 0;
+
+    switch(templ->type) {
+        case PATTERN_TYPE_NUM:
+            *val = templ->num;
+            return true;
+
+        case PATTERN_TYPE_CONST:
+            return class_const_(eg, subst->eclass[templ->capture], val);
+
+        case PATTERN_TYPE_FOLD:
+            if(!fold_value_(eg, templ->left, subst, &left) || !fold_value_(eg, templ->right, subst, &right))
+                return false;
+            *val = evaluate_operator_type(templ->op_type, left, right);
+            return true;
+
+        case PATTERN_TYPE_NIL:
+        case PATTERN_TYPE_OPERATOR:
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+        default:
+            return false;
+    }
+}
+
+static int instantiate_(EGraph* eg, rewrite::Pattern* templ, const Subst* subst)
+{
+    using namespace rewrite;
+
+    ENode enode = { ENODE_KIND_NUM, 0, { NO_CLASS, NO_CLASS }, NO_CLASS };
+
+    switch(templ->type) {
+        case PATTERN_TYPE_NIL:
+            return NO_CLASS;
+
+        case PATTERN_TYPE_NUM:
+        case PATTERN_TYPE_FOLD:
+            if(!fold_value_(eg, templ, subst, &enode.val))
+                return NO_CLASS;
+            return add_node_(eg, enode);
+
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+        case PATTERN_TYPE_CONST:
+            return subst->eclass[templ->capture];
+
+        case PATTERN_TYPE_OPERATOR:
+            enode.kind     = ENODE_KIND_OPERATOR;
+            enode.val      = templ->op_type;
+            enode.child[0] = instantiate_(eg, templ->left,  subst);
+            enode.child[1] = instantiate_(eg, templ->right, subst);
+            return add_node_(eg, enode);
+
+        default:
+            return NO_CLASS;
+    }
+}
+
+static void saturate_(EGraph* eg, rewrite::Pattern** rules, bool may_trap)
+{
+    Vector matches = VECTOR_INITLIST;
+    vector_ctor(&matches, 64, sizeof(Match));
+
+    Vector substs = VECTOR_INITLIST;
+    vector_ctor(&substs, 16, sizeof(Subst));
+
+    Subst empty = {};
+    for(int i = 0; i < rewrite::CAPTURE_CNT; ++i)
+        empty.eclass[i] = NO_CLASS;
+
+    for(size_t iter = 0; iter < MAX_ITERATIONS && eg->nodes.size < MAX_NODES; ++iter) {
+        rebuild_(eg);
+        build_index_(eg);
+
+        bool changed = fold_constants_(eg);
+        if(changed) {
+            rebuild_(eg);
+            build_index_(eg);
+        }
+
+        // match everything first, index goes stale once nodes are added
+        vector_free(&matches);
+        size_t classes = eg->nodes.size;
+
+        for(size_t rule = 0; rule < SIZEOF(rules_); ++rule) {
+            if(may_trap && rules_[rule].drops_operand)
+                continue;
+
+            for(size_t eclass = 0; eclass < classes; ++eclass) {
+                if(find_(eg, (int) eclass) != (int) eclass)
+                    continue;
+
+                vector_free(&substs);
+                ematch_(eg, rules[2 * rule], (int) eclass, &empty, &substs);
+
+                for(size_t i = 0; i < substs.size && matches.size < MAX_MATCHES; ++i) {
+                    Match match = { rule, (int) eclass, *(Subst*)vector_at(&substs, i) };
+                    vector_push(&matches, &match);
+                }
+            }
+        }
+
+        for(size_t i = 0; i < matches.size && eg->nodes.size < MAX_NODES; ++i) {
+            Match* match = (Match*)vector_at(&matches, i);
+
+            int eclass = instantiate_(eg, rules[2 * match->rule + 1], &match->subst);
+            if(eclass != NO_CLASS)
+                changed |= union_(eg, match->eclass, eclass);
+        }
+
+        if(!changed) {
+            UTILS_LOGD(LOG_EGRAPH, "saturated after %lu iterations", iter + 1);
+            break;
+        }
+    }
+
+    rebuild_(eg);
+
+    vector_dtor(&substs);
+    vector_dtor(&matches);
+}
+
+/* --------------------------- extraction -------------------------- */
+
+static long enode_cost_(EGraph* eg, ENode* node, long* best_cost)
+{
+    long total = 0;
+
+    switch(node->kind) {
+        case ENODE_KIND_NUM:
+            return cost::PUSH;
+
+        case ENODE_KIND_LEAF:
+            return cost::PUSHM;
+
+        case ENODE_KIND_OPERATOR:
+            total = cost::operator_cost((token::OperatorType) node->val, node->child[0] == NO_CLASS);
+
+            for(int i = 0; i < 2; ++i) {
+                if(node->child[i] == NO_CLASS) continue;
+
+                long child_cost = best_cost[find_(eg, node->child[i])];
+                if(child_cost == LONG_MAX)
+                    return LONG_MAX;
+
+                total += child_cost;
+            }
+            return total;
+
+        default:
+            return LONG_MAX;
+    }
+}
+
+static ast::ASTNode* extract_(EGraph* eg, int root, long* root_cost)
+{
+    size_t size = eg->nodes.size;
+
+    long* best_cost = TYPED_CALLOC(size, long);
+    int*  best_node = TYPED_CALLOC(size, int);
+    utils_assert(best_cost && best_node);
+
+    for(size_t i = 0; i < size; ++i) {
+        best_cost[i] = LONG_MAX;
+        best_node[i] = NO_CLASS;
+    }
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+
+        for(size_t i = 0; i < size; ++i) {
+            ENode* node = node_(eg, (int) i);
+            int eclass = find_(eg, node->eclass);
+
+            long node_cost = enode_cost_(eg, node, best_cost);
+            if(node_cost < best_cost[eclass]) {
+                best_cost[eclass] = node_cost;
+                best_node[eclass] = (int) i;
+                changed = true;
+            }
+        }
+    }
+
+    root = find_(eg, root);
+    *root_cost = best_cost[root];
+
+    ast::ASTNode* tree = *root_cost == LONG_MAX ? NULL : build_ast_(eg, root, best_node);
+
+    free(best_cost);
+    free(best_node);
+
+    return tree;
+}
+
+static ast::ASTNode* build_ast_(EGraph* eg, int eclass, int* best_node)
+{
+    if(eclass == NO_CLASS)
+        return NULL;
+
+    ENode* node = node_(eg, best_node[find_(eg, eclass)]);
+    token::Token tok = TOKEN_INITLIST;
+
+    switch(node->kind) {
+        case ENODE_KIND_NUM:
+            tok.type    = token::TYPE_NUM_LITERAL;
+            tok.val.num = node->val;
+            return ast::new_node(&tok, NULL, NULL, NULL);
+
+        case ENODE_KIND_LEAF:
+            tok = (*(ast::ASTNode**)vector_at(&eg->leaves, (size_t) node->val))->token;
+            return ast::new_node(&tok, NULL, NULL, NULL);
+
+        case ENODE_KIND_OPERATOR:
+            tok.type        = token::TYPE_OPERATOR;
+            tok.val.op_type = (token::OperatorType) node->val;
+            return ast::new_node(
+                &tok,
+                build_ast_(eg, node->child[0], best_node),
+                build_ast_(eg, node->child[1], best_node),
+                NULL);
+
+        default:
+            return NULL;
+    }
+}
+
+} // egraph
+} // compiler
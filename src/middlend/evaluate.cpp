@@ -15,7 +15,9 @@ static int evaluate_(ast::ASTNode* node);
 
 static int evaluate_(ast::ASTNode* node) 
 {
-    utils_assert(node);
+    // missing operand (unary minus, sqrt) evaluates as zero
+    if(!node)
+        return 0;
 
     switch(node->token.type) {
 
@@ -41,26 +43,34 @@ int evaluate_operator(ast::ASTNode* node)
     utils_assert(node);
     utils_assert(node->token.type == token::TYPE_OPERATOR);
 
-    int res = 0;
-
     int left = evaluate_(node->left);
     int right = evaluate_(node->right);
 
-    switch(node->token.val.op_type) {
+    return evaluate_operator_type(node->token.val.op_type, left, right);
+}
+
+// arithmetic wraps and sqrt of nonpositive is zero, as in VM
+int evaluate_operator_type(token::OperatorType op_type, int left, int right)
+{
+    int res = 0;
+
+    switch(op_type) {
         case token::OPERATOR_TYPE_ADD:
-            res = left + right;
+            res = (int) ((unsigned) left + (unsigned) right);
             break;
 
         case token::OPERATOR_TYPE_SUB:
-            res = left - right;
+            res = (int) ((unsigned) left - (unsigned) right);
             break;
 
         case token::OPERATOR_TYPE_MUL:
-            res = left * right;
+            res = (int) ((unsigned) left * (unsigned) right);
             break;
 
         case token::OPERATOR_TYPE_DIV:
-            res = left / right;
+            utils_assert(right != 0 && "division by zero is left to trap at runtime");
+            // INT_MIN / -1 wraps
+            res = right == -1 ? (int) (0u - (unsigned) left) : left / right;
             break;
 
         case token::OPERATOR_TYPE_POW:
@@ -68,11 +78,11 @@ int evaluate_operator(ast::ASTNode* node)
             break;
 
         case token::OPERATOR_TYPE_OR:
-            res = left | right;
+            res = left || right;
             break;
 
         case token::OPERATOR_TYPE_AND:
-            res = left & right;
+            res = left && right;
             break;
 
         case token::OPERATOR_TYPE_EQ:
@@ -103,7 +113,7 @@ int evaluate_operator(ast::ASTNode* node)
             break;
 
         case token::OPERATOR_TYPE_SQRT:
-            res = (int)sqrt(left);
+            res = left > 0 ? (int)sqrt(left) : 0;
             break;
     }
 
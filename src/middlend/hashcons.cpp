@@ -0,0 +1,224 @@
+#include "hashcons.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace hashcons {
+
+ATTR_UNUSED static const char* LOG_HASHCONS = "HASHCONS";
+
+struct Entry
+{
+    token::Type type;
+    int         val;
+    int         scope_id;
+    int         inner_scope_id;
+    int         left;
+    int         right;
+};
+
+static Vector entries_ = {}; // Entry, id is index + 1
+
+static int*   slots_    = NULL; // id, 0 is empty slot
+static size_t slot_cap_ = 0;
+
+static size_t lookups_ = 0;
+static size_t shared_  = 0;
+
+static Entry  entry_(ast::ASTNode* node);
+
+static size_t hash_entry_(Entry* entry);
+
+static bool   entry_equal_(Entry* a, Entry* b);
+
+static size_t find_slot_(Entry* entry);
+
+static void   grow_();
+
+static void   reset_ids_(ast::ASTNode* node);
+
+void ctor()
+{
+    const size_t entries_cap = 64;
+    vector_ctor(&entries_, entries_cap, sizeof(Entry));
+
+    slot_cap_ = 2 * entries_cap;
+    slots_ = TYPED_CALLOC(slot_cap_, int);
+    utils_assert(slots_);
+
+    lookups_ = 0;
+    shared_  = 0;
+}
+
+void dtor(ast::ASTNode* root)
+{
+    reset_ids_(root);
+
+    vector_dtor(&entries_);
+
+    NFREE(slots_);
+    slot_cap_ = 0;
+}
+
+int intern(ast::ASTNode* node)
+{
+    utils_assert(slots_);
+
+    if(!node)
+        return 0;
+
+    if(node->cons_id)
+        return node->cons_id;
+
+    intern(node->left);
+    intern(node->right);
+
+    Entry entry = entry_(node);
+
+    lookups_++;
+
+    size_t slot = find_slot_(&entry);
+
+    if(slots_[slot]) {
+        shared_++;
+        node->cons_id = slots_[slot];
+        return node->cons_id;
+    }
+
+    vector_push(&entries_, &entry);
+
+    node->cons_id = (int) entries_.size;
+    slots_[slot]  = node->cons_id;
+
+    grow_();
+
+    return node->cons_id;
+}
+
+bool equal(ast::ASTNode* a, ast::ASTNode* b)
+{
+    return intern(a) == intern(b);
+}
+
+void log_stats()
+{
+    UTILS_LOGD(LOG_HASHCONS, "%lu distinct subtrees, %lu of %lu lookups shared",
+               entries_.size, shared_, lookups_);
+}
+
+static Entry entry_(ast::ASTNode* node)
+{
+    Entry entry = {
+        .type           = node->token.type,
+        .val            = 0,
+        .scope_id       = 0,
+        .inner_scope_id = 0,
+        .left           = node->left  ? node->left->cons_id  : 0,
+        .right          = node->right ? node->right->cons_id : 0,
+    };
+
+    switch(node->token.type) {
+        case token::TYPE_IDENTIFIER:
+            entry.scope_id       = node->token.scope_id;
+            entry.inner_scope_id = node->token.inner_scope_id;
+            break;
+
+        case token::TYPE_NUM_LITERAL:
+            entry.val = node->token.val.num;
+            break;
+
+        case token::TYPE_OPERATOR:
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+            entry.val = node->token.val.enum_val;
+            break;
+
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            break;
+    }
+
+    return entry;
+}
+
+static size_t hash_entry_(Entry* entry)
+{
+    const size_t mult = 1000003u;
+
+    size_t hash = (size_t) entry->type;
+    hash = (hash ^ (size_t)(unsigned) entry->val)            * mult;
+    hash = (hash ^ (size_t)(unsigned) entry->scope_id)       * mult;
+    hash = (hash ^ (size_t)(unsigned) entry->inner_scope_id) * mult;
+    hash = (hash ^ (size_t)(unsigned) entry->left)           * mult;
+    hash = (hash ^ (size_t)(unsigned) entry->right)          * mult;
+
+    return hash;
+}
+
+static bool entry_equal_(Entry* a, Entry* b)
+{
+    return a->type           == b->type
+        && a->val            == b->val
+        && a->scope_id       == b->scope_id
+        && a->inner_scope_id == b->inner_scope_id
+        && a->left           == b->left
+        && a->right          == b->right;
+}
+
+// returns slot holding equal entry or empty slot
+static size_t find_slot_(Entry* entry)
+{
+    size_t mask = slot_cap_ - 1;
+    size_t slot = hash_entry_(entry) & mask;
+
+    while(slots_[slot]) {
+        Entry* other = (Entry*)vector_at(&entries_, (size_t) slots_[slot] - 1);
+        if(entry_equal_(entry, other))
+            break;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static void grow_()
+{
+    if(2 * entries_.size < slot_cap_)
+        return;
+
+    NFREE(slots_);
+
+    slot_cap_ *= 2;
+    slots_ = TYPED_CALLOC(slot_cap_, int);
+    utils_assert(slots_);
+
+    for(size_t i = 0; i < entries_.size; ++i) {
+        size_t slot = find_slot_((Entry*)vector_at(&entries_, i));
+        slots_[slot] = (int) i + 1;
+    }
+}
+
+static void reset_ids_(ast::ASTNode* node)
+{
+    if(!node) return;
+
+    node->cons_id = 0;
+
+    reset_ids_(node->left);
+    reset_ids_(node->right);
+}
+
+} // hashcons
+} // compiler
@@ -0,0 +1,512 @@
+#include "inliner.h"
+
+#include "assertutils.h"
+#include "ast.h"
+#include "callgraph.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace inliner {
+
+ATTR_UNUSED static const char* LOG_INLINER = "INLINER";
+
+// translator spends about 2k + 6 instructions on call with k arguments,
+// body may be that many times bigger and still be worth copying
+const size_t CALL_BASE_COST  = 6;
+const size_t SIZE_FACTOR     = 4;
+const size_t GROWTH_FACTOR   = 2; // of whole program size
+
+// parallel to functions of call graph
+struct Function
+{
+    ast::ASTNode* node;
+    size_t        size;
+    bool          recursive;
+    bool          inlinable; // returns can be turned into assignments
+};
+
+struct Context
+{
+    ast::AST* astree;
+    int       env_id; // of caller
+
+    callgraph::CallGraph graph;
+    Vector               functions; // Function
+
+    size_t budget; // nodes inlining may still add
+    size_t inlined;
+};
+
+static void caller_(Context* ctx, ast::ASTNode* node);
+
+static void block_(Context* ctx, ast::ASTNode* chain);
+
+static bool try_inline_(Context* ctx, ast::ASTNode* stmt, ast::ASTNode* expr);
+
+static ast::ASTNode* first_call_(ast::ASTNode* node, bool* conditional);
+
+static bool follows_trap_(ast::ASTNode* call, ast::ASTNode* expr);
+
+static void inline_call_(Context* ctx, ast::ASTNode* stmt, ast::ASTNode* call, Function* callee);
+
+static void rebind_(Context* ctx, ast::ASTNode* node, int callee_env_id, token::Token* slots, bool* bound);
+
+static void returns_to_assignments_(ast::ASTNode* node, token::Token* result_tok);
+
+static bool normalize_(ast::ASTNode* chain);
+
+static bool always_returns_(ast::ASTNode* chain);
+
+static Function* find_function_(Context* ctx, utils_str_t* name);
+
+static bool holds_return_(ast::ASTNode* node);
+
+void inline_calls(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree    = astree,
+        .env_id    = 0,
+        .graph     = {},
+        .functions = VECTOR_INITLIST,
+        .budget    = 0,
+        .inlined   = 0,
+    };
+
+    const size_t functions_cap = 8;
+    vector_ctor(&ctx.functions, functions_cap, sizeof(Function));
+
+    callgraph::ctor(&ctx.graph, astree);
+
+    size_t functions_cnt = ctx.graph.functions.size;
+    for(size_t i = 0; i < functions_cnt; ++i) {
+        callgraph::Function* info = callgraph::get_function(&ctx.graph, i);
+
+        Function func = {
+            .node      = info->node,
+            .size      = ast::count_nodes(info->node->right),
+            .recursive = info->recursive,
+            .inlinable = false,
+        };
+
+        // clone is normalized, so check is done on throwaway copy
+        ast::ASTNode* copy = ast::copy_subtree(astree, func.node->right, NULL);
+        func.inlinable = normalize_(copy);
+        ast::free_subtree(copy);
+
+        vector_push(&ctx.functions, &func);
+    }
+
+    ctx.budget = ast::count_nodes(astree->root) * GROWTH_FACTOR;
+
+    // callees first, so they are copied with their own calls inlined
+    for(size_t i = 0; i < functions_cnt; ++i) {
+        size_t ind = *(size_t*)vector_at(&ctx.graph.order, i);
+        caller_(&ctx, ((Function*)vector_at(&ctx.functions, ind))->node);
+    }
+
+    UTILS_LOGD(LOG_INLINER, "%lu calls inlined", ctx.inlined);
+
+    callgraph::dtor(&ctx.graph);
+    vector_dtor(&ctx.functions);
+}
+
+static void caller_(Context* ctx, ast::ASTNode* func)
+{
+    ctx->env_id = func->token.scope_id;
+    block_(ctx, func->right);
+}
+
+// statement is revisited after inlining, copied body may hold
+// more calls and statement itself may hold next one
+static void block_(Context* ctx, ast::ASTNode* chain)
+{
+    using namespace token;
+
+    ast::ASTNode* link = chain;
+
+    while(link) {
+        ast::ASTNode* stmt = link->left;
+
+        if(!stmt) {
+            link = link->right;
+            continue;
+        }
+
+        bool is_while = stmt->token.type == TYPE_KEYWORD && stmt->token.val.kw_type == KEYWORD_TYPE_WHILE;
+        bool is_if    = stmt->token.type == TYPE_KEYWORD && stmt->token.val.kw_type == KEYWORD_TYPE_IF;
+
+        // loop condition is evaluated on every iteration, it can not be hoisted
+        if(!is_while && try_inline_(ctx, stmt, is_if ? stmt->left : stmt))
+            continue;
+
+        if(is_while)
+            block_(ctx, stmt->right);
+
+        if(is_if) {
+            if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+               && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                block_(ctx, stmt->right->left);
+                block_(ctx, stmt->right->right);
+            }
+            else
+                block_(ctx, stmt->right);
+        }
+
+        link = link->right;
+    }
+}
+
+// only call evaluated first in statement is taken, moving it in front
+// of statement does not reorder it with anything that has effects,
+// unless operand evaluated before it may trap
+static bool try_inline_(Context* ctx, ast::ASTNode* stmt, ast::ASTNode* expr)
+{
+    bool conditional = false;
+    ast::ASTNode* call = first_call_(expr, &conditional);
+
+    if(!call || conditional || follows_trap_(call, expr))
+        return false;
+
+    Function* callee = find_function_(ctx, &call->left->token.val.str);
+    if(!callee || callee->recursive || !callee->inlinable || callgraph::is_main(callee->node))
+        return false;
+
+    Vector args = VECTOR_INITLIST;
+    const size_t args_cap = 4;
+    vector_ctor(&args, args_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(call->right, &args);
+    size_t argcnt = args.size;
+
+    Vector params = VECTOR_INITLIST;
+    vector_ctor(&params, args_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(callee->node->left, &params);
+    size_t paramcnt = params.size;
+
+    vector_dtor(&args);
+    vector_dtor(&params);
+
+    if(argcnt != paramcnt)
+        return false;
+
+    // callee may have grown by calls inlined into it
+    callee->size = ast::count_nodes(callee->node->right);
+
+    size_t limit = (2 * argcnt + CALL_BASE_COST) * SIZE_FACTOR;
+    if(callee->size > limit || callee->size > ctx->budget)
+        return false;
+
+    ctx->budget -= callee->size;
+
+    inline_call_(ctx, stmt, call, callee);
+
+    return true;
+}
+
+// post-order, as translator evaluates; right operand of logical
+// operator may be skipped at runtime
+static ast::ASTNode* first_call_(ast::ASTNode* node, bool* conditional)
+{
+    if(!node) return NULL;
+
+    ast::ASTNode* call = NULL;
+
+    if(node->token.type == token::TYPE_CALL) {
+        call = first_call_(node->right, conditional);
+        return call ? call : node;
+    }
+
+    call = first_call_(node->left, conditional);
+    if(call) return call;
+
+    call = first_call_(node->right, conditional);
+
+    if(call && node->token.type == token::TYPE_OPERATOR
+       && (node->token.val.op_type == token::OPERATOR_TYPE_AND
+           || node->token.val.op_type == token::OPERATOR_TYPE_OR))
+        *conditional = true;
+
+    return call;
+}
+
+static bool follows_trap_(ast::ASTNode* call, ast::ASTNode* expr)
+{
+    for(ast::ASTNode* node = call; node != expr; node = node->parent) {
+        ast::ASTNode* parent = node->parent;
+        if(parent->right == node && ast::may_trap(parent->left))
+            return true;
+    }
+
+    return false;
+}
+
+// x = f(a, b) becomes
+// p = a; q = b; <body with returns turned into r = ...>; x = r;
+static void inline_call_(Context* ctx, ast::ASTNode* stmt, ast::ASTNode* call, Function* callee)
+{
+    using namespace token;
+
+    ast::AST* astree = ctx->astree;
+    ast::ASTNode* func = callee->node;
+
+    UTILS_LOGD(LOG_INLINER, "inlining %.*s of size %lu",
+               (int) func->token.val.str.len, func->token.val.str.str, callee->size);
+
+    int callee_env_id = func->token.scope_id;
+    size_t slots_cnt = ast::get_enviroment(astree, callee_env_id)->symbol_table.size;
+
+    token::Token* slots = TYPED_CALLOC(slots_cnt + 1, token::Token);
+    bool*         bound = TYPED_CALLOC(slots_cnt + 1, bool);
+    utils_assert(slots);
+    utils_assert(bound);
+
+    Token assign_tok = TOKEN_INITLIST;
+    assign_tok.type        = TYPE_OPERATOR;
+    assign_tok.val.op_type = OPERATOR_TYPE_ASSIGN;
+
+    Vector args = VECTOR_INITLIST, params = VECTOR_INITLIST;
+    const size_t args_cap = 4;
+    vector_ctor(&args,   args_cap, sizeof(ast::ASTNode*));
+    vector_ctor(&params, args_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(call->right, &args);
+    ast::collect_list(func->left,  &params);
+
+    for(size_t i = 0; i < args.size; ++i) {
+        ast::ASTNode* arg   = *(ast::ASTNode**)vector_at(&args,   i);
+        ast::ASTNode* param = *(ast::ASTNode**)vector_at(&params, i);
+
+        ast::ASTNode* target = ast::copy_subtree(astree, param, NULL);
+        rebind_(ctx, target, callee_env_id, slots, bound);
+
+        ast::ASTNode* assign = ast::new_node(&assign_tok, target, ast::copy_subtree(astree, arg, NULL), NULL);
+        ast::insert_statement_before(stmt, assign);
+    }
+
+    vector_dtor(&args);
+    vector_dtor(&params);
+
+    ast::ASTNode* body = ast::copy_subtree(astree, func->right, NULL);
+    normalize_(body);
+    rebind_(ctx, body, callee_env_id, slots, bound);
+
+    token::Token result_tok = ast::new_temporary(astree, ctx->env_id);
+    returns_to_assignments_(body, &result_tok);
+
+    for(ast::ASTNode* link = body; link; link = link->right) {
+        if(!link->left) continue;
+
+        ast::ASTNode* body_stmt = link->left;
+        link->left = NULL;
+        ast::insert_statement_before(stmt, body_stmt);
+    }
+
+    ast::free_subtree(body);
+
+    ast::replace_node(call, ast::new_node(&result_tok, NULL, NULL, NULL));
+    ast::free_subtree(call);
+
+    NFREE(slots);
+    NFREE(bound);
+
+    ctx->inlined++;
+}
+
+// moves identifiers of callee env into caller env, every callee
+// variable gets its own fresh temporary
+static void rebind_(Context* ctx, ast::ASTNode* node, int callee_env_id, token::Token* slots, bool* bound)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_CALL) {
+        // callee names are looked up by string, slot only has to exist
+        ast::ASTNode* name = node->left;
+        name->token.scope_id       = ctx->env_id;
+        name->token.inner_scope_id = add_symbol_to_env(
+            ast::get_enviroment(ctx->astree, ctx->env_id), &name->token.val.str, SYMBOL_TYPE_VARIABLE);
+
+        rebind_(ctx, node->right, callee_env_id, slots, bound);
+        return;
+    }
+
+    if(node->token.type == token::TYPE_IDENTIFIER && node->token.scope_id == callee_env_id) {
+        int id = node->token.inner_scope_id;
+
+        if(!bound[id]) {
+            slots[id] = ast::new_temporary(ctx->astree, ctx->env_id);
+            bound[id] = true;
+        }
+
+        node->token = slots[id];
+    }
+
+    rebind_(ctx, node->left,  callee_env_id, slots, bound);
+    rebind_(ctx, node->right, callee_env_id, slots, bound);
+}
+
+static void returns_to_assignments_(ast::ASTNode* node, token::Token* result_tok)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_KEYWORD && node->token.val.kw_type == token::KEYWORD_TYPE_RETURN) {
+        node->token.type        = token::TYPE_OPERATOR;
+        node->token.val.op_type = token::OPERATOR_TYPE_ASSIGN;
+
+        node->right = node->left;
+        node->left  = ast::new_node(result_tok, NULL, NULL, node);
+        return;
+    }
+
+    returns_to_assignments_(node->left,  result_tok);
+    returns_to_assignments_(node->right, result_tok);
+}
+
+// restructures chain so that every return is last statement on its path:
+// statements following IF with returning arm move into the other arm,
+// false if some return can not be placed so
+static bool normalize_(ast::ASTNode* chain)
+{
+    using namespace token;
+
+    for(ast::ASTNode* link = chain; link; link = link->right) {
+        ast::ASTNode* stmt = link->left;
+        if(!stmt || stmt->token.type != TYPE_KEYWORD) continue;
+
+        switch(stmt->token.val.kw_type) {
+            case KEYWORD_TYPE_RETURN:
+                if(link->right) return false;
+                break;
+
+            case KEYWORD_TYPE_WHILE:
+                if(holds_return_(stmt->right)) return false;
+                break;
+
+            case KEYWORD_TYPE_IF: {
+                if(!holds_return_(stmt->right))
+                    break;
+
+                bool has_else = stmt->right && stmt->right->token.type == TYPE_KEYWORD
+                                && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE;
+
+                ast::ASTNode* rest = link->right;
+
+                if(!rest) {
+                    if(has_else)
+                        return normalize_(stmt->right->left) && normalize_(stmt->right->right);
+
+                    return normalize_(stmt->right);
+                }
+
+                link->right = NULL;
+
+                if(!has_else) {
+                    Token else_tok = TOKEN_INITLIST;
+                    else_tok.type        = TYPE_KEYWORD;
+                    else_tok.val.kw_type = KEYWORD_TYPE_ELSE;
+
+                    stmt->right = ast::new_node(&else_tok, stmt->right, NULL, stmt);
+                }
+
+                ast::ASTNode* arms = stmt->right;
+
+                if(!normalize_(arms->left) || !normalize_(arms->right)) {
+                    link->right = rest;
+                    return false;
+                }
+
+                bool left_returns  = always_returns_(arms->left);
+                bool right_returns = always_returns_(arms->right);
+
+                if((holds_return_(arms->left) && !left_returns)
+                   || (holds_return_(arms->right) && !right_returns)) {
+                    link->right = rest;
+                    return false;
+                }
+
+                if(left_returns && right_returns) {
+                    ast::free_subtree(rest);
+                    return true;
+                }
+
+                // rest goes to arm that falls through, one arm returns here
+                ast::ASTNode** arm = left_returns ? &arms->right : &arms->left;
+
+                if(!*arm) {
+                    *arm = rest;
+                    rest->parent = arms;
+                }
+                else {
+                    ast::ASTNode* tail = *arm;
+                    while(tail->right) tail = tail->right;
+
+                    tail->right  = rest;
+                    rest->parent = tail;
+                }
+
+                return normalize_(*arm);
+            }
+
+            case KEYWORD_TYPE_ELSE:
+            case KEYWORD_TYPE_DEFUN:
+            case KEYWORD_TYPE_IN:
+            case KEYWORD_TYPE_OUT:
+            case KEYWORD_TYPE_RAMSET:
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+static bool always_returns_(ast::ASTNode* chain)
+{
+    if(!chain) return false;
+
+    while(chain->right)
+        chain = chain->right;
+
+    ast::ASTNode* stmt = chain->left;
+    if(!stmt || stmt->token.type != token::TYPE_KEYWORD)
+        return false;
+
+    if(stmt->token.val.kw_type == token::KEYWORD_TYPE_RETURN)
+        return true;
+
+    if(stmt->token.val.kw_type == token::KEYWORD_TYPE_IF && stmt->right
+       && stmt->right->token.type == token::TYPE_KEYWORD
+       && stmt->right->token.val.kw_type == token::KEYWORD_TYPE_ELSE)
+        return always_returns_(stmt->right->left) && always_returns_(stmt->right->right);
+
+    return false;
+}
+
+static Function* find_function_(Context* ctx, utils_str_t* name)
+{
+    callgraph::Function* info = callgraph::find_function(&ctx->graph, name);
+    if(!info)
+        return NULL;
+
+    return (Function*)vector_at(&ctx->functions, callgraph::function_index(&ctx->graph, info));
+}
+
+static bool holds_return_(ast::ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_KEYWORD && node->token.val.kw_type == token::KEYWORD_TYPE_RETURN)
+        return true;
+
+    return holds_return_(node->left) || holds_return_(node->right);
+}
+
+} // inliner
+} // compiler
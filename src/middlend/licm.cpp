@@ -0,0 +1,460 @@
+#include "licm.h"
+
+#include "assertutils.h"
+#include "ast.h"
+#include "cost.h"
+#include "hashcons.h"
+#include "logutils.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace licm {
+
+ATTR_UNUSED static const char* LOG_LICM = "LICM";
+
+struct Invariant
+{
+    int    cons_id;
+    bool   needs_guard; // may trap and is not computed by loop condition
+    Vector occurrences; // ASTNode*
+};
+
+struct Context
+{
+    ast::AST* astree;
+    int       env_id;
+
+    ast::ASTNode* loop;
+    bool          guard_possible;
+
+    Vector assigned;   // ASTNode*, variables written inside loop
+    Vector invariants; // Invariant
+
+    size_t hoisted;
+    size_t guarded;
+};
+
+static void function_(Context* ctx, ast::ASTNode* node);
+
+static void block_(Context* ctx, ast::ASTNode* chain);
+
+static void loop_(Context* ctx, ast::ASTNode* loop);
+
+static void collect_assigned_(Context* ctx, ast::ASTNode* node);
+
+static void scan_body_(Context* ctx, ast::ASTNode* chain);
+
+static void scan_statement_(Context* ctx, ast::ASTNode* stmt, bool sure);
+
+static void scan_(Context* ctx, ast::ASTNode* node, bool sure, bool in_cond);
+
+static bool is_invariant_(Context* ctx, ast::ASTNode* node);
+
+static void record_(Context* ctx, ast::ASTNode* node, bool needs_guard);
+
+static ast::ASTNode* guard_(ast::AST* astree, ast::ASTNode* loop);
+
+static void hoist_(Context* ctx, Invariant* inv);
+
+static bool holds_return_(ast::ASTNode* node);
+
+static bool holds_effect_(ast::ASTNode* node);
+
+void hoist_loop_invariants(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree         = astree,
+        .env_id         = 0,
+        .loop           = NULL,
+        .guard_possible = false,
+        .assigned       = VECTOR_INITLIST,
+        .invariants     = VECTOR_INITLIST,
+        .hoisted        = 0,
+        .guarded        = 0,
+    };
+
+    const size_t vec_cap = 16;
+    vector_ctor(&ctx.assigned,   vec_cap, sizeof(ast::ASTNode*));
+    vector_ctor(&ctx.invariants, vec_cap, sizeof(Invariant));
+
+    hashcons::ctor();
+
+    function_(&ctx, astree->root);
+
+    hashcons::dtor(astree->root);
+
+    UTILS_LOGD(LOG_LICM, "%lu expressions hoisted, %lu loops guarded", ctx.hoisted, ctx.guarded);
+
+    vector_dtor(&ctx.assigned);
+    vector_dtor(&ctx.invariants);
+}
+
+static void function_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        function_(ctx, node->left);
+        function_(ctx, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    ctx->env_id = node->token.scope_id;
+
+    block_(ctx, node->right);
+}
+
+// outer loops first, so expressions invariant in both leave both
+static void block_(Context* ctx, ast::ASTNode* chain)
+{
+    using namespace token;
+
+    while(chain) {
+        // hoisting links new statements in front of loop
+        ast::ASTNode* next = chain->right;
+        ast::ASTNode* stmt = chain->left;
+
+        if(stmt && stmt->token.type == TYPE_KEYWORD) {
+            switch(stmt->token.val.kw_type) {
+                case KEYWORD_TYPE_WHILE:
+                    loop_(ctx, stmt);
+                    block_(ctx, stmt->right);
+                    break;
+
+                case KEYWORD_TYPE_IF:
+                    if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+                       && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                        block_(ctx, stmt->right->left);
+                        block_(ctx, stmt->right->right);
+                    }
+                    else
+                        block_(ctx, stmt->right);
+                    break;
+
+                case KEYWORD_TYPE_ELSE:
+                case KEYWORD_TYPE_DEFUN:
+                case KEYWORD_TYPE_RETURN:
+                case KEYWORD_TYPE_IN:
+                case KEYWORD_TYPE_OUT:
+                case KEYWORD_TYPE_RAMSET:
+                default:
+                    break;
+            }
+        }
+
+        chain = next;
+    }
+}
+
+static void loop_(Context* ctx, ast::ASTNode* loop)
+{
+    ctx->loop           = loop;
+    ctx->guard_possible = !ast::holds_call(loop->left);
+
+    vector_free(&ctx->assigned);
+    collect_assigned_(ctx, loop);
+
+    // condition runs at least once, body only if it holds,
+    // call in condition may have effects before trap
+    scan_(ctx, loop->left, ctx->guard_possible, true);
+    scan_body_(ctx, loop->right);
+
+    bool needs_guard = false;
+    for(size_t i = 0; i < ctx->invariants.size; ++i)
+        needs_guard |= ((Invariant*)vector_at(&ctx->invariants, i))->needs_guard;
+
+    if(needs_guard) {
+        guard_(ctx->astree, loop);
+        ctx->guarded++;
+    }
+
+    for(size_t i = 0; i < ctx->invariants.size; ++i) {
+        Invariant* inv = (Invariant*)vector_at(&ctx->invariants, i);
+
+        hoist_(ctx, inv);
+        vector_dtor(&inv->occurrences);
+    }
+
+    vector_free(&ctx->invariants);
+}
+
+static void collect_assigned_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    bool assign = node->token.type == token::TYPE_OPERATOR
+                  && node->token.val.op_type == token::OPERATOR_TYPE_ASSIGN;
+    bool in     = node->token.type == token::TYPE_KEYWORD
+                  && node->token.val.kw_type == token::KEYWORD_TYPE_IN;
+
+    if(assign || in)
+        vector_push(&ctx->assigned, &node->left);
+
+    collect_assigned_(ctx, node->left);
+    collect_assigned_(ctx, node->right);
+}
+
+// top-level statements up to first possible return run on every iteration,
+// trap is hoisted only if no observable effect comes before it
+static void scan_body_(Context* ctx, ast::ASTNode* chain)
+{
+    bool sure = true;
+
+    for(; chain; chain = chain->right) {
+        ast::ASTNode* stmt = chain->left;
+        if(!stmt) continue;
+
+        scan_statement_(ctx, stmt, sure && !ast::holds_call(stmt));
+
+        if(holds_return_(stmt) || holds_effect_(stmt))
+            sure = false;
+    }
+}
+
+static void scan_statement_(Context* ctx, ast::ASTNode* stmt, bool sure)
+{
+    using namespace token;
+
+    if(stmt->token.type == TYPE_OPERATOR && stmt->token.val.op_type == OPERATOR_TYPE_ASSIGN) {
+        scan_(ctx, stmt->right, sure, false);
+        return;
+    }
+
+    if(stmt->token.type != TYPE_KEYWORD)
+        return;
+
+    switch(stmt->token.val.kw_type) {
+        case KEYWORD_TYPE_OUT:
+        case KEYWORD_TYPE_RETURN:
+            scan_(ctx, stmt->left, sure, false);
+            break;
+
+        case KEYWORD_TYPE_RAMSET:
+            scan_(ctx, stmt->left,  sure, false);
+            scan_(ctx, stmt->right, sure, false);
+            break;
+
+        case KEYWORD_TYPE_IF:
+        case KEYWORD_TYPE_WHILE:
+            scan_(ctx, stmt->left, sure, false);
+
+            if(stmt->right && stmt->right->token.type == TYPE_KEYWORD
+               && stmt->right->token.val.kw_type == KEYWORD_TYPE_ELSE) {
+                for(ast::ASTNode* chain = stmt->right->left; chain; chain = chain->right)
+                    if(chain->left) scan_statement_(ctx, chain->left, false);
+                for(ast::ASTNode* chain = stmt->right->right; chain; chain = chain->right)
+                    if(chain->left) scan_statement_(ctx, chain->left, false);
+            }
+            else {
+                for(ast::ASTNode* chain = stmt->right; chain; chain = chain->right)
+                    if(chain->left) scan_statement_(ctx, chain->left, false);
+            }
+            break;
+
+        case KEYWORD_TYPE_IN:
+        case KEYWORD_TYPE_ELSE:
+        case KEYWORD_TYPE_DEFUN:
+        default:
+            break;
+    }
+}
+
+static void scan_(Context* ctx, ast::ASTNode* node, bool sure, bool in_cond)
+{
+    if(!node) return;
+
+    if(is_invariant_(ctx, node)) {
+        bool traps = ast::may_trap(node);
+
+        // trapping expression must not run where original program would not
+        if(!traps || (in_cond && sure)) {
+            record_(ctx, node, false);
+            return;
+        }
+
+        if(sure && ctx->guard_possible) {
+            record_(ctx, node, true);
+            return;
+        }
+    }
+
+    bool logical = node->token.type == token::TYPE_OPERATOR
+                   && (node->token.val.op_type == token::OPERATOR_TYPE_AND
+                       || node->token.val.op_type == token::OPERATOR_TYPE_OR);
+
+    scan_(ctx, node->left,  sure, in_cond);
+    scan_(ctx, node->right, sure && !logical, in_cond);
+}
+
+static bool operands_invariant_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return true;
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            return true;
+
+        case token::TYPE_IDENTIFIER:
+            for(size_t i = 0; i < ctx->assigned.size; ++i) {
+                ast::ASTNode* var = *(ast::ASTNode**)vector_at(&ctx->assigned, i);
+                if(var->token.scope_id == node->token.scope_id
+                   && var->token.inner_scope_id == node->token.inner_scope_id)
+                    return false;
+            }
+            return true;
+
+        case token::TYPE_OPERATOR:
+            return node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN
+                   && operands_invariant_(ctx, node->left)
+                   && operands_invariant_(ctx, node->right);
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return false;
+    }
+}
+
+static bool is_invariant_(Context* ctx, ast::ASTNode* node)
+{
+    return node->token.type == token::TYPE_OPERATOR
+           && node->token.val.op_type != token::OPERATOR_TYPE_ASSIGN
+           && cost::expression_cost(node) > cost::PUSHM
+           && operands_invariant_(ctx, node);
+}
+
+static void record_(Context* ctx, ast::ASTNode* node, bool needs_guard)
+{
+    int id = hashcons::intern(node);
+
+    Invariant* inv = NULL;
+    for(size_t i = 0; i < ctx->invariants.size; ++i) {
+        Invariant* other = (Invariant*)vector_at(&ctx->invariants, i);
+        if(other->cons_id == id) {
+            inv = other;
+            break;
+        }
+    }
+
+    if(!inv) {
+        Invariant new_inv = {
+            .cons_id     = id,
+            .needs_guard = needs_guard,
+            .occurrences = VECTOR_INITLIST,
+        };
+
+        const size_t occurrences_cap = 4;
+        vector_ctor(&new_inv.occurrences, occurrences_cap, sizeof(ast::ASTNode*));
+
+        vector_push(&ctx->invariants, &new_inv);
+        inv = (Invariant*)vector_at(&ctx->invariants, ctx->invariants.size - 1);
+    }
+    else
+        inv->needs_guard &= needs_guard;
+
+    vector_push(&inv->occurrences, &node);
+}
+
+// while c {...} -> if c { while c {...} }, hoisted code goes in front of loop
+static ast::ASTNode* guard_(ast::AST* astree, ast::ASTNode* loop)
+{
+    token::Token if_tok = TOKEN_INITLIST;
+    if_tok.type        = token::TYPE_KEYWORD;
+    if_tok.val.kw_type = token::KEYWORD_TYPE_IF;
+
+    token::Token chain_tok = TOKEN_INITLIST;
+    chain_tok.type         = token::TYPE_SEPARATOR;
+    chain_tok.val.sep_type = token::SEPARATOR_TYPE_SEMICOLON;
+
+    ast::ASTNode* chain = ast::new_node(&chain_tok, NULL, NULL, NULL);
+    ast::ASTNode* guard = ast::new_node(&if_tok, ast::copy_subtree(astree, loop->left, NULL), chain, NULL);
+
+    ast::replace_node(loop, guard);
+
+    chain->left  = loop;
+    loop->parent = chain;
+
+    return guard;
+}
+
+static void hoist_(Context* ctx, Invariant* inv)
+{
+    token::Token tmp_tok    = ast::new_temporary(ctx->astree, ctx->env_id);
+    token::Token assign_tok = TOKEN_INITLIST;
+    assign_tok.type        = token::TYPE_OPERATOR;
+    assign_tok.val.op_type = token::OPERATOR_TYPE_ASSIGN;
+
+    for(size_t i = 0; i < inv->occurrences.size; ++i) {
+        ast::ASTNode* node = *(ast::ASTNode**)vector_at(&inv->occurrences, i);
+
+        ast::replace_node(node, ast::new_node(&tmp_tok, NULL, NULL, NULL));
+
+        if(i == 0) {
+            ast::ASTNode* assign = ast::new_node(
+                &assign_tok,
+                ast::new_node(&tmp_tok, NULL, NULL, NULL),
+                node,
+                NULL);
+
+            ast::insert_statement_before(ctx->loop, assign);
+        }
+        else
+            ast::free_subtree(node);
+    }
+
+    UTILS_LOGD(LOG_LICM, "%.*s hoisted out of loop %p, %lu uses",
+               (int) tmp_tok.val.str.len, tmp_tok.val.str.str, ctx->loop, inv->occurrences.size);
+
+    ctx->hoisted++;
+}
+
+static bool holds_return_(ast::ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_KEYWORD && node->token.val.kw_type == token::KEYWORD_TYPE_RETURN)
+        return true;
+
+    return holds_return_(node->left) || holds_return_(node->right);
+}
+
+static bool holds_effect_(ast::ASTNode* node)
+{
+    if(!node) return false;
+
+    if(node->token.type == token::TYPE_CALL)
+        return true;
+
+    if(node->token.type == token::TYPE_KEYWORD) {
+        switch(node->token.val.kw_type) {
+            case token::KEYWORD_TYPE_IN:
+            case token::KEYWORD_TYPE_OUT:
+            case token::KEYWORD_TYPE_RAMSET:
+                return true;
+
+            case token::KEYWORD_TYPE_IF:
+            case token::KEYWORD_TYPE_WHILE:
+            case token::KEYWORD_TYPE_ELSE:
+            case token::KEYWORD_TYPE_DEFUN:
+            case token::KEYWORD_TYPE_RETURN:
+            default:
+                break;
+        }
+    }
+
+    return holds_effect_(node->left) || holds_effect_(node->right);
+}
+
+} // licm
+} // compiler
@@ -1,6 +1,7 @@
 #include <cstdlib>
 #include <error.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
 #include "ioutils.h"
@@ -17,6 +18,7 @@ static utils_long_opt_t long_opts[] =
     { OPT_ARG_REQUIRED, "log",    NULL, 0, 0 },
     { OPT_ARG_REQUIRED, "in" ,    NULL, 0, 0 },
     { OPT_ARG_REQUIRED, "out" ,   NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "egraph", NULL, 0, 0 },
 };
 
 #ifdef _DEBUG
@@ -60,7 +62,10 @@ int main(int argc, char* argv[])
             GOTO_END;
         }
 
-        optimizer::optimize(&astree);
+        optimizer::Config config = OPTIMIZER_CONFIG_INITLIST;
+        config.egraph = long_opts[3].arg && !strcmp(long_opts[3].arg, "on");
+
+        optimizer::optimize(&astree, &config);
 
         FILE* file_ast_reduced = open_file(long_opts[2].arg, "w");
         if(!file_ast_reduced) {
@@ -7,6 +7,18 @@
 #include "utils.h"
 #include "evaluate.h"
 #include "compiler_error.h"
+#include "rewrite.h"
+#include "egraph.h"
+#include "hashcons.h"
+#include "cse.h"
+#include "licm.h"
+#include "constprop.h"
+#include "dse.h"
+#include "tailrec.h"
+#include "inliner.h"
+#include "ctfe.h"
+#include "specialize.h"
+#include "callgraph.h"
 
 namespace compiler {
 namespace optimizer {
@@ -21,34 +33,75 @@ static ast::ASTNode* const_(int num);
 
 static ast::ASTNode* const_fold_(ast::AST* astree, ast::ASTNode* node);
 
-static ast::ASTNode* eliminate_neutral_(ast::AST* astree, ast::ASTNode* node);
+static void simplify_(ast::AST* astree);
 
-static ast::ASTNode* eliminate_neutral_mul_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right);
+static void eliminate_dead_code_(ast::ASTNode* node);
 
-static ast::ASTNode* eliminate_neutral_add_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right);
+static bool prune_block_(ast::ASTNode* chain);
 
-static ast::ASTNode* eliminate_neutral_pow_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right);
+static bool prune_statement_(ast::ASTNode* link);
 
-static ast::ASTNode* eliminate_dead_code_(ast::AST* astree, ast::ASTNode* node);
+static void splice_(ast::ASTNode* link, ast::ASTNode* body);
 
-void optimize(ast::AST *astree)
+void optimize(ast::AST *astree, const Config* config)
 {
     utils_assert(astree);
+    utils_assert(config);
 
     Err err = ERR_NONE; 
 
     AST_DUMP(astree, err);
 
-    eliminate_dead_code_(astree, astree->root);
+    tailrec::introduce_accumulators(astree);
+    inliner::inline_calls(astree);
 
+    hashcons::ctor();
+    rewrite::ctor();
+
+    simplify_(astree);
+
+    // literal arguments are known only after folding, clones are
+    // folded once more with their literal parameters
+    if(specialize::specialize_functions(astree))
+        simplify_(astree);
+
+    rewrite::log_stats();
+    rewrite::dtor();
+
+    hashcons::log_stats();
+    hashcons::dtor(astree->root);
+
+    // inlining, evaluation and specialization leave callees unused
+    size_t removed = callgraph::remove_unreachable(astree);
+    UTILS_LOGD(LOG_OPTIMIZE, "%lu unreachable functions removed", removed);
+
+    if(config->egraph)
+        egraph::optimize_expressions(astree);
+
+    dse::eliminate_dead_stores(astree);
+
+    licm::hoist_loop_invariants(astree);
+    cse::eliminate_common_subexpressions(astree);
+
+    AST_DUMP(astree, err);
+}
+
+static void simplify_(ast::AST* astree)
+{
     do {
         treeChanged = false;
         const_fold_(astree, astree->root);
-        eliminate_neutral_(astree, astree->root);
+        rewrite::apply(astree, astree->root, &treeChanged);
 
-    } while(treeChanged);
+        if(constprop::propagate(astree))
+            treeChanged = true;
 
-    AST_DUMP(astree, err);
+        if(ctfe::evaluate_pure_calls(astree))
+            treeChanged = true;
+
+        eliminate_dead_code_(astree->root);
+
+    } while(treeChanged);
 }
 
 static bool ast_subtree_holds_identifier_(ast::ASTNode* node)
@@ -96,18 +149,19 @@ static ast::ASTNode* const_fold_(ast::AST* astree, ast::ASTNode* node)
 
     UTILS_LOGD(LOG_OPTIMIZE, "node %p %s, %d, %d", node, token::value_str(&node->token), left_holds_id, right_holds_id);
 
+    // division by zero is left to trap at runtime
+    if(node->token.val.op_type == token::OPERATOR_TYPE_DIV
+       && right && right->token.type == token::TYPE_NUM_LITERAL && right->token.val.num == 0)
+        return node;
+
     if(!left_holds_id && !right_holds_id) {
 
         int value = evaluate_operator(node);
         ast::ASTNode* new_node = const_(value);
         
-        if(node->parent->left == node)
-            node->parent->left = new_node;
-
-        if(node->parent->right == node)
-            node->parent->right = new_node;
+        ast::replace_node(node, new_node);
         
-        ast::mark_to_delete(astree, node);
+        ast::free_subtree(node);
 
         treeChanged = true;
 
@@ -117,136 +171,146 @@ static ast::ASTNode* const_fold_(ast::AST* astree, ast::ASTNode* node)
     return node;
 }
 
-#define IS_VALUE_(node, value) \
-    ((node->token.type == token::TYPE_NUM_LITERAL) && (node->token.val.num == value))
-
-#define cL ast::copy_subtree(astree, node->left, node)
-#define cR ast::copy_subtree(astree, node->right, node)
-
-static ast::ASTNode* eliminate_neutral_(ast::AST* astree, ast::ASTNode* node)
+static void eliminate_dead_code_(ast::ASTNode* node)
 {
-    utils_assert(astree);
-    utils_assert(node);
-
-    ast::ASTNode *left = NULL, *right = NULL, *new_node = node;
-    
-    if(node->token.type != token::TYPE_OPERATOR)
-        return node;
-
-    if(node->left)
-        left = eliminate_neutral_(astree, node->left);
-
-    if(node->right)
-        right = eliminate_neutral_(astree, node->right);
-
-    if(node->token.val.op_type == token::OPERATOR_TYPE_MUL)
-        new_node = eliminate_neutral_mul_(astree, node, left, right);
-
-    else if(node->token.val.op_type == token::OPERATOR_TYPE_ADD)
-        new_node = eliminate_neutral_add_(astree, node, left, right);
-
-    else if(node->token.val.op_type == token::OPERATOR_TYPE_POW)
-        new_node = eliminate_neutral_pow_(astree, node, left, right);
-
+    if(!node) return;
 
-    if(new_node != node) {
-        if(node->parent->left == node)
-            node->parent->left = new_node;
-
-        else if(node->parent->right == node)
-            node->parent->right = new_node;
-
-        treeChanged = true;
-
-        ast::mark_to_delete(astree, node);
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        eliminate_dead_code_(node->left);
+        eliminate_dead_code_(node->right);
+        return;
     }
 
-    return new_node;
-}
-
-static ast::ASTNode* eliminate_neutral_mul_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right)
-{
-    utils_assert(astree);
-    utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
-
-    utils_assert(node->token.type == token::TYPE_OPERATOR);
-    utils_assert(node->token.val.op_type == token::OPERATOR_TYPE_MUL);
-
-    ast::ASTNode* new_node = node;
-
-    if     (IS_VALUE_(left,  0)) new_node = const_(0.f);
-    else if(IS_VALUE_(left,  1)) new_node = cR;
-    else if(IS_VALUE_(right, 0)) new_node = const_(0.f);
-    else if(IS_VALUE_(right, 1)) new_node = cL;
-
-    return new_node;
+    if(node->token.type == token::TYPE_IDENTIFIER)
+        prune_block_(node->right);
 }
 
-
-static ast::ASTNode* eliminate_neutral_add_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right)
+// returns true if control never falls out of chain,
+// everything after such statement is cut off
+static bool prune_block_(ast::ASTNode* chain)
 {
-    utils_assert(astree);
-    utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
-
-    utils_assert(node->token.type == token::TYPE_OPERATOR);
-    utils_assert(node->token.val.op_type == token::OPERATOR_TYPE_MUL);
+    for(ast::ASTNode* link = chain; link; link = link->right) {
+        if(!prune_statement_(link))
+            continue;
+
+        if(link->right) {
+            ast::free_subtree(link->right);
+            link->right = NULL;
+            treeChanged = true;
+        }
 
-    ast::ASTNode* new_node = node;
+        return true;
+    }
 
-    if     (IS_VALUE_(left, 0))  new_node = cR;
-    else if(IS_VALUE_(right, 0)) new_node = cL;
-    
-    return new_node;
+    return false;
 }
 
-static ast::ASTNode* eliminate_neutral_pow_(ast::AST* astree, ast::ASTNode* node, ast::ASTNode* left, ast::ASTNode* right)
+static bool prune_statement_(ast::ASTNode* link)
 {
-    utils_assert(astree);
-    utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
-
-    utils_assert(node->token.type == token::TYPE_OPERATOR);
-    utils_assert(node->token.val.op_type == token::OPERATOR_TYPE_MUL);
-
-    ast::ASTNode* new_node = node;
-
-    if      (IS_VALUE_(left,  0)) new_node = const_(0.f); // 0 ^ x = 0
-    else if (IS_VALUE_(left,  1)) new_node = const_(1.f); // 1 ^ x = 1
-    else if (IS_VALUE_(right, 0)) new_node = const_(1.f); // x ^ 0 = 1
-    else if (IS_VALUE_(right, 1)) new_node = cL;          // x ^ 1 = x
+    using namespace token;
+
+    for(;;) {
+        ast::ASTNode* stmt = link->left;
+
+        if(!stmt || stmt->token.type != TYPE_KEYWORD)
+            return false;
+
+        ast::ASTNode* cond = stmt->left;
+        bool is_const = cond && cond->token.type == TYPE_NUM_LITERAL;
+
+        switch(stmt->token.val.kw_type) {
+            case KEYWORD_TYPE_RETURN:
+                return true;
+
+            case KEYWORD_TYPE_IF: {
+                ast::ASTNode* body = stmt->right;
+                bool has_else = body && body->token.type == TYPE_KEYWORD
+                                && body->token.val.kw_type == KEYWORD_TYPE_ELSE;
+
+                if(!is_const) {
+                    if(!has_else) {
+                        prune_block_(body);
+                        return false;
+                    }
+
+                    bool then_returns = prune_block_(body->left);
+                    bool else_returns = prune_block_(body->right);
+                    return then_returns && else_returns;
+                }
+
+                ast::ASTNode* taken = NULL;
+                if(has_else && cond->token.val.num) {
+                    taken = body->left;
+                    body->left = NULL;
+                }
+                else if(has_else) {
+                    taken = body->right;
+                    body->right = NULL;
+                }
+                else if(cond->token.val.num) {
+                    taken = body;
+                    stmt->right = NULL;
+                }
+
+                splice_(link, taken);
+                break;
+            }
+
+            case KEYWORD_TYPE_WHILE:
+                if(!is_const) {
+                    prune_block_(stmt->right);
+                    return false;
+                }
+
+                // nothing breaks out of loop except return
+                if(cond->token.val.num) {
+                    prune_block_(stmt->right);
+                    return true;
+                }
+
+                splice_(link, NULL);
+                break;
+
+            case KEYWORD_TYPE_ELSE:
+            case KEYWORD_TYPE_DEFUN:
+            case KEYWORD_TYPE_IN:
+            case KEYWORD_TYPE_OUT:
+            case KEYWORD_TYPE_RAMSET:
+            default:
+                return false;
+        }
 
-    return new_node;
+        treeChanged = true;
+    }
 }
 
-#undef IS_VALUE_
-#undef cL
-#undef cR
-
-static ast::ASTNode* eliminate_dead_code_(ast::AST* astree, ast::ASTNode* node)
+// statement hanging off link is replaced with statements of body chain
+static void splice_(ast::ASTNode* link, ast::ASTNode* body)
 {
-    utils_assert(astree);
-    utils_assert(node);
+    ast::free_subtree(link->left);
+    link->left = NULL;
 
-    if(node->token.type == token::TYPE_SEPARATOR 
-       && node->token.val.sep_type == token::SEPARATOR_TYPE_SEMICOLON) {
-
-        if(node->left->token.type == token::TYPE_KEYWORD
-           && node->left->token.val.kw_type == token::KEYWORD_TYPE_RETURN) {
+    // empty statement takes place of the next one, if any
+    if(!body) {
+        body = link->right;
+        if(!body) return;
+    }
+    else {
+        ast::ASTNode* tail = body;
+        while(tail->right)
+            tail = tail->right;
 
-            if(node->right) ast::mark_to_delete(astree, node->right);
-            node->right = NULL;
-        }
+        tail->right = link->right;
+        if(link->right) link->right->parent = tail;
     }
 
-    if(node->left)  eliminate_dead_code_(astree, node->left);
-    if(node->right) eliminate_dead_code_(astree, node->right);
+    link->left  = body->left;
+    link->right = body->right;
+    if(link->left)  link->left->parent  = link;
+    if(link->right) link->right->parent = link;
 
-    return node;
+    body->left = body->right = NULL;
+    ast::free_subtree(body);
 }
 
 } // optimizer
@@ -0,0 +1,779 @@
+#include "rewrite.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "evaluate.h"
+#include "hashcons.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace rewrite {
+
+ATTR_UNUSED static const char* LOG_REWRITE = "REWRITE";
+
+struct Rule
+{
+    const char* name;
+    const char* pattern_str;
+    const char* template_str;
+
+    Pattern* pattern;
+    Pattern* templ;
+
+    size_t hits;
+};
+
+#define MAKE_RULE(name, pattern, templ) \
+    Rule { name, pattern, templ, NULL, NULL, 0 }
+
+static Rule rules_[] =
+{
+    MAKE_RULE("add-zero-l"    , "(ADD 0 ?x)"                 , "?x"                  ),
+    MAKE_RULE("add-zero-r"    , "(ADD ?x 0)"                 , "?x"                  ),
+    MAKE_RULE("add-reassoc"   , "(ADD (ADD ?x #a) #b)"       , "(ADD ?x {ADD #a #b})"),
+    MAKE_RULE("sub-zero"      , "(SUB ?x 0)"                 , "?x"                  ),
+    MAKE_RULE("sub-self"      , "(SUB !x !x)"                , "0"                   ),
+    MAKE_RULE("sub-reassoc"   , "(SUB (SUB ?x #a) #b)"       , "(SUB ?x {ADD #a #b})"),
+    MAKE_RULE("mul-zero-l"    , "(MUL 0 !x)"                 , "0"                   ),
+    MAKE_RULE("mul-zero-r"    , "(MUL !x 0)"                 , "0"                   ),
+    MAKE_RULE("mul-one-l"     , "(MUL 1 ?x)"                 , "?x"                  ),
+    MAKE_RULE("mul-one-r"     , "(MUL ?x 1)"                 , "?x"                  ),
+    MAKE_RULE("mul-reassoc"   , "(MUL (MUL ?x #a) #b)"       , "(MUL ?x {MUL #a #b})"),
+    MAKE_RULE("div-one"       , "(DIV ?x 1)"                 , "?x"                  ),
+    MAKE_RULE("pow-zero"      , "(POW !x 0)"                 , "1"                   ),
+    MAKE_RULE("pow-one"       , "(POW ?x 1)"                 , "?x"                  ),
+    MAKE_RULE("pow-base-one"  , "(POW 1 !x)"                 , "1"                   ),
+    MAKE_RULE("eq-self"       , "(EQ !x !x)"                 , "1"                   ),
+    MAKE_RULE("neq-self"      , "(NEQ !x !x)"                , "0"                   ),
+    MAKE_RULE("lt-self"       , "(LT !x !x)"                 , "0"                   ),
+    MAKE_RULE("gt-self"       , "(GT !x !x)"                 , "0"                   ),
+    MAKE_RULE("leq-self"      , "(LEQ !x !x)"                , "1"                   ),
+    MAKE_RULE("geq-self"      , "(GEQ !x !x)"                , "1"                   ),
+    MAKE_RULE("neq-zero-eq"   , "(NEQ (EQ ?x ?y) 0)"         , "(EQ ?x ?y)"          ),
+    MAKE_RULE("neq-zero-neq"  , "(NEQ (NEQ ?x ?y) 0)"        , "(NEQ ?x ?y)"         ),
+    MAKE_RULE("neq-zero-lt"   , "(NEQ (LT ?x ?y) 0)"         , "(LT ?x ?y)"          ),
+    MAKE_RULE("neq-zero-gt"   , "(NEQ (GT ?x ?y) 0)"         , "(GT ?x ?y)"          ),
+    MAKE_RULE("neq-zero-leq"  , "(NEQ (LEQ ?x ?y) 0)"        , "(LEQ ?x ?y)"         ),
+    MAKE_RULE("neq-zero-geq"  , "(NEQ (GEQ ?x ?y) 0)"        , "(GEQ ?x ?y)"         ),
+    MAKE_RULE("eq-zero-eq"    , "(EQ (EQ ?x ?y) 0)"          , "(NEQ ?x ?y)"         ),
+    MAKE_RULE("eq-zero-neq"   , "(EQ (NEQ ?x ?y) 0)"         , "(EQ ?x ?y)"          ),
+    MAKE_RULE("eq-zero-lt"    , "(EQ (LT ?x ?y) 0)"          , "(GEQ ?x ?y)"         ),
+    MAKE_RULE("eq-zero-gt"    , "(EQ (GT ?x ?y) 0)"          , "(LEQ ?x ?y)"         ),
+    MAKE_RULE("eq-zero-leq"   , "(EQ (LEQ ?x ?y) 0)"         , "(GT ?x ?y)"          ),
+    MAKE_RULE("eq-zero-geq"   , "(EQ (GEQ ?x ?y) 0)"         , "(LT ?x ?y)"          ),
+};
+
+#undef MAKE_RULE
+
+static const size_t MAX_REWRITES_PER_NODE = 32;
+
+static size_t relinked_ = 0;
+static size_t copied_   = 0;
+
+/* ------------------------- decision tree ------------------------- */
+
+// subject positions tested by decision tree: root, its children and grandchildren
+enum Position
+{
+    POSITION_ROOT = 0,
+    POSITION_L    = 1,
+    POSITION_R    = 2,
+    POSITION_LL   = 3,
+    POSITION_LR   = 4,
+    POSITION_RL   = 5,
+    POSITION_RR   = 6,
+    POSITION_CNT  = 7,
+    POSITION_LEAF = 8,
+};
+
+enum KeyKind
+{
+    KEY_KIND_NIL,
+    KEY_KIND_NUM,
+    KEY_KIND_OPERATOR,
+    KEY_KIND_OTHER,
+    KEY_KIND_CNT,
+};
+
+struct Key
+{
+    KeyKind kind;
+    int     val;
+};
+
+struct DecisionNode;
+
+struct DecisionEdge
+{
+    Key           key;
+    DecisionNode* next;
+};
+
+struct DecisionNode
+{
+    int position;
+
+    Vector        edges;
+    DecisionNode* defaults[KEY_KIND_CNT];
+
+    Vector rules; // leaf only, indices into rules_ in priority order
+};
+
+enum PatternClass
+{
+    PATTERN_CLASS_WILDCARD,
+    PATTERN_CLASS_NUM_ANY,
+    PATTERN_CLASS_EXACT,
+};
+
+static DecisionNode* tree_root_ = NULL;
+
+static Vector tree_nodes_ = {};
+
+static Vector patterns_ = {};
+
+static Pattern* parse_pattern_(const char** str, Vector* pool);
+
+static Pattern* new_pattern_(PatternType type, Vector* pool);
+
+static DecisionNode* compile_(Vector* rule_ids, int position);
+
+static DecisionNode* new_decision_node_(int position);
+
+static Rule* find_rule_(ast::ASTNode* node, ast::ASTNode** captures);
+
+static bool match_(Pattern* pattern, ast::ASTNode* node, ast::ASTNode** captures);
+
+static bool bind_(int capture, ast::ASTNode* node, ast::ASTNode** captures);
+
+static ast::ASTNode* instantiate_(ast::AST* astree, Pattern* templ, ast::ASTNode** captures, bool* moved);
+
+static void detach_(ast::ASTNode* node);
+
+static int fold_value_(Pattern* templ, ast::ASTNode** captures);
+
+void ctor()
+{
+    vector_ctor(&patterns_, PATTERN_POOL_CAP, sizeof(Pattern*));
+
+    const size_t tree_nodes_cap = 64;
+    vector_ctor(&tree_nodes_, tree_nodes_cap, sizeof(DecisionNode*));
+
+    Vector rule_ids = VECTOR_INITLIST;
+    vector_ctor(&rule_ids, SIZEOF(rules_), sizeof(size_t));
+
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        const char* pattern_str  = rules_[i].pattern_str;
+        const char* template_str = rules_[i].template_str;
+
+        rules_[i].pattern = parse_pattern(pattern_str,  &patterns_);
+        rules_[i].templ   = parse_pattern(template_str, &patterns_);
+        rules_[i].hits    = 0;
+
+        utils_assert(rules_[i].pattern);
+        utils_assert(rules_[i].templ);
+        utils_assert(rules_[i].pattern->type == PATTERN_TYPE_OPERATOR);
+
+        vector_push(&rule_ids, &i);
+    }
+
+    tree_root_ = compile_(&rule_ids, POSITION_ROOT);
+
+    vector_dtor(&rule_ids);
+}
+
+void dtor()
+{
+    for(size_t i = 0; i < tree_nodes_.size; ++i) {
+        DecisionNode* node = *(DecisionNode**)vector_at(&tree_nodes_, i);
+        vector_dtor(&node->edges);
+        vector_dtor(&node->rules);
+        free(node);
+    }
+
+    free_patterns(&patterns_);
+
+    vector_dtor(&tree_nodes_);
+
+    tree_root_ = NULL;
+}
+
+ast::ASTNode* apply(ast::AST* astree, ast::ASTNode* node, bool* changed)
+{
+    utils_assert(astree);
+    utils_assert(node);
+    utils_assert(changed);
+    utils_assert(tree_root_);
+
+    if(node->left)  apply(astree, node->left, changed);
+    if(node->right) apply(astree, node->right, changed);
+
+    ast::ASTNode* captures[CAPTURE_CNT] = {};
+    bool          moved[CAPTURE_CNT]    = {};
+
+    for(size_t step = 0; step < MAX_REWRITES_PER_NODE; ++step) {
+        if(node->token.type != token::TYPE_OPERATOR)
+            break;
+
+        Rule* rule = find_rule_(node, captures);
+        if(!rule)
+            break;
+
+        UTILS_LOGD(LOG_REWRITE, "rule %s at %p", rule->name, node);
+
+        memset(moved, 0, sizeof(moved));
+        ast::ASTNode* new_node = instantiate_(astree, rule->templ, captures, moved);
+
+        // captured subtrees are relinked, only matched skeleton is left
+        ast::replace_node(node, new_node);
+        ast::free_subtree(node);
+
+        rule->hits++;
+        *changed = true;
+
+        node = new_node;
+    }
+
+    return node;
+}
+
+void log_stats()
+{
+    for(size_t i = 0; i < SIZEOF(rules_); ++i) {
+        if(rules_[i].hits)
+            UTILS_LOGD(LOG_REWRITE, "%-14s %lu hits", rules_[i].name, rules_[i].hits);
+    }
+
+    UTILS_LOGD(LOG_REWRITE, "%lu subtrees relinked, %lu copied", relinked_, copied_);
+}
+
+/* ----------------------------- parser ----------------------------- */
+
+Pattern* parse_pattern(const char* str, Vector* pool)
+{
+    utils_assert(str);
+    utils_assert(pool);
+
+    return parse_pattern_(&str, pool);
+}
+
+void free_patterns(Vector* pool)
+{
+    utils_assert(pool);
+
+    for(size_t i = 0; i < pool->size; ++i)
+        free(*(Pattern**)vector_at(pool, i));
+
+    vector_dtor(pool);
+}
+
+static void skip_spaces_(const char** str)
+{
+    while(**str == ' ') (*str)++;
+}
+
+static Pattern* parse_pattern_(const char** str, Vector* pool)
+{
+    utils_assert(str);
+
+    skip_spaces_(str);
+
+    char ch = **str;
+
+    if(ch == '(' || ch == '{') {
+        (*str)++;
+
+        const char* name = *str;
+        while(**str && **str != ' ' && **str != ')' && **str != '}') (*str)++;
+        ssize_t name_len = *str - name;
+
+        Pattern* pattern = new_pattern_(ch == '(' ? PATTERN_TYPE_OPERATOR : PATTERN_TYPE_FOLD, pool);
+
+        bool op_found = false;
+        for(size_t i = 0; i < SIZEOF(token::TokenArr); ++i) {
+            if(token::TokenArr[i].type == token::TYPE_OPERATOR
+               && token::TokenArr[i].str_internal_len == name_len
+               && strncmp(token::TokenArr[i].str_internal, name, (size_t) name_len) == 0) {
+
+                pattern->op_type = token::TokenArr[i].val.op_type;
+                op_found = true;
+                break;
+            }
+        }
+
+        if(!op_found) {
+            UTILS_LOGE(LOG_REWRITE, "unknown operator %.*s", (int) name_len, name);
+            return NULL;
+        }
+
+        char closing = ch == '(' ? ')' : '}';
+
+        skip_spaces_(str);
+        pattern->left  = **str == closing ? new_pattern_(PATTERN_TYPE_NIL, pool) : parse_pattern_(str, pool);
+
+        skip_spaces_(str);
+        pattern->right = **str == closing ? new_pattern_(PATTERN_TYPE_NIL, pool) : parse_pattern_(str, pool);
+
+        skip_spaces_(str);
+        if(!pattern->left || !pattern->right || **str != closing) {
+            UTILS_LOGE(LOG_REWRITE, "expected <%c> in rule at \"%s\"", closing, *str);
+            return NULL;
+        }
+
+        (*str)++;
+
+        return pattern;
+    }
+
+    if(ch == '?' || ch == '!' || ch == '#') {
+        PatternType type = ch == '?' ? PATTERN_TYPE_ANY
+                         : ch == '!' ? PATTERN_TYPE_PURE
+                         :             PATTERN_TYPE_CONST;
+
+        char capture = (*str)[1];
+        if(capture < 'a' || capture > 'z') {
+            UTILS_LOGE(LOG_REWRITE, "bad capture name in rule at \"%s\"", *str);
+            return NULL;
+        }
+
+        *str += 2;
+
+        Pattern* pattern = new_pattern_(type, pool);
+        pattern->capture = capture - 'a';
+
+        if(strncmp(*str, ":nz", 3) == 0) {
+            pattern->predicate = PREDICATE_NONZERO;
+            *str += 3;
+        }
+
+        return pattern;
+    }
+
+    if(strncmp(*str, TOKEN_NIL_STR, SIZEOF(TOKEN_NIL_STR) - 1) == 0) {
+        *str += SIZEOF(TOKEN_NIL_STR) - 1;
+        return new_pattern_(PATTERN_TYPE_NIL, pool);
+    }
+
+    if(('0' <= ch && ch <= '9') || ch == '-') {
+        int sign = 1;
+        if(ch == '-') {
+            sign = -1;
+            (*str)++;
+        }
+
+        int val = 0;
+        while('0' <= **str && **str <= '9') {
+            val = val * 10 + (**str - '0');
+            (*str)++;
+        }
+
+        Pattern* pattern = new_pattern_(PATTERN_TYPE_NUM, pool);
+        pattern->num = sign * val;
+
+        return pattern;
+    }
+
+    UTILS_LOGE(LOG_REWRITE, "unexpected symbol <%c> in rule", ch);
+    return NULL;
+}
+
+static Pattern* new_pattern_(PatternType type, Vector* pool)
+{
+    Pattern* pattern = TYPED_CALLOC(1, Pattern);
+    utils_assert(pattern);
+
+    pattern->type = type;
+
+    vector_push(pool, &pattern);
+
+    return pattern;
+}
+
+/* ---------------------------- compiler ---------------------------- */
+
+static Pattern* pattern_at_(Pattern* pattern, int position)
+{
+    if(!pattern) return NULL;
+
+    switch(position) {
+        case POSITION_ROOT: return pattern;
+        case POSITION_L:    return pattern->type == PATTERN_TYPE_OPERATOR ? pattern->left  : NULL;
+        case POSITION_R:    return pattern->type == PATTERN_TYPE_OPERATOR ? pattern->right : NULL;
+        case POSITION_LL:   return pattern_at_(pattern_at_(pattern, POSITION_L), POSITION_L);
+        case POSITION_LR:   return pattern_at_(pattern_at_(pattern, POSITION_L), POSITION_R);
+        case POSITION_RL:   return pattern_at_(pattern_at_(pattern, POSITION_R), POSITION_L);
+        case POSITION_RR:   return pattern_at_(pattern_at_(pattern, POSITION_R), POSITION_R);
+        default:            return NULL;
+    }
+}
+
+static ast::ASTNode* node_at_(ast::ASTNode* node, int position)
+{
+    if(!node) return NULL;
+
+    switch(position) {
+        case POSITION_ROOT: return node;
+        case POSITION_L:    return node->left;
+        case POSITION_R:    return node->right;
+        case POSITION_LL:   return node_at_(node->left,  POSITION_L);
+        case POSITION_LR:   return node_at_(node->left,  POSITION_R);
+        case POSITION_RL:   return node_at_(node->right, POSITION_L);
+        case POSITION_RR:   return node_at_(node->right, POSITION_R);
+        default:            return NULL;
+    }
+}
+
+static PatternClass pattern_class_(Pattern* pattern, Key* key)
+{
+    if(!pattern)
+        return PATTERN_CLASS_WILDCARD;
+
+    switch(pattern->type) {
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+            return PATTERN_CLASS_WILDCARD;
+
+        case PATTERN_TYPE_CONST:
+            return PATTERN_CLASS_NUM_ANY;
+
+        case PATTERN_TYPE_NUM:
+            *key = { KEY_KIND_NUM, pattern->num };
+            return PATTERN_CLASS_EXACT;
+
+        case PATTERN_TYPE_NIL:
+            *key = { KEY_KIND_NIL, 0 };
+            return PATTERN_CLASS_EXACT;
+
+        case PATTERN_TYPE_OPERATOR:
+            *key = { KEY_KIND_OPERATOR, pattern->op_type };
+            return PATTERN_CLASS_EXACT;
+
+        case PATTERN_TYPE_FOLD:
+        default:
+            utils_assert(0 && "fold in pattern");
+            return PATTERN_CLASS_WILDCARD;
+    }
+}
+
+static Key node_key_(ast::ASTNode* node)
+{
+    if(!node)
+        return { KEY_KIND_NIL, 0 };
+
+    switch(node->token.type) {
+        case token::TYPE_NUM_LITERAL:
+            return { KEY_KIND_NUM, node->token.val.num };
+
+        case token::TYPE_OPERATOR:
+            return { KEY_KIND_OPERATOR, node->token.val.op_type };
+
+        case token::TYPE_KEYWORD:
+        case token::TYPE_SEPARATOR:
+        case token::TYPE_IDENTIFIER:
+        case token::TYPE_CALL:
+        case token::TYPE_TERMINATOR:
+        case token::TYPE_FAKE:
+        case token::TYPE_NONE:
+        default:
+            return { KEY_KIND_OTHER, 0 };
+    }
+}
+
+static bool key_equal_(Key a, Key b)
+{
+    return a.kind == b.kind && a.val == b.val;
+}
+
+static DecisionNode* compile_(Vector* rule_ids, int position)
+{
+    utils_assert(rule_ids);
+
+    // skip positions no rule cares about
+    for(; position < POSITION_CNT; ++position) {
+        bool tested = false;
+        for(size_t i = 0; i < rule_ids->size && !tested; ++i) {
+            Rule* rule = &rules_[*(size_t*)vector_at(rule_ids, i)];
+            Key key = {};
+            tested = pattern_class_(pattern_at_(rule->pattern, position), &key) != PATTERN_CLASS_WILDCARD;
+        }
+        if(tested) break;
+    }
+
+    if(position == POSITION_CNT) {
+        DecisionNode* leaf = new_decision_node_(POSITION_LEAF);
+        for(size_t i = 0; i < rule_ids->size; ++i)
+            vector_push(&leaf->rules, vector_at(rule_ids, i));
+        return leaf;
+    }
+
+    DecisionNode* node = new_decision_node_(position);
+
+    Vector subset = VECTOR_INITLIST;
+    vector_ctor(&subset, rule_ids->size, sizeof(size_t));
+
+    // one edge per distinct exact key, wildcards follow every edge
+    for(size_t i = 0; i < rule_ids->size; ++i) {
+        Rule* rule = &rules_[*(size_t*)vector_at(rule_ids, i)];
+
+        Key key = {};
+        if(pattern_class_(pattern_at_(rule->pattern, position), &key) != PATTERN_CLASS_EXACT)
+            continue;
+
+        bool seen = false;
+        for(size_t e = 0; e < node->edges.size && !seen; ++e)
+            seen = key_equal_(((DecisionEdge*)vector_at(&node->edges, e))->key, key);
+        if(seen) continue;
+
+        vector_free(&subset);
+        for(size_t j = 0; j < rule_ids->size; ++j) {
+            Rule* other = &rules_[*(size_t*)vector_at(rule_ids, j)];
+            Key other_key = {};
+
+            switch(pattern_class_(pattern_at_(other->pattern, position), &other_key)) {
+                case PATTERN_CLASS_WILDCARD:
+                    vector_push(&subset, vector_at(rule_ids, j));
+                    break;
+                case PATTERN_CLASS_NUM_ANY:
+                    if(key.kind == KEY_KIND_NUM)
+                        vector_push(&subset, vector_at(rule_ids, j));
+                    break;
+                case PATTERN_CLASS_EXACT:
+                    if(key_equal_(key, other_key))
+                        vector_push(&subset, vector_at(rule_ids, j));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        DecisionEdge edge = { key, compile_(&subset, position + 1) };
+        vector_push(&node->edges, &edge);
+    }
+
+    // fallbacks for keys without own edge
+    for(int kind = 0; kind < KEY_KIND_CNT; ++kind) {
+        vector_free(&subset);
+        for(size_t j = 0; j < rule_ids->size; ++j) {
+            Rule* other = &rules_[*(size_t*)vector_at(rule_ids, j)];
+            Key other_key = {};
+
+            PatternClass pclass = pattern_class_(pattern_at_(other->pattern, position), &other_key);
+
+            if(pclass == PATTERN_CLASS_WILDCARD
+               || (pclass == PATTERN_CLASS_NUM_ANY && kind == KEY_KIND_NUM))
+                vector_push(&subset, vector_at(rule_ids, j));
+        }
+
+        if(subset.size)
+            node->defaults[kind] = compile_(&subset, position + 1);
+    }
+
+    vector_dtor(&subset);
+
+    return node;
+}
+
+static DecisionNode* new_decision_node_(int position)
+{
+    DecisionNode* node = TYPED_CALLOC(1, DecisionNode);
+    utils_assert(node);
+
+    node->position = position;
+
+    const size_t edges_cap = 4;
+    vector_ctor(&node->edges, edges_cap, sizeof(DecisionEdge));
+
+    const size_t rules_cap = 4;
+    vector_ctor(&node->rules, rules_cap, sizeof(size_t));
+
+    vector_push(&tree_nodes_, &node);
+
+    return node;
+}
+
+/* ----------------------------- matcher ---------------------------- */
+
+static Rule* find_rule_(ast::ASTNode* node, ast::ASTNode** captures)
+{
+    utils_assert(node);
+
+    DecisionNode* dnode = tree_root_;
+
+    while(dnode && dnode->position != POSITION_LEAF) {
+        Key key = node_key_(node_at_(node, dnode->position));
+
+        DecisionNode* next = dnode->defaults[key.kind];
+        for(size_t e = 0; e < dnode->edges.size; ++e) {
+            DecisionEdge* edge = (DecisionEdge*)vector_at(&dnode->edges, e);
+            if(key_equal_(edge->key, key)) {
+                next = edge->next;
+                break;
+            }
+        }
+
+        dnode = next;
+    }
+
+    if(!dnode)
+        return NULL;
+
+    for(size_t i = 0; i < dnode->rules.size; ++i) {
+        Rule* rule = &rules_[*(size_t*)vector_at(&dnode->rules, i)];
+
+        memset(captures, 0, CAPTURE_CNT * sizeof(captures[0]));
+
+        if(match_(rule->pattern, node, captures))
+            return rule;
+    }
+
+    return NULL;
+}
+
+static bool match_(Pattern* pattern, ast::ASTNode* node, ast::ASTNode** captures)
+{
+    utils_assert(pattern);
+
+    switch(pattern->type) {
+        case PATTERN_TYPE_NIL:
+            return !node;
+
+        case PATTERN_TYPE_NUM:
+            return node
+                   && node->token.type == token::TYPE_NUM_LITERAL
+                   && node->token.val.num == pattern->num;
+
+        case PATTERN_TYPE_OPERATOR:
+            return node
+                   && node->token.type == token::TYPE_OPERATOR
+                   && node->token.val.op_type == pattern->op_type
+                   && match_(pattern->left,  node->left,  captures)
+                   && match_(pattern->right, node->right, captures);
+
+        case PATTERN_TYPE_ANY:
+            return node && bind_(pattern->capture, node, captures);
+
+        case PATTERN_TYPE_PURE:
+            return node
+                   && !ast::holds_call(node)
+                   && !ast::may_trap(node)
+                   && bind_(pattern->capture, node, captures);
+
+        case PATTERN_TYPE_CONST:
+            return node
+                   && node->token.type == token::TYPE_NUM_LITERAL
+                   && !(pattern->predicate == PREDICATE_NONZERO && node->token.val.num == 0)
+                   && bind_(pattern->capture, node, captures);
+
+        case PATTERN_TYPE_FOLD:
+        default:
+            return false;
+    }
+}
+
+static bool bind_(int capture, ast::ASTNode* node, ast::ASTNode** captures)
+{
+    if(captures[capture])
+        return hashcons::equal(captures[capture], node);
+
+    captures[capture] = node;
+    return true;
+}
+
+static ast::ASTNode* instantiate_(ast::AST* astree, Pattern* templ, ast::ASTNode** captures, bool* moved)
+{
+    utils_assert(templ);
+
+    token::Token tok = TOKEN_INITLIST;
+
+    switch(templ->type) {
+        case PATTERN_TYPE_NIL:
+            return NULL;
+
+        case PATTERN_TYPE_NUM:
+        case PATTERN_TYPE_FOLD:
+            tok.type    = token::TYPE_NUM_LITERAL;
+            tok.val.num = fold_value_(templ, captures);
+            return ast::new_node(&tok, NULL, NULL, NULL);
+
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+        case PATTERN_TYPE_CONST:
+            utils_assert(captures[templ->capture]);
+
+            // capture used twice in template needs a copy
+            if(moved[templ->capture]) {
+                copied_++;
+                return ast::copy_subtree(astree, captures[templ->capture], NULL);
+            }
+
+            moved[templ->capture] = true;
+            relinked_++;
+
+            detach_(captures[templ->capture]);
+            return captures[templ->capture];
+
+        case PATTERN_TYPE_OPERATOR:
+            tok.type        = token::TYPE_OPERATOR;
+            tok.val.op_type = templ->op_type;
+            return ast::new_node(
+                &tok,
+                instantiate_(astree, templ->left,  captures, moved),
+                instantiate_(astree, templ->right, captures, moved),
+                NULL);
+
+        default:
+            utils_assert(0 && "unknown template");
+            return NULL;
+    }
+}
+
+static int fold_value_(Pattern* templ, ast::ASTNode** captures)
+{
+    switch(templ->type) {
+        case PATTERN_TYPE_NUM:
+            return templ->num;
+
+        case PATTERN_TYPE_CONST:
+            utils_assert(captures[templ->capture]);
+            return captures[templ->capture]->token.val.num;
+
+        case PATTERN_TYPE_FOLD:
+            return evaluate_operator_type(
+                templ->op_type,
+                fold_value_(templ->left, captures),
+                fold_value_(templ->right, captures));
+
+        case PATTERN_TYPE_NIL:
+            return 0;
+
+        case PATTERN_TYPE_OPERATOR:
+        case PATTERN_TYPE_ANY:
+        case PATTERN_TYPE_PURE:
+        default:
+            utils_assert(0 && "non-constant in fold");
+            return 0;
+    }
+}
+
+static void detach_(ast::ASTNode* node)
+{
+    ast::ASTNode* parent = node->parent;
+
+    if(parent) {
+        if(parent->left == node)
+            parent->left = NULL;
+        else if(parent->right == node)
+            parent->right = NULL;
+    }
+
+    node->parent = NULL;
+}
+
+} // rewrite
+} // compiler
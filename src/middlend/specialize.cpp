@@ -0,0 +1,350 @@
+#include "specialize.h"
+
+#include "assertutils.h"
+#include "ast.h"
+#include "callgraph.h"
+#include "logutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace specialize {
+
+ATTR_UNUSED static const char* LOG_SPECIALIZE = "SPECIALIZE";
+
+const size_t MAX_CLONES    = 4; // per function
+const size_t GROWTH_FACTOR = 1; // of whole program size
+
+struct Clone
+{
+    ast::ASTNode* func;  // original
+    ast::ASTNode* clone;
+    Vector        consts; // Const, sorted by parameter index
+};
+
+struct Const
+{
+    size_t param;
+    int    val;
+};
+
+struct Context
+{
+    ast::AST* astree;
+
+    callgraph::CallGraph graph; // functions present before pass
+    Vector clones;    // Clone
+
+    size_t budget; // nodes clones may still add
+    size_t retargeted;
+};
+
+static void calls_(Context* ctx, ast::ASTNode* node, int env_id);
+
+static void retarget_(Context* ctx, ast::ASTNode* call, ast::ASTNode* func, int env_id);
+
+static Clone* find_clone_(Context* ctx, ast::ASTNode* func, Vector* consts);
+
+static Clone* new_clone_(Context* ctx, ast::ASTNode* func, Vector* consts);
+
+static void rebind_(ast::ASTNode* node, int old_env_id, Env* env, int env_id);
+
+static ast::ASTNode* join_arguments_(Vector* args);
+
+static size_t count_clones_(Context* ctx, ast::ASTNode* func);
+
+bool specialize_functions(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree     = astree,
+        .graph      = {},
+        .clones     = VECTOR_INITLIST,
+        .budget     = ast::count_nodes(astree->root) * GROWTH_FACTOR,
+        .retargeted = 0,
+    };
+
+    const size_t vec_cap = 8;
+    vector_ctor(&ctx.clones, vec_cap, sizeof(Clone));
+
+    callgraph::ctor(&ctx.graph, astree);
+
+    // clones are not scanned, they only repeat calls of their originals
+    for(size_t i = 0; i < ctx.graph.functions.size; ++i) {
+        callgraph::Function* func = callgraph::get_function(&ctx.graph, i);
+
+        if(func->reachable)
+            calls_(&ctx, func->node->right, func->node->token.scope_id);
+    }
+
+    UTILS_LOGD(LOG_SPECIALIZE, "%lu clones, %lu call sites retargeted",
+               ctx.clones.size, ctx.retargeted);
+
+    for(size_t i = 0; i < ctx.clones.size; ++i)
+        vector_dtor(&((Clone*)vector_at(&ctx.clones, i))->consts);
+
+    callgraph::dtor(&ctx.graph);
+    vector_dtor(&ctx.clones);
+
+    return ctx.retargeted > 0;
+}
+
+static void calls_(Context* ctx, ast::ASTNode* node, int env_id)
+{
+    if(!node) return;
+
+    calls_(ctx, node->left,  env_id);
+    calls_(ctx, node->right, env_id);
+
+    if(node->token.type != token::TYPE_CALL)
+        return;
+
+    callgraph::Function* func = callgraph::find_function(&ctx->graph, &node->left->token.val.str);
+    if(func && !callgraph::is_main(func->node))
+        retarget_(ctx, node, func->node, env_id);
+}
+
+static void retarget_(Context* ctx, ast::ASTNode* call, ast::ASTNode* func, int env_id)
+{
+    Vector args = VECTOR_INITLIST, params = VECTOR_INITLIST, consts = VECTOR_INITLIST, rest = VECTOR_INITLIST;
+    const size_t vec_cap = 4;
+    vector_ctor(&args,   vec_cap, sizeof(ast::ASTNode*));
+    vector_ctor(&params, vec_cap, sizeof(ast::ASTNode*));
+    vector_ctor(&consts, vec_cap, sizeof(Const));
+    vector_ctor(&rest,   vec_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(call->right, &args);
+    ast::collect_list(func->left,  &params);
+
+    if(args.size == params.size) {
+        for(size_t i = 0; i < args.size; ++i) {
+            ast::ASTNode* arg = *(ast::ASTNode**)vector_at(&args, i);
+
+            if(arg->token.type == token::TYPE_NUM_LITERAL) {
+                Const c = { .param = i, .val = arg->token.val.num };
+                vector_push(&consts, &c);
+            }
+            else
+                vector_push(&rest, &arg);
+        }
+    }
+
+    Clone* clone = NULL;
+    if(consts.size > 0) {
+        clone = find_clone_(ctx, func, &consts);
+
+        if(!clone)
+            clone = new_clone_(ctx, func, &consts);
+    }
+
+    if(clone) {
+        // literal arguments are dropped, others are moved to new list
+        for(size_t i = 0; i < rest.size; ++i) {
+            ast::ASTNode* arg = *(ast::ASTNode**)vector_at(&rest, i);
+            ast::replace_node(arg, ast::new_node(&arg->token, NULL, NULL, NULL));
+            arg->parent = NULL;
+        }
+
+        ast::free_subtree(call->right);
+        call->right = join_arguments_(&rest);
+        if(call->right) call->right->parent = call;
+
+        ast::ASTNode* name = call->left;
+        name->token.val.str        = clone->clone->token.val.str;
+        name->token.inner_scope_id = add_symbol_to_env(
+            ast::get_enviroment(ctx->astree, env_id), &name->token.val.str, SYMBOL_TYPE_VARIABLE);
+
+        ctx->retargeted++;
+    }
+
+    vector_dtor(&args);
+    vector_dtor(&params);
+    vector_dtor(&consts);
+    vector_dtor(&rest);
+}
+
+static Clone* find_clone_(Context* ctx, ast::ASTNode* func, Vector* consts)
+{
+    for(size_t i = 0; i < ctx->clones.size; ++i) {
+        Clone* clone = (Clone*)vector_at(&ctx->clones, i);
+
+        if(clone->func != func || clone->consts.size != consts->size)
+            continue;
+
+        bool same = true;
+        for(size_t j = 0; j < consts->size && same; ++j) {
+            Const* a = (Const*)vector_at(&clone->consts, j);
+            Const* b = (Const*)vector_at(consts, j);
+
+            same = a->param == b->param && a->val == b->val;
+        }
+
+        if(same)
+            return clone;
+    }
+
+    return NULL;
+}
+
+// f(a, b) called as f(x, 5) gets clone
+// f_sN(a) { b = 5; <body of f> }
+static Clone* new_clone_(Context* ctx, ast::ASTNode* func, Vector* consts)
+{
+    using namespace token;
+
+    ast::AST* astree = ctx->astree;
+
+    size_t size = ast::count_nodes(func);
+    if(count_clones_(ctx, func) >= MAX_CLONES || size > ctx->budget)
+        return NULL;
+
+    ctx->budget -= size;
+
+    // '_' is not allowed in identifiers by lexer
+    utils_str_t clone_name = ast::new_name(astree, "%.*s_s%lu",
+                                           (int) func->token.val.str.len, func->token.val.str.str,
+                                           ctx->clones.size);
+
+    UTILS_LOGD(LOG_SPECIALIZE, "%.*s for %lu literal arguments",
+               (int) clone_name.len, clone_name.str, consts->size);
+
+    Env* env = create_env();
+    int env_id = ast::add_enviroment(astree, &env);
+
+    // keeps new function visible to find_enviroment
+    astree->current_env    = env;
+    astree->current_env_id = env_id;
+
+    Token func_tok = func->token;
+    func_tok.val.str        = clone_name;
+    func_tok.scope_id       = env_id;
+    func_tok.inner_scope_id = add_symbol_to_env(env, &clone_name, SYMBOL_TYPE_FUNCTION);
+
+    Vector params = VECTOR_INITLIST, kept = VECTOR_INITLIST;
+    const size_t vec_cap = 4;
+    vector_ctor(&params, vec_cap, sizeof(ast::ASTNode*));
+    vector_ctor(&kept,   vec_cap, sizeof(ast::ASTNode*));
+
+    ast::collect_list(func->left, &params);
+
+    // remaining parameters are bound first, so they take first slots
+    size_t next_const = 0;
+    for(size_t i = 0; i < params.size; ++i) {
+        if(next_const < consts->size && ((Const*)vector_at(consts, next_const))->param == i) {
+            next_const++;
+            continue;
+        }
+
+        ast::ASTNode* param = ast::copy_subtree(astree, *(ast::ASTNode**)vector_at(&params, i), NULL);
+        rebind_(param, func->token.scope_id, env, env_id);
+        vector_push(&kept, &param);
+    }
+
+    ast::ASTNode* body = ast::copy_subtree(astree, func->right, NULL);
+
+    Token assign_tok = TOKEN_INITLIST;
+    assign_tok.type        = TYPE_OPERATOR;
+    assign_tok.val.op_type = OPERATOR_TYPE_ASSIGN;
+
+    Token semicol_tok = TOKEN_INITLIST;
+    semicol_tok.type         = TYPE_SEPARATOR;
+    semicol_tok.val.sep_type = SEPARATOR_TYPE_SEMICOLON;
+
+    for(size_t i = consts->size; i-- > 0;) {
+        Const* c = (Const*)vector_at(consts, i);
+
+        Token num_tok = TOKEN_INITLIST;
+        num_tok.type    = TYPE_NUM_LITERAL;
+        num_tok.val.num = c->val;
+
+        ast::ASTNode* param  = ast::copy_subtree(astree, *(ast::ASTNode**)vector_at(&params, c->param), NULL);
+        ast::ASTNode* assign = ast::new_node(&assign_tok, param, ast::new_node(&num_tok, NULL, NULL, NULL), NULL);
+
+        body = ast::new_node(&semicol_tok, assign, body, NULL);
+    }
+
+    rebind_(body, func->token.scope_id, env, env_id);
+
+    ast::ASTNode* clone_node = ast::new_node(&func_tok, join_arguments_(&kept), body, NULL);
+
+    vector_dtor(&params);
+    vector_dtor(&kept);
+
+    Token program_tok = TOKEN_INITLIST;
+    program_tok.type         = TYPE_SEPARATOR;
+    program_tok.val.sep_type = SEPARATOR_TYPE_CURLY_OPEN;
+
+    ast::ASTNode* program = ast::new_node(&program_tok, NULL, NULL, NULL);
+    if(func->parent)
+        ast::replace_node(func, program);
+    else
+        astree->root = program;
+
+    program->left  = func;
+    program->right = clone_node;
+    func->parent       = program;
+    clone_node->parent = program;
+
+    Clone clone = {
+        .func   = func,
+        .clone  = clone_node,
+        .consts = VECTOR_INITLIST,
+    };
+
+    vector_ctor(&clone.consts, vec_cap, sizeof(Const));
+    for(size_t i = 0; i < consts->size; ++i)
+        vector_push(&clone.consts, vector_at(consts, i));
+
+    vector_push(&ctx->clones, &clone);
+
+    return (Clone*)vector_at(&ctx->clones, ctx->clones.size - 1);
+}
+
+static void rebind_(ast::ASTNode* node, int old_env_id, Env* env, int env_id)
+{
+    if(!node) return;
+
+    // in-order, so that parameters keep their order
+    rebind_(node->left, old_env_id, env, env_id);
+
+    if(node->token.type == token::TYPE_IDENTIFIER && node->token.scope_id == old_env_id) {
+        node->token.scope_id       = env_id;
+        node->token.inner_scope_id = add_symbol_to_env(env, &node->token.val.str, SYMBOL_TYPE_VARIABLE);
+    }
+
+    rebind_(node->right, old_env_id, env, env_id);
+}
+
+// builds left-nested COMMA list the parser produces
+static ast::ASTNode* join_arguments_(Vector* args)
+{
+    token::Token comma_tok = TOKEN_INITLIST;
+    comma_tok.type         = token::TYPE_SEPARATOR;
+    comma_tok.val.sep_type = token::SEPARATOR_TYPE_COMMA;
+
+    ast::ASTNode* list = NULL;
+
+    for(size_t i = 0; i < args->size; ++i) {
+        ast::ASTNode* arg = *(ast::ASTNode**)vector_at(args, i);
+        list = list ? ast::new_node(&comma_tok, list, arg, NULL) : arg;
+    }
+
+    return list;
+}
+
+static size_t count_clones_(Context* ctx, ast::ASTNode* func)
+{
+    size_t cnt = 0;
+
+    for(size_t i = 0; i < ctx->clones.size; ++i)
+        if(((Clone*)vector_at(&ctx->clones, i))->func == func)
+            cnt++;
+
+    return cnt;
+}
+
+} // specialize
+} // compiler
@@ -0,0 +1,457 @@
+#include "tailrec.h"
+
+#include <string.h>
+
+#include "assertutils.h"
+#include "ast.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "symbol.h"
+#include "token.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace compiler {
+namespace tailrec {
+
+ATTR_UNUSED static const char* LOG_TAILREC = "TAILREC";
+
+struct Context
+{
+    ast::AST*     astree;
+    ast::ASTNode* func;
+    int           env_id;
+    utils_str_t   name;
+
+    token::OperatorType op_type;
+    bool                op_found;
+    token::Token        call_tok;
+
+    Vector returns; // ASTNode*, RET statements of function
+
+    size_t converted;
+};
+
+static void function_(Context* ctx, ast::ASTNode* node);
+
+static bool analyze_(Context* ctx);
+
+static bool check_return_(Context* ctx, ast::ASTNode* expr, size_t* accepted);
+
+static void collect_returns_(Context* ctx, ast::ASTNode* node);
+
+static void convert_(Context* ctx);
+
+static void rewrite_return_(Context* ctx, ast::ASTNode* ret, token::Token* acc_tok);
+
+static void add_wrapper_(Context* ctx, ast::ASTNode* params, utils_str_t helper_name);
+
+static void bind_(ast::ASTNode* node, Env* env, int env_id);
+
+static ast::ASTNode* append_argument_(ast::ASTNode* args, ast::ASTNode* arg);
+
+static void move_symbol_(Context* ctx, int from, int to);
+
+static void renumber_(Context* ctx, ast::ASTNode* node, int from, int to);
+
+static void rename_calls_(Context* ctx, ast::ASTNode* node, utils_str_t name);
+
+static size_t count_self_calls_(Context* ctx, ast::ASTNode* node);
+
+static bool is_self_call_(Context* ctx, ast::ASTNode* node);
+
+static size_t count_params_(ast::ASTNode* params);
+
+void introduce_accumulators(ast::AST* astree)
+{
+    utils_assert(astree);
+
+    Context ctx = {
+        .astree    = astree,
+        .func      = NULL,
+        .env_id    = 0,
+        .name      = {},
+        .op_type   = token::OPERATOR_TYPE_ADD,
+        .op_found  = false,
+        .call_tok  = TOKEN_INITLIST,
+        .returns   = VECTOR_INITLIST,
+        .converted = 0,
+    };
+
+    const size_t returns_cap = 8;
+    vector_ctor(&ctx.returns, returns_cap, sizeof(ast::ASTNode*));
+
+    function_(&ctx, astree->root);
+
+    UTILS_LOGD(LOG_TAILREC, "%lu functions got accumulator", ctx.converted);
+
+    vector_dtor(&ctx.returns);
+}
+
+static void function_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_SEPARATOR) {
+        function_(ctx, node->left);
+        function_(ctx, node->right);
+        return;
+    }
+
+    if(node->token.type != token::TYPE_IDENTIFIER)
+        return;
+
+    ctx->func     = node;
+    ctx->env_id   = node->token.scope_id;
+    ctx->name     = node->token.val.str;
+    ctx->op_found = false;
+
+    vector_free(&ctx->returns);
+    collect_returns_(ctx, node->right);
+
+    if(analyze_(ctx))
+        convert_(ctx);
+}
+
+// every self call must be whole returned expression or operand of
+// single kind of associative operator at top of returned expression
+static bool analyze_(Context* ctx)
+{
+    size_t accepted = 0;
+
+    for(size_t i = 0; i < ctx->returns.size; ++i) {
+        ast::ASTNode* ret = *(ast::ASTNode**)vector_at(&ctx->returns, i);
+
+        if(!ret->left || !check_return_(ctx, ret->left, &accepted))
+            return false;
+    }
+
+    return ctx->op_found && accepted == count_self_calls_(ctx, ctx->func->right);
+}
+
+static bool check_return_(Context* ctx, ast::ASTNode* expr, size_t* accepted)
+{
+    using namespace token;
+
+    if(is_self_call_(ctx, expr)) {
+        if(count_self_calls_(ctx, expr->right) > 0)
+            return false;
+
+        (*accepted)++;
+        return true;
+    }
+
+    if(expr->token.type != TYPE_OPERATOR
+       || (expr->token.val.op_type != OPERATOR_TYPE_ADD && expr->token.val.op_type != OPERATOR_TYPE_MUL))
+        return count_self_calls_(ctx, expr) == 0;
+
+    ast::ASTNode* call  = NULL;
+    ast::ASTNode* other = NULL;
+
+    if(is_self_call_(ctx, expr->left)) {
+        call  = expr->left;
+        other = expr->right;
+    }
+    else if(is_self_call_(ctx, expr->right)) {
+        call  = expr->right;
+        other = expr->left;
+    }
+    else
+        return count_self_calls_(ctx, expr) == 0;
+
+    // other operand is moved before the call, so it must have no effects,
+    // and right one must not trap ahead of recursion it used to follow
+    if(!other || ast::holds_call(other) || count_self_calls_(ctx, call->right) > 0)
+        return false;
+
+    if(other == expr->right && ast::may_trap(other))
+        return false;
+
+    if(ctx->op_found && ctx->op_type != expr->token.val.op_type)
+        return false;
+
+    ctx->op_type  = expr->token.val.op_type;
+    ctx->op_found = true;
+    ctx->call_tok = call->token;
+
+    (*accepted)++;
+    return true;
+}
+
+static void collect_returns_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_KEYWORD && node->token.val.kw_type == token::KEYWORD_TYPE_RETURN) {
+        vector_push(&ctx->returns, &node);
+        return;
+    }
+
+    collect_returns_(ctx, node->left);
+    collect_returns_(ctx, node->right);
+}
+
+// f(p) { ... return f(q) * e; ... return b; } becomes
+// f_acc(p, acc) { ... return f_acc(q, acc * e); ... return acc * b; }
+// f(p) { return f_acc(p, 1); }
+static void convert_(Context* ctx)
+{
+    ast::AST* astree = ctx->astree;
+    Env*      env    = ast::get_enviroment(astree, ctx->env_id);
+
+    // '_' is not allowed in identifiers by lexer
+    utils_str_t helper_name = ast::new_name(astree, "%.*s_acc", (int) ctx->name.len, ctx->name.str);
+
+    UTILS_LOGD(LOG_TAILREC, "%.*s uses accumulator", (int) ctx->name.len, ctx->name.str);
+
+    ast::ASTNode* params = ctx->func->left;
+    size_t param_cnt = count_params_(params);
+
+    ast::ASTNode* wrapper_params = params ? ast::copy_subtree(astree, params, NULL) : NULL;
+
+    // accumulator is one more parameter, so it takes slot right after them
+    token::Token acc_tok = ast::new_temporary(astree, ctx->env_id);
+    move_symbol_(ctx, acc_tok.inner_scope_id, (int) param_cnt + 1);
+    acc_tok.inner_scope_id = (int) param_cnt + 1;
+
+    ctx->func->left = append_argument_(params, ast::new_node(&acc_tok, NULL, NULL, NULL));
+    ctx->func->left->parent = ctx->func;
+
+    int callee_id = find_symbol(env, &ctx->name, SYMBOL_TYPE_VARIABLE);
+    if(callee_id >= 0)
+        symbol_at(env, callee_id)->str = helper_name;
+
+    symbol_at(env, ctx->func->token.inner_scope_id)->str = helper_name;
+
+    for(size_t i = 0; i < ctx->returns.size; ++i)
+        rewrite_return_(ctx, *(ast::ASTNode**)vector_at(&ctx->returns, i), &acc_tok);
+
+    rename_calls_(ctx, ctx->func->right, helper_name);
+
+    ctx->func->token.val.str = helper_name;
+
+    add_wrapper_(ctx, wrapper_params, helper_name);
+
+    ctx->converted++;
+}
+
+static void rewrite_return_(Context* ctx, ast::ASTNode* ret, token::Token* acc_tok)
+{
+    ast::ASTNode* expr = ret->left;
+
+    token::Token op_tok = TOKEN_INITLIST;
+    op_tok.type        = token::TYPE_OPERATOR;
+    op_tok.val.op_type = ctx->op_type;
+
+    ast::ASTNode* acc = ast::new_node(acc_tok, NULL, NULL, NULL);
+
+    if(is_self_call_(ctx, expr)) {
+        expr->right = append_argument_(expr->right, acc);
+        expr->right->parent = expr;
+        return;
+    }
+
+    if(count_self_calls_(ctx, expr) == 0) {
+        // base case, returned value is folded into accumulator
+        ast::ASTNode* result = ast::new_node(&op_tok, acc, NULL, NULL);
+        ast::replace_node(expr, result);
+
+        result->right = expr;
+        expr->parent  = result;
+        return;
+    }
+
+    bool call_left = is_self_call_(ctx, expr->left);
+
+    ast::ASTNode* call  = call_left ? expr->left  : expr->right;
+    ast::ASTNode* other = call_left ? expr->right : expr->left;
+
+    expr->left = expr->right = NULL;
+    ast::replace_node(expr, call);
+    ast::free_subtree(expr);
+
+    call->right = append_argument_(call->right, ast::new_node(&op_tok, acc, other, NULL));
+    call->right->parent = call;
+}
+
+static void add_wrapper_(Context* ctx, ast::ASTNode* params, utils_str_t helper_name)
+{
+    using namespace token;
+
+    ast::AST* astree = ctx->astree;
+
+    Env* env = create_env();
+    int env_id = ast::add_enviroment(astree, &env);
+
+    // keeps new function visible to find_enviroment
+    astree->current_env    = env;
+    astree->current_env_id = env_id;
+
+    Token func_tok = ctx->func->token;
+    func_tok.val.str        = ctx->name;
+    func_tok.scope_id       = env_id;
+    func_tok.inner_scope_id = add_symbol_to_env(env, &ctx->name, SYMBOL_TYPE_FUNCTION);
+
+    // parameters come first, so they keep their ids
+    bind_(params, env, env_id);
+
+    Token identity_tok = TOKEN_INITLIST;
+    identity_tok.type    = TYPE_NUM_LITERAL;
+    identity_tok.val.num = ctx->op_type == OPERATOR_TYPE_MUL ? 1 : 0;
+
+    ast::ASTNode* args = append_argument_(
+        params ? ast::copy_subtree(astree, params, NULL) : NULL,
+        ast::new_node(&identity_tok, NULL, NULL, NULL));
+
+    Token callee_tok = TOKEN_INITLIST;
+    callee_tok.type           = TYPE_IDENTIFIER;
+    callee_tok.val.str        = helper_name;
+    callee_tok.scope_id       = env_id;
+    callee_tok.inner_scope_id = add_symbol_to_env(env, &helper_name, SYMBOL_TYPE_VARIABLE);
+
+    Token ret_tok = TOKEN_INITLIST;
+    ret_tok.type        = TYPE_KEYWORD;
+    ret_tok.val.kw_type = KEYWORD_TYPE_RETURN;
+
+    Token semicol_tok = TOKEN_INITLIST;
+    semicol_tok.type         = TYPE_SEPARATOR;
+    semicol_tok.val.sep_type = SEPARATOR_TYPE_SEMICOLON;
+
+    ast::ASTNode* call = ast::new_node(&ctx->call_tok, ast::new_node(&callee_tok, NULL, NULL, NULL), args, NULL);
+    ast::ASTNode* body = ast::new_node(&semicol_tok, ast::new_node(&ret_tok, call, NULL, NULL), NULL, NULL);
+
+    ast::ASTNode* wrapper = ast::new_node(&func_tok, params, body, NULL);
+
+    Token program_tok = TOKEN_INITLIST;
+    program_tok.type         = TYPE_SEPARATOR;
+    program_tok.val.sep_type = SEPARATOR_TYPE_CURLY_OPEN;
+
+    ast::ASTNode* func   = ctx->func;
+    ast::ASTNode* parent = func->parent;
+
+    ast::ASTNode* program = ast::new_node(&program_tok, NULL, NULL, NULL);
+    if(parent)
+        ast::replace_node(func, program);
+    else
+        astree->root = program;
+
+    program->left  = wrapper;
+    program->right = func;
+    wrapper->parent = program;
+    func->parent    = program;
+}
+
+static void bind_(ast::ASTNode* node, Env* env, int env_id)
+{
+    if(!node) return;
+
+    bind_(node->left, env, env_id);
+
+    if(node->token.type == token::TYPE_IDENTIFIER) {
+        node->token.scope_id       = env_id;
+        node->token.inner_scope_id = add_symbol_to_env(env, &node->token.val.str, SYMBOL_TYPE_VARIABLE);
+    }
+
+    bind_(node->right, env, env_id);
+}
+
+static ast::ASTNode* append_argument_(ast::ASTNode* args, ast::ASTNode* arg)
+{
+    if(!args)
+        return arg;
+
+    token::Token comma_tok = TOKEN_INITLIST;
+    comma_tok.type         = token::TYPE_SEPARATOR;
+    comma_tok.val.sep_type = token::SEPARATOR_TYPE_COMMA;
+
+    ast::ASTNode* comma = ast::new_node(&comma_tok, args, arg, NULL);
+    args->parent = comma;
+    arg->parent  = comma;
+
+    return comma;
+}
+
+static void move_symbol_(Context* ctx, int from, int to)
+{
+    utils_assert(from >= to);
+
+    Env* env = ast::get_enviroment(ctx->astree, ctx->env_id);
+    size_t size = env->symbol_table.size;
+
+    Symbol* symbols = TYPED_CALLOC(size + 1, Symbol);
+    utils_assert(symbols);
+
+    for(size_t i = 0; i < size; ++i)
+        symbols[i] = *symbol_at(env, (int) i);
+
+    Symbol moved = symbols[from];
+    memmove(&symbols[to + 1], &symbols[to], (size_t)(from - to) * sizeof(Symbol));
+    symbols[to] = moved;
+
+    vector_free(&env->symbol_table);
+    for(size_t i = 0; i < size; ++i)
+        vector_push(&env->symbol_table, &symbols[i]);
+
+    NFREE(symbols);
+
+    renumber_(ctx, ctx->func, from, to);
+}
+
+static void renumber_(Context* ctx, ast::ASTNode* node, int from, int to)
+{
+    if(!node) return;
+
+    if(node->token.type == token::TYPE_IDENTIFIER && node->token.scope_id == ctx->env_id) {
+        int id = node->token.inner_scope_id;
+
+        if(id == from)
+            node->token.inner_scope_id = to;
+        else if(id >= to && id < from)
+            node->token.inner_scope_id = id + 1;
+    }
+
+    renumber_(ctx, node->left,  from, to);
+    renumber_(ctx, node->right, from, to);
+}
+
+static void rename_calls_(Context* ctx, ast::ASTNode* node, utils_str_t name)
+{
+    if(!node) return;
+
+    if(is_self_call_(ctx, node))
+        node->left->token.val.str = name;
+
+    rename_calls_(ctx, node->left,  name);
+    rename_calls_(ctx, node->right, name);
+}
+
+static size_t count_self_calls_(Context* ctx, ast::ASTNode* node)
+{
+    if(!node) return 0;
+
+    return (is_self_call_(ctx, node) ? 1 : 0)
+           + count_self_calls_(ctx, node->left)
+           + count_self_calls_(ctx, node->right);
+}
+
+static bool is_self_call_(Context* ctx, ast::ASTNode* node)
+{
+    return node
+           && node->token.type == token::TYPE_CALL
+           && node->left
+           && node->left->token.val.str.len == ctx->name.len
+           && strncmp(node->left->token.val.str.str, ctx->name.str, ctx->name.len) == 0;
+}
+
+static size_t count_params_(ast::ASTNode* params)
+{
+    if(!params) return 0;
+
+    if(params->token.type == token::TYPE_SEPARATOR)
+        return count_params_(params->left) + count_params_(params->right);
+
+    return 1;
+}
+
+} // tailrec
+} // compiler
@@ -0,0 +1,545 @@
+#include "regvm.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "regcode.h"
+#include "utils.h"
+
+namespace compiler {
+namespace regvm {
+
+ATTR_UNUSED static const char* LOG_REGVM = "REGVM";
+
+const size_t NO_INDEX = (size_t) -1;
+
+const size_t OPERAND_SIZE = 5;
+const size_t TARGET_SIZE  = 4;
+
+// frames start right after VRAM
+const size_t FRAMES_BASE = vm::VRAM_BASE + vm::VRAM_WIDTH * vm::VRAM_HEIGHT;
+
+// layout of operands following opcode byte
+enum Format
+{
+    FORMAT_NONE,          //
+    FORMAT_DST,           // dst
+    FORMAT_A,             // a
+    FORMAT_DST_A,         // dst, a
+    FORMAT_DST_A_B,       // dst, a, b
+    FORMAT_A_B,           // a, b
+    FORMAT_TARGET,        // u32
+    FORMAT_A_B_TARGET,    // a, b, u32
+    FORMAT_CALL,          // dst, u32, u32
+};
+
+static bool format_(uint8_t opcode, Format* format);
+
+static size_t format_size_(Format format);
+
+static bool get_operand_(Machine* machine, const uint8_t* pos, bool is_dst, Operand* operand);
+
+static uint32_t get_u32_(const uint8_t* pos);
+
+vm::VmErr ctor(Machine* machine, FILE* in, FILE* out)
+{
+    utils_assert(machine);
+    utils_assert(in);
+    utils_assert(out);
+
+    machine->memory = TYPED_CALLOC(vm::MEMORY_SIZE, int32_t);
+    machine->calls  = TYPED_CALLOC(vm::CALL_DEPTH,  Frame);
+
+    if(!machine->memory || !machine->calls) {
+        dtor(machine);
+        return vm::VM_ERR_ALLOC_FAIL;
+    }
+
+    machine->ret      = 0;
+    machine->executed = 0;
+    machine->in       = in;
+    machine->out      = out;
+
+    return vm::VM_ERR_NONE;
+}
+
+void dtor(Machine* machine)
+{
+    utils_assert(machine);
+
+    NFREE(machine->code);
+    NFREE(machine->consts);
+    NFREE(machine->memory);
+    NFREE(machine->calls);
+
+    machine->code_size   = 0;
+    machine->consts_size = 0;
+}
+
+vm::VmErr load(Machine* machine, const uint8_t* image, size_t size)
+{
+    utils_assert(machine);
+    utils_assert(image);
+
+    if(size < regcode::HEADER_SIZE
+       || memcmp(image, regcode::MAGIC, sizeof(regcode::MAGIC) - 1) != 0
+       || get_u32_(image + 4) != regcode::VERSION
+       || get_u32_(image + 8) != size - regcode::HEADER_SIZE)
+        return vm::VM_ERR_BAD_IMAGE;
+
+    const uint8_t* bytes = image + regcode::HEADER_SIZE;
+    size_t bytes_cnt = size - regcode::HEADER_SIZE;
+
+    // first pass maps byte offsets of instructions to their indices,
+    // every operand may be immediate, so their count bounds constant pool
+    size_t* index_of = TYPED_CALLOC(bytes_cnt + 1, size_t);
+    if(!index_of)
+        return vm::VM_ERR_ALLOC_FAIL;
+
+    for(size_t i = 0; i <= bytes_cnt; ++i)
+        index_of[i] = NO_INDEX;
+
+    vm::VmErr err = vm::VM_ERR_NONE;
+    size_t instr_cnt = 0;
+
+    for(size_t pos = 0; pos < bytes_cnt; ) {
+        Format format = FORMAT_NONE;
+        if(!format_(bytes[pos], &format) || pos + 1 + format_size_(format) > bytes_cnt) {
+            err = vm::VM_ERR_BAD_IMAGE;
+            break;
+        }
+
+        index_of[pos] = instr_cnt++;
+        pos += 1 + format_size_(format);
+    }
+
+    // label at the very end refers to implicit HLT after the last instruction
+    if(err == vm::VM_ERR_NONE)
+        index_of[bytes_cnt] = instr_cnt;
+
+    Instr*   code   = NULL;
+    int32_t* consts = NULL;
+    if(err == vm::VM_ERR_NONE) {
+        code   = TYPED_CALLOC(instr_cnt + 1, Instr);
+        consts = TYPED_CALLOC(3 * instr_cnt + 1, int32_t);
+        if(!code || !consts)
+            err = vm::VM_ERR_ALLOC_FAIL;
+    }
+
+    NFREE(machine->consts);
+    machine->consts      = consts;
+    machine->consts_size = 0;
+    machine->frame_size  = 0;
+
+    // second pass decodes, branch targets become indices
+    for(size_t pos = 0, ind = 0; err == vm::VM_ERR_NONE && pos < bytes_cnt; ++ind) {
+        Instr* instr = &code[ind];
+
+        uint8_t opcode = bytes[pos++];
+        instr->opcode = opcode;
+
+        Format format = FORMAT_NONE;
+        format_(opcode, &format);
+
+        const uint8_t* args = bytes + pos;
+
+        bool     ok = true;
+        bool     has_target = false;
+        uint32_t target = 0;
+
+        switch(format) {
+            case FORMAT_DST:
+                ok = get_operand_(machine, args, true, &instr->dst);
+                break;
+
+            case FORMAT_A:
+                ok = get_operand_(machine, args, false, &instr->a);
+                break;
+
+            case FORMAT_DST_A:
+                ok = get_operand_(machine, args,                true,  &instr->dst)
+                     && get_operand_(machine, args + OPERAND_SIZE, false, &instr->a);
+                break;
+
+            case FORMAT_DST_A_B:
+                ok = get_operand_(machine, args,                    true,  &instr->dst)
+                     && get_operand_(machine, args + OPERAND_SIZE,     false, &instr->a)
+                     && get_operand_(machine, args + 2 * OPERAND_SIZE, false, &instr->b);
+                break;
+
+            case FORMAT_A_B:
+                ok = get_operand_(machine, args,                false, &instr->a)
+                     && get_operand_(machine, args + OPERAND_SIZE, false, &instr->b);
+                break;
+
+            case FORMAT_TARGET:
+                has_target = true;
+                target = get_u32_(args);
+                break;
+
+            case FORMAT_A_B_TARGET:
+                ok = get_operand_(machine, args,                false, &instr->a)
+                     && get_operand_(machine, args + OPERAND_SIZE, false, &instr->b);
+                has_target = true;
+                target = get_u32_(args + 2 * OPERAND_SIZE);
+                break;
+
+            case FORMAT_CALL:
+                ok = get_operand_(machine, args, true, &instr->dst);
+                has_target = true;
+                target = get_u32_(args + OPERAND_SIZE);
+                instr->frame = get_u32_(args + OPERAND_SIZE + TARGET_SIZE);
+                ok = ok && instr->frame < vm::MEMORY_SIZE;
+                break;
+
+            case FORMAT_NONE:
+            default:
+                break;
+        }
+
+        pos += format_size_(format);
+
+        if(has_target) {
+            if(target > bytes_cnt || index_of[target] == NO_INDEX)
+                ok = false;
+            else
+                instr->target = (uint32_t) index_of[target];
+        }
+
+        if(!ok)
+            err = vm::VM_ERR_BAD_IMAGE;
+    }
+
+    if(err == vm::VM_ERR_NONE && FRAMES_BASE + machine->frame_size > vm::MEMORY_SIZE)
+        err = vm::VM_ERR_BAD_IMAGE;
+
+    NFREE(index_of);
+
+    if(err != vm::VM_ERR_NONE) {
+        NFREE(code);
+        NFREE(machine->consts);
+        machine->consts_size = 0;
+        return err;
+    }
+
+    NFREE(machine->code);
+    machine->code      = code;
+    machine->code_size = instr_cnt;
+
+    UTILS_LOGD(LOG_REGVM, "loaded %lu instructions and %lu constants from %lu bytes, frame of %lu slots",
+               instr_cnt, machine->consts_size, bytes_cnt, machine->frame_size);
+
+    return vm::VM_ERR_NONE;
+}
+
+vm::VmErr run(Machine* machine)
+{
+    utils_assert(machine);
+    utils_assert(machine->code);
+
+    Instr*   code   = machine->code;
+    int32_t* memory = machine->memory;
+
+    // fp is bases[BASE_FRAME]
+    int32_t* bases[] = { machine->consts, memory + FRAMES_BASE };
+
+    Frame*   call       = machine->calls;
+    Frame*   calls_end  = machine->calls + vm::CALL_DEPTH;
+    int32_t* frames_end = memory + vm::MEMORY_SIZE - machine->frame_size;
+
+    Instr*    ip  = code;
+    Instr*    cur = NULL;
+    size_t    executed = 0;
+    vm::VmErr err = vm::VM_ERR_NONE;
+
+    uint32_t a    = 0;
+    uint32_t b    = 0;
+    int64_t  addr = 0;
+    int      val  = 0;
+
+    // handler addresses are only known here, so they are bound on every run
+    for(size_t i = 0; i < machine->code_size; ++i) {
+        Instr* instr = &code[i];
+
+        switch(instr->opcode) {
+            case regcode::OPCODE_HLT:   instr->handler = &&op_hlt;   break;
+            case regcode::OPCODE_MOV:   instr->handler = &&op_mov;   break;
+            case regcode::OPCODE_ADD:   instr->handler = &&op_add;   break;
+            case regcode::OPCODE_SUB:   instr->handler = &&op_sub;   break;
+            case regcode::OPCODE_MUL:   instr->handler = &&op_mul;   break;
+            case regcode::OPCODE_DIV:   instr->handler = &&op_div;   break;
+            case regcode::OPCODE_POW:   instr->handler = &&op_pow;   break;
+            case regcode::OPCODE_SQR:   instr->handler = &&op_sqr;   break;
+            case regcode::OPCODE_IN:    instr->handler = &&op_in;    break;
+            case regcode::OPCODE_OUT:   instr->handler = &&op_out;   break;
+            case regcode::OPCODE_DRAW:  instr->handler = &&op_draw;  break;
+            case regcode::OPCODE_STORE: instr->handler = &&op_store; break;
+            case regcode::OPCODE_CALL:  instr->handler = &&op_call;  break;
+            case regcode::OPCODE_RET:   instr->handler = &&op_ret;   break;
+            case regcode::OPCODE_JMP:   instr->handler = &&op_jmp;   break;
+            case regcode::OPCODE_JE:    instr->handler = &&op_je;    break;
+            case regcode::OPCODE_JNE:   instr->handler = &&op_jne;   break;
+            case regcode::OPCODE_JA:    instr->handler = &&op_ja;    break;
+            case regcode::OPCODE_JB:    instr->handler = &&op_jb;    break;
+            case regcode::OPCODE_JAE:   instr->handler = &&op_jae;   break;
+            case regcode::OPCODE_JBE:   instr->handler = &&op_jbe;   break;
+            case regcode::OPCODE_LABEL:
+            case regcode::OPCODE_FUNC:
+            default:
+                utils_assert(0 && "opcode was not validated by load");
+                break;
+        }
+    }
+
+    // instruction after the last one is HLT
+    code[machine->code_size].handler = &&op_hlt;
+
+#define DISPATCH()                  \
+    do {                            \
+        cur = ip++;                 \
+        executed++;                 \
+        goto *cur->handler;         \
+    } while(0)
+
+#define FAIL(error)                 \
+    do {                            \
+        err = (error);              \
+        goto fail;                  \
+    } while(0)
+
+#define VAL(operand) bases[(operand).base][(operand).off]
+
+#define DST() bases[BASE_FRAME][cur->dst.off]
+
+// arithmetic wraps around, operands are taken as unsigned
+#define BINARY(expr)                                \
+    a = (uint32_t) VAL(cur->a);                     \
+    b = (uint32_t) VAL(cur->b);                     \
+    DST() = (int32_t) (expr);                       \
+    DISPATCH()
+
+#define BRANCH(cmp)                                 \
+    if(VAL(cur->a) cmp VAL(cur->b))                 \
+        ip = code + cur->target;                    \
+    DISPATCH()
+
+    DISPATCH();
+
+op_mov:
+    DST() = VAL(cur->a);
+    DISPATCH();
+
+op_add: BINARY(a + b);
+op_sub: BINARY(a - b);
+op_mul: BINARY(a * b);
+
+op_div:
+    b = (uint32_t) VAL(cur->b);
+    if(b == 0)
+        FAIL(vm::VM_ERR_DIV_BY_ZERO);
+    // INT_MIN / -1 wraps instead of trapping
+    if(b == (uint32_t) -1) {
+        DST() = (int32_t) (0u - (uint32_t) VAL(cur->a));
+        DISPATCH();
+    }
+    DST() = VAL(cur->a) / (int32_t) b;
+    DISPATCH();
+
+// same rounding as constant folding in middlend
+op_pow:
+    DST() = (int32_t) pown(VAL(cur->a), VAL(cur->b));
+    DISPATCH();
+
+op_sqr:
+    val = VAL(cur->a);
+    DST() = val > 0 ? (int32_t) sqrt(val) : 0;
+    DISPATCH();
+
+op_in:
+    if(fscanf(machine->in, "%d", &val) != 1)
+        FAIL(vm::VM_ERR_INPUT);
+    DST() = val;
+    DISPATCH();
+
+op_out:
+    fprintf(machine->out, "%d\n", VAL(cur->a));
+    DISPATCH();
+
+op_draw:
+    vm::draw(memory, machine->out);
+    DISPATCH();
+
+op_store:
+    addr = VAL(cur->a);
+    if((uint64_t) addr >= vm::VRAM_WIDTH * vm::VRAM_HEIGHT)
+        FAIL(vm::VM_ERR_BAD_ADDRESS);
+    memory[vm::VRAM_BASE + (size_t) addr] = VAL(cur->b);
+    DISPATCH();
+
+op_call:
+    if(call == calls_end || bases[BASE_FRAME] + cur->frame > frames_end)
+        FAIL(vm::VM_ERR_CALL_OVERFLOW);
+    call->ret = ip;
+    call->fp  = bases[BASE_FRAME];
+    call->dst = &DST();
+    call++;
+    bases[BASE_FRAME] += cur->frame;
+    ip = code + cur->target;
+    DISPATCH();
+
+op_ret:
+    if(call == machine->calls)
+        FAIL(vm::VM_ERR_STACK_UNDERFLOW);
+    machine->ret = VAL(cur->a);
+    call--;
+    bases[BASE_FRAME] = call->fp;
+    *call->dst = machine->ret;
+    ip = call->ret;
+    DISPATCH();
+
+op_jmp:
+    ip = code + cur->target;
+    DISPATCH();
+
+op_je:  BRANCH(==);
+op_jne: BRANCH(!=);
+op_ja:  BRANCH(>);
+op_jb:  BRANCH(<);
+op_jae: BRANCH(>=);
+op_jbe: BRANCH(<=);
+
+fail:
+    UTILS_LOGE(LOG_REGVM, "%s at instruction %ld", vm::strerr(err), cur - code);
+
+op_hlt:
+    machine->executed += executed;
+
+    return err;
+
+#undef DISPATCH
+#undef FAIL
+#undef VAL
+#undef DST
+#undef BINARY
+#undef BRANCH
+}
+
+static bool format_(uint8_t opcode, Format* format)
+{
+    switch(opcode) {
+        case regcode::OPCODE_HLT:
+        case regcode::OPCODE_DRAW:
+            *format = FORMAT_NONE;
+            return true;
+
+        case regcode::OPCODE_IN:
+            *format = FORMAT_DST;
+            return true;
+
+        case regcode::OPCODE_RET:
+        case regcode::OPCODE_OUT:
+            *format = FORMAT_A;
+            return true;
+
+        case regcode::OPCODE_MOV:
+        case regcode::OPCODE_SQR:
+            *format = FORMAT_DST_A;
+            return true;
+
+        case regcode::OPCODE_ADD:
+        case regcode::OPCODE_SUB:
+        case regcode::OPCODE_MUL:
+        case regcode::OPCODE_DIV:
+        case regcode::OPCODE_POW:
+            *format = FORMAT_DST_A_B;
+            return true;
+
+        case regcode::OPCODE_STORE:
+            *format = FORMAT_A_B;
+            return true;
+
+        case regcode::OPCODE_JMP:
+            *format = FORMAT_TARGET;
+            return true;
+
+        case regcode::OPCODE_JE:
+        case regcode::OPCODE_JNE:
+        case regcode::OPCODE_JA:
+        case regcode::OPCODE_JB:
+        case regcode::OPCODE_JAE:
+        case regcode::OPCODE_JBE:
+            *format = FORMAT_A_B_TARGET;
+            return true;
+
+        case regcode::OPCODE_CALL:
+            *format = FORMAT_CALL;
+            return true;
+
+        case regcode::OPCODE_LABEL:
+        case regcode::OPCODE_FUNC:
+        default:
+            return false;
+    }
+}
+
+static size_t format_size_(Format format)
+{
+    switch(format) {
+        case FORMAT_DST:          return OPERAND_SIZE;
+        case FORMAT_A:            return OPERAND_SIZE;
+        case FORMAT_DST_A:        return 2 * OPERAND_SIZE;
+        case FORMAT_DST_A_B:      return 3 * OPERAND_SIZE;
+        case FORMAT_A_B:          return 2 * OPERAND_SIZE;
+        case FORMAT_TARGET:       return TARGET_SIZE;
+        case FORMAT_A_B_TARGET:   return 2 * OPERAND_SIZE + TARGET_SIZE;
+        case FORMAT_CALL:         return OPERAND_SIZE + 2 * TARGET_SIZE;
+        case FORMAT_NONE:
+        default:                  return 0;
+    }
+}
+
+// immediate goes to constant pool, slot widens frame if needed
+static bool get_operand_(Machine* machine, const uint8_t* pos, bool is_dst, Operand* operand)
+{
+    int32_t val = (int32_t) get_u32_(pos + 1);
+
+    switch(pos[0]) {
+        case regcode::OPERAND_IMM:
+            if(is_dst)
+                return false;
+
+            machine->consts[machine->consts_size] = val;
+            operand->base = BASE_CONST;
+            operand->off  = (int32_t) machine->consts_size++;
+            return true;
+
+        case regcode::OPERAND_SLOT:
+            if(val < 0 || (size_t) val >= vm::MEMORY_SIZE)
+                return false;
+
+            if((size_t) val + 1 > machine->frame_size)
+                machine->frame_size = (size_t) val + 1;
+
+            operand->base = BASE_FRAME;
+            operand->off  = val;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static uint32_t get_u32_(const uint8_t* pos)
+{
+    return (uint32_t) pos[0]
+           | (uint32_t) pos[1] << 8
+           | (uint32_t) pos[2] << 16
+           | (uint32_t) pos[3] << 24;
+}
+
+} // regvm
+} // compiler
@@ -0,0 +1,622 @@
+#include "vm.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "bytecode.h"
+#include "instr.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+
+namespace compiler {
+namespace vm {
+
+ATTR_UNUSED static const char* LOG_VM = "VM";
+
+const size_t NO_INDEX = (size_t) -1;
+
+// layout of operands following opcode byte
+enum Format
+{
+    FORMAT_NONE,        //
+    FORMAT_IMM,         // i32
+    FORMAT_REG,         // u8
+    FORMAT_MEM,         // u8, i32
+    FORMAT_MEM2,        // u8, i32, u8, i32
+    FORMAT_TARGET,      // u32
+    FORMAT_IMM_TARGET,  // i32, u32
+};
+
+static bool format_(uint8_t opcode, Format* format);
+
+static size_t format_size_(Format format);
+
+static bool is_register_(uint8_t reg);
+
+static uint32_t get_u32_(const uint8_t* pos);
+
+VmErr ctor(Machine* machine, FILE* in, FILE* out)
+{
+    utils_assert(machine);
+    utils_assert(in);
+    utils_assert(out);
+
+    machine->memory = TYPED_CALLOC(MEMORY_SIZE, int32_t);
+    machine->stack  = TYPED_CALLOC(STACK_SIZE,  int32_t);
+    machine->calls  = TYPED_CALLOC(CALL_DEPTH,  Instr*);
+
+    if(!machine->memory || !machine->stack || !machine->calls) {
+        dtor(machine);
+        return VM_ERR_ALLOC_FAIL;
+    }
+
+    memset(machine->regs, 0, sizeof(machine->regs));
+    machine->regs[instr::REGISTER_SP] = (int32_t) (VRAM_BASE + VRAM_WIDTH * VRAM_HEIGHT);
+
+    machine->executed = 0;
+    machine->in       = in;
+    machine->out      = out;
+
+    return VM_ERR_NONE;
+}
+
+void dtor(Machine* machine)
+{
+    utils_assert(machine);
+
+    NFREE(machine->code);
+    NFREE(machine->memory);
+    NFREE(machine->stack);
+    NFREE(machine->calls);
+
+    machine->code_size = 0;
+}
+
+VmErr load(Machine* machine, const uint8_t* image, size_t size)
+{
+    utils_assert(machine);
+    utils_assert(image);
+
+    if(size < bytecode::HEADER_SIZE
+       || memcmp(image, bytecode::MAGIC, sizeof(bytecode::MAGIC) - 1) != 0
+       || get_u32_(image + 4) != bytecode::VERSION
+       || get_u32_(image + 8) != size - bytecode::HEADER_SIZE)
+        return VM_ERR_BAD_IMAGE;
+
+    const uint8_t* bytes = image + bytecode::HEADER_SIZE;
+    size_t bytes_cnt = size - bytecode::HEADER_SIZE;
+
+    // first pass maps byte offsets of instructions to their indices
+    size_t* index_of = TYPED_CALLOC(bytes_cnt + 1, size_t);
+    if(!index_of)
+        return VM_ERR_ALLOC_FAIL;
+
+    for(size_t i = 0; i <= bytes_cnt; ++i)
+        index_of[i] = NO_INDEX;
+
+    VmErr  err = VM_ERR_NONE;
+    size_t instr_cnt = 0;
+
+    for(size_t pos = 0; pos < bytes_cnt; ) {
+        Format format = FORMAT_NONE;
+        if(!format_(bytes[pos], &format) || pos + 1 + format_size_(format) > bytes_cnt) {
+            err = VM_ERR_BAD_IMAGE;
+            break;
+        }
+
+        index_of[pos] = instr_cnt++;
+        pos += 1 + format_size_(format);
+    }
+
+    // label at the very end refers to implicit HLT after the last instruction
+    if(err == VM_ERR_NONE)
+        index_of[bytes_cnt] = instr_cnt;
+
+    Instr* code = NULL;
+    if(err == VM_ERR_NONE) {
+        code = TYPED_CALLOC(instr_cnt + 1, Instr);
+        if(!code)
+            err = VM_ERR_ALLOC_FAIL;
+    }
+
+    // second pass decodes, branch targets become indices
+    for(size_t pos = 0, ind = 0; err == VM_ERR_NONE && pos < bytes_cnt; ++ind) {
+        Instr* instr = &code[ind];
+
+        uint8_t opcode = bytes[pos++];
+        instr->opcode = opcode;
+
+        Format format = FORMAT_NONE;
+        format_(opcode, &format);
+
+        uint32_t target = 0;
+
+        switch(format) {
+            case FORMAT_IMM:
+                instr->arg = (int32_t) get_u32_(bytes + pos);
+                break;
+
+            case FORMAT_REG:
+                instr->reg = bytes[pos];
+                break;
+
+            case FORMAT_MEM:
+                instr->reg = bytes[pos];
+                instr->arg = (int32_t) get_u32_(bytes + pos + 1);
+                break;
+
+            case FORMAT_MEM2:
+                instr->reg  = bytes[pos];
+                instr->arg  = (int32_t) get_u32_(bytes + pos + 1);
+                instr->reg2 = bytes[pos + 5];
+                instr->arg2 = (int32_t) get_u32_(bytes + pos + 6);
+                break;
+
+            case FORMAT_TARGET:
+                target = get_u32_(bytes + pos);
+                break;
+
+            case FORMAT_IMM_TARGET:
+                instr->arg2 = (int32_t) get_u32_(bytes + pos);
+                target = get_u32_(bytes + pos + 4);
+                break;
+
+            case FORMAT_NONE:
+            default:
+                break;
+        }
+
+        pos += format_size_(format);
+
+        bool has_reg = format == FORMAT_REG || format == FORMAT_MEM || format == FORMAT_MEM2;
+        if(has_reg && !is_register_(instr->reg))
+            err = VM_ERR_BAD_IMAGE;
+
+        if(format == FORMAT_MEM2 && !is_register_(instr->reg2))
+            err = VM_ERR_BAD_IMAGE;
+
+        // op_divi does not check divisor, 0 and -1 must come as DIV
+        if(opcode == bytecode::OPCODE_DIVI && (instr->arg == 0 || instr->arg == -1))
+            err = VM_ERR_BAD_IMAGE;
+
+        if(format == FORMAT_TARGET || format == FORMAT_IMM_TARGET) {
+            if(target > bytes_cnt || index_of[target] == NO_INDEX)
+                err = VM_ERR_BAD_IMAGE;
+            else
+                instr->arg = (int32_t) index_of[target];
+        }
+    }
+
+    NFREE(index_of);
+
+    if(err != VM_ERR_NONE) {
+        NFREE(code);
+        return err;
+    }
+
+    NFREE(machine->code);
+    machine->code      = code;
+    machine->code_size = instr_cnt;
+
+    UTILS_LOGD(LOG_VM, "loaded %lu instructions from %lu bytes", instr_cnt, bytes_cnt);
+
+    return VM_ERR_NONE;
+}
+
+VmErr run(Machine* machine)
+{
+    utils_assert(machine);
+    utils_assert(machine->code);
+
+    Instr*   code   = machine->code;
+    int32_t* memory = machine->memory;
+    int32_t* regs   = machine->regs;
+
+    int32_t* top       = machine->stack;
+    int32_t* stack_end = machine->stack + STACK_SIZE;
+
+    Instr**  call      = machine->calls;
+    Instr**  calls_end = machine->calls + CALL_DEPTH;
+
+    Instr*   ip  = code;
+    Instr*   cur = NULL;
+    size_t   executed = 0;
+    VmErr    err = VM_ERR_NONE;
+
+    uint32_t a    = 0;
+    uint32_t b    = 0;
+    int64_t  addr = 0;
+    int      val  = 0;
+
+    // handler addresses are only known here, so they are bound on every run
+    for(size_t i = 0; i < machine->code_size; ++i) {
+        Instr* instr = &code[i];
+
+        switch(instr->opcode) {
+            case bytecode::OPCODE_HLT:   instr->handler = &&op_hlt;   break;
+            case bytecode::OPCODE_PUSH:  instr->handler = &&op_push;  break;
+            case bytecode::OPCODE_PUSHR: instr->handler = &&op_pushr; break;
+            case bytecode::OPCODE_POPR:  instr->handler = &&op_popr;  break;
+            case bytecode::OPCODE_PUSHM: instr->handler = &&op_pushm; break;
+            case bytecode::OPCODE_POPM:  instr->handler = &&op_popm;  break;
+            case bytecode::OPCODE_ADD:   instr->handler = &&op_add;   break;
+            case bytecode::OPCODE_SUB:   instr->handler = &&op_sub;   break;
+            case bytecode::OPCODE_MUL:   instr->handler = &&op_mul;   break;
+            case bytecode::OPCODE_DIV:   instr->handler = &&op_div;   break;
+            case bytecode::OPCODE_POW:   instr->handler = &&op_pow;   break;
+            case bytecode::OPCODE_SQR:   instr->handler = &&op_sqr;   break;
+            case bytecode::OPCODE_IN:    instr->handler = &&op_in;    break;
+            case bytecode::OPCODE_OUT:   instr->handler = &&op_out;   break;
+            case bytecode::OPCODE_DRAW:  instr->handler = &&op_draw;  break;
+            case bytecode::OPCODE_CALL:  instr->handler = &&op_call;  break;
+            case bytecode::OPCODE_RET:   instr->handler = &&op_ret;   break;
+            case bytecode::OPCODE_JMP:   instr->handler = &&op_jmp;   break;
+            case bytecode::OPCODE_JE:    instr->handler = &&op_je;    break;
+            case bytecode::OPCODE_JNE:   instr->handler = &&op_jne;   break;
+            case bytecode::OPCODE_JA:    instr->handler = &&op_ja;    break;
+            case bytecode::OPCODE_JB:    instr->handler = &&op_jb;    break;
+            case bytecode::OPCODE_JAE:   instr->handler = &&op_jae;   break;
+            case bytecode::OPCODE_JBE:   instr->handler = &&op_jbe;   break;
+
+            case bytecode::OPCODE_ADDSP:  instr->handler = &&op_addsp;  break;
+            case bytecode::OPCODE_PUSHM2: instr->handler = &&op_pushm2; break;
+            case bytecode::OPCODE_ADDI:   instr->handler = &&op_addi;   break;
+            case bytecode::OPCODE_SUBI:   instr->handler = &&op_subi;   break;
+            case bytecode::OPCODE_MULI:   instr->handler = &&op_muli;   break;
+            case bytecode::OPCODE_DIVI:   instr->handler = &&op_divi;   break;
+            case bytecode::OPCODE_JEI:    instr->handler = &&op_jei;    break;
+            case bytecode::OPCODE_JNEI:   instr->handler = &&op_jnei;   break;
+            case bytecode::OPCODE_JAI:    instr->handler = &&op_jai;    break;
+            case bytecode::OPCODE_JBI:    instr->handler = &&op_jbi;    break;
+            case bytecode::OPCODE_JAEI:   instr->handler = &&op_jaei;   break;
+            case bytecode::OPCODE_JBEI:   instr->handler = &&op_jbei;   break;
+            default:
+                utils_assert(0 && "opcode was not validated by load");
+                break;
+        }
+    }
+
+    // instruction after the last one is HLT
+    code[machine->code_size].handler = &&op_hlt;
+
+#define DISPATCH()                  \
+    do {                            \
+        cur = ip++;                 \
+        executed++;                 \
+        goto *cur->handler;         \
+    } while(0)
+
+#define FAIL(error)                 \
+    do {                            \
+        err = (error);              \
+        goto fail;                  \
+    } while(0)
+
+#define NEED_PUSH()                 \
+    if(top == stack_end)            \
+        FAIL(VM_ERR_STACK_OVERFLOW)
+
+#define NEED_POP(cnt)                               \
+    if(top - machine->stack < (cnt))                \
+        FAIL(VM_ERR_STACK_UNDERFLOW)
+
+#define ADDRESS()                                   \
+    addr = (int64_t) regs[cur->reg] + cur->arg;     \
+    if((uint64_t) addr >= MEMORY_SIZE)              \
+        FAIL(VM_ERR_BAD_ADDRESS)
+
+// arithmetic wraps around, operands are taken as unsigned
+#define BINARY(expr)                                \
+    NEED_POP(2);                                    \
+    b = (uint32_t) *--top;                          \
+    a = (uint32_t) top[-1];                         \
+    top[-1] = (int32_t) (expr);                     \
+    DISPATCH()
+
+#define BRANCH(cmp)                                 \
+    NEED_POP(2);                                    \
+    top -= 2;                                       \
+    if(top[0] cmp top[1])                           \
+        ip = code + cur->arg;                       \
+    DISPATCH()
+
+#define BINARY_IMM(expr)                            \
+    NEED_POP(1);                                    \
+    b = (uint32_t) cur->arg;                        \
+    a = (uint32_t) top[-1];                         \
+    top[-1] = (int32_t) (expr);                     \
+    DISPATCH()
+
+#define BRANCH_IMM(cmp)                             \
+    NEED_POP(1);                                    \
+    top--;                                          \
+    if(top[0] cmp cur->arg2)                        \
+        ip = code + cur->arg;                       \
+    DISPATCH()
+
+    DISPATCH();
+
+op_push:
+    NEED_PUSH();
+    *top++ = cur->arg;
+    DISPATCH();
+
+op_pushr:
+    NEED_PUSH();
+    *top++ = regs[cur->reg];
+    DISPATCH();
+
+op_popr:
+    NEED_POP(1);
+    regs[cur->reg] = *--top;
+    DISPATCH();
+
+op_pushm:
+    NEED_PUSH();
+    ADDRESS();
+    *top++ = memory[addr];
+    DISPATCH();
+
+op_popm:
+    NEED_POP(1);
+    ADDRESS();
+    memory[addr] = *--top;
+    DISPATCH();
+
+op_add: BINARY(a + b);
+op_sub: BINARY(a - b);
+op_mul: BINARY(a * b);
+
+op_div:
+    NEED_POP(2);
+    if(top[-1] == 0)
+        FAIL(VM_ERR_DIV_BY_ZERO);
+    // INT_MIN / -1 wraps instead of trapping
+    if(top[-1] == -1) {
+        top--;
+        top[-1] = (int32_t) (0u - (uint32_t) top[-1]);
+        DISPATCH();
+    }
+    top--;
+    top[-1] = top[-1] / top[0];
+    DISPATCH();
+
+// same rounding as constant folding in middlend
+op_pow:
+    NEED_POP(2);
+    top--;
+    top[-1] = (int32_t) pown(top[-1], top[0]);
+    DISPATCH();
+
+op_sqr:
+    NEED_POP(1);
+    top[-1] = top[-1] > 0 ? (int32_t) sqrt(top[-1]) : 0;
+    DISPATCH();
+
+op_in:
+    NEED_PUSH();
+    if(fscanf(machine->in, "%d", &val) != 1)
+        FAIL(VM_ERR_INPUT);
+    *top++ = val;
+    DISPATCH();
+
+op_out:
+    NEED_POP(1);
+    fprintf(machine->out, "%d\n", *--top);
+    DISPATCH();
+
+op_draw:
+    draw(memory, machine->out);
+    DISPATCH();
+
+op_call:
+    if(call == calls_end)
+        FAIL(VM_ERR_CALL_OVERFLOW);
+    *call++ = ip;
+    ip = code + cur->arg;
+    DISPATCH();
+
+op_ret:
+    if(call == machine->calls)
+        FAIL(VM_ERR_STACK_UNDERFLOW);
+    ip = *--call;
+    DISPATCH();
+
+op_jmp:
+    ip = code + cur->arg;
+    DISPATCH();
+
+op_je:  BRANCH(==);
+op_jne: BRANCH(!=);
+op_ja:  BRANCH(>);
+op_jb:  BRANCH(<);
+op_jae: BRANCH(>=);
+op_jbe: BRANCH(<=);
+
+op_addsp:
+    regs[instr::REGISTER_SP] = (int32_t) ((uint32_t) regs[instr::REGISTER_SP] + (uint32_t) cur->arg);
+    DISPATCH();
+
+op_pushm2:
+    if(stack_end - top < 2)
+        FAIL(VM_ERR_STACK_OVERFLOW);
+    ADDRESS();
+    *top++ = memory[addr];
+    addr = (int64_t) regs[cur->reg2] + cur->arg2;
+    if((uint64_t) addr >= MEMORY_SIZE)
+        FAIL(VM_ERR_BAD_ADDRESS);
+    *top++ = memory[addr];
+    DISPATCH();
+
+op_addi: BINARY_IMM(a + b);
+op_subi: BINARY_IMM(a - b);
+op_muli: BINARY_IMM(a * b);
+
+// divisor is never 0 or -1, those stay DIV
+op_divi:
+    NEED_POP(1);
+    top[-1] = top[-1] / cur->arg;
+    DISPATCH();
+
+op_jei:  BRANCH_IMM(==);
+op_jnei: BRANCH_IMM(!=);
+op_jai:  BRANCH_IMM(>);
+op_jbi:  BRANCH_IMM(<);
+op_jaei: BRANCH_IMM(>=);
+op_jbei: BRANCH_IMM(<=);
+
+fail:
+    UTILS_LOGE(LOG_VM, "%s at instruction %ld", strerr(err), cur - code);
+
+op_hlt:
+    machine->executed += executed;
+
+    return err;
+
+#undef DISPATCH
+#undef FAIL
+#undef NEED_PUSH
+#undef NEED_POP
+#undef ADDRESS
+#undef BINARY
+#undef BRANCH
+#undef BINARY_IMM
+#undef BRANCH_IMM
+}
+
+void draw(const int32_t* memory, FILE* out)
+{
+    utils_assert(memory);
+    utils_assert(out);
+
+    const int32_t* vram = memory + VRAM_BASE;
+
+    bool empty = true;
+    for(size_t i = 0; i < VRAM_WIDTH * VRAM_HEIGHT && empty; ++i)
+        empty = vram[i] == 0;
+
+    if(empty)
+        return;
+
+    for(size_t y = 0; y < VRAM_HEIGHT; ++y) {
+        for(size_t x = 0; x < VRAM_WIDTH; ++x) {
+            int32_t cell = vram[y * VRAM_WIDTH + x];
+            fputc(cell ? (char) cell : '.', out);
+        }
+        fputc('\n', out);
+    }
+}
+
+const char* strerr(VmErr err)
+{
+    switch(err) {
+        case VM_ERR_NONE:            return "none";
+        case VM_ERR_ALLOC_FAIL:      return "memory allocation failed";
+        case VM_ERR_BAD_IMAGE:       return "malformed bytecode image";
+        case VM_ERR_BAD_ADDRESS:     return "memory access out of bounds";
+        case VM_ERR_STACK_OVERFLOW:  return "stack overflow";
+        case VM_ERR_STACK_UNDERFLOW: return "stack underflow";
+        case VM_ERR_CALL_OVERFLOW:   return "call depth exceeded";
+        case VM_ERR_DIV_BY_ZERO:     return "division by zero";
+        case VM_ERR_INPUT:           return "failed to read input";
+        default:                     return "unknown";
+    }
+}
+
+static bool format_(uint8_t opcode, Format* format)
+{
+    switch(opcode) {
+        case bytecode::OPCODE_HLT:
+        case bytecode::OPCODE_ADD:
+        case bytecode::OPCODE_SUB:
+        case bytecode::OPCODE_MUL:
+        case bytecode::OPCODE_DIV:
+        case bytecode::OPCODE_POW:
+        case bytecode::OPCODE_SQR:
+        case bytecode::OPCODE_IN:
+        case bytecode::OPCODE_OUT:
+        case bytecode::OPCODE_DRAW:
+        case bytecode::OPCODE_RET:
+            *format = FORMAT_NONE;
+            return true;
+
+        case bytecode::OPCODE_PUSH:
+        case bytecode::OPCODE_ADDSP:
+        case bytecode::OPCODE_ADDI:
+        case bytecode::OPCODE_SUBI:
+        case bytecode::OPCODE_MULI:
+        case bytecode::OPCODE_DIVI:
+            *format = FORMAT_IMM;
+            return true;
+
+        case bytecode::OPCODE_PUSHR:
+        case bytecode::OPCODE_POPR:
+            *format = FORMAT_REG;
+            return true;
+
+        case bytecode::OPCODE_PUSHM:
+        case bytecode::OPCODE_POPM:
+            *format = FORMAT_MEM;
+            return true;
+
+        case bytecode::OPCODE_PUSHM2:
+            *format = FORMAT_MEM2;
+            return true;
+
+        case bytecode::OPCODE_CALL:
+        case bytecode::OPCODE_JMP:
+        case bytecode::OPCODE_JE:
+        case bytecode::OPCODE_JNE:
+        case bytecode::OPCODE_JA:
+        case bytecode::OPCODE_JB:
+        case bytecode::OPCODE_JAE:
+        case bytecode::OPCODE_JBE:
+            *format = FORMAT_TARGET;
+            return true;
+
+        case bytecode::OPCODE_JEI:
+        case bytecode::OPCODE_JNEI:
+        case bytecode::OPCODE_JAI:
+        case bytecode::OPCODE_JBI:
+        case bytecode::OPCODE_JAEI:
+        case bytecode::OPCODE_JBEI:
+            *format = FORMAT_IMM_TARGET;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static size_t format_size_(Format format)
+{
+    switch(format) {
+        case FORMAT_IMM:        return 4;
+        case FORMAT_REG:        return 1;
+        case FORMAT_MEM:        return 5;
+        case FORMAT_MEM2:       return 10;
+        case FORMAT_TARGET:     return 4;
+        case FORMAT_IMM_TARGET: return 8;
+        case FORMAT_NONE:
+        default:                return 0;
+    }
+}
+
+static bool is_register_(uint8_t reg)
+{
+    return reg == instr::REGISTER_SP || reg == instr::REGISTER_A0 || reg == instr::REGISTER_T0;
+}
+
+static uint32_t get_u32_(const uint8_t* pos)
+{
+    return (uint32_t) pos[0]
+           | (uint32_t) pos[1] << 8
+           | (uint32_t) pos[2] << 16
+           | (uint32_t) pos[3] << 24;
+}
+
+} // vm
+} // compiler
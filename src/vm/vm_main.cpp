@@ -0,0 +1,164 @@
+#include <cstdlib>
+#include <error.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "instr.h"
+#include "ioutils.h"
+#include "memutils.h"
+#include "optutils.h"
+#include "utils.h"
+#include "logutils.h"
+#include "regcode.h"
+#include "regvm.h"
+#include "vm.h"
+
+ATTR_UNUSED static const char* LOG_OPT = "OPTIONS";
+ATTR_UNUSED static const char* LOG_APP = "APP";
+
+static utils_long_opt_t long_opts[] =
+{
+    { OPT_ARG_REQUIRED, "log",    NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "in" ,    NULL, 0, 0 },
+};
+
+static compiler::vm::VmErr run_stack_(uint8_t* image, size_t size, double* ms, int32_t* ret, size_t* executed);
+
+static compiler::vm::VmErr run_register_(uint8_t* image, size_t size, double* ms, int32_t* ret, size_t* executed);
+
+static double elapsed_ms_(struct timespec* begin, struct timespec* end);
+
+int main(int argc, char* argv[])
+{
+    if(!utils_long_opt_get(argc, argv, long_opts, SIZEOF(long_opts)))
+        return EXIT_FAILURE;
+
+    utils_init_log_file(long_opts[0].arg, LOG_DIR);
+
+    using namespace compiler;
+
+    vm::VmErr err = vm::VM_ERR_NONE;
+
+    uint8_t* image = NULL;
+
+    bool err_occured = false;
+
+    BEGIN {
+
+        FILE* file_bc = open_file(long_opts[1].arg, "rb");
+        if(!file_bc) {
+            err_occured = true;
+            GOTO_END;
+        }
+
+        size_t fsize = get_file_size(file_bc);
+
+        image = TYPED_CALLOC(fsize, uint8_t);
+        size_t bytes_transferred = image ? fread(image, 1, fsize, file_bc) : 0;
+
+        fclose(file_bc);
+
+        if(!image) {
+            err_occured = true;
+            UTILS_LOGE(LOG_APP, "failed to read %s", long_opts[1].arg);
+            GOTO_END;
+        }
+
+        double  ms       = 0;
+        int32_t ret      = 0;
+        size_t  executed = 0;
+
+        // image kind is told by its magic
+        bool is_register = bytes_transferred >= regcode::HEADER_SIZE
+                           && !memcmp(image, regcode::MAGIC, sizeof(regcode::MAGIC) - 1);
+
+        if(is_register)
+            err = run_register_(image, bytes_transferred, &ms, &ret, &executed);
+        else
+            err = run_stack_(image, bytes_transferred, &ms, &ret, &executed);
+
+        fflush(stdout);
+
+        if(executed)
+            fprintf(stderr, "executed %lu instructions in %.3f ms, returned %d\n", executed, ms, ret);
+
+        if(err != vm::VM_ERR_NONE) {
+            err_occured = true;
+            UTILS_LOGE(LOG_APP, "%s, exit...", vm::strerr(err));
+        }
+
+    } END;
+
+    NFREE(image);
+
+    utils_end_log();
+
+    return err_occured ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static compiler::vm::VmErr run_stack_(uint8_t* image, size_t size, double* ms, int32_t* ret, size_t* executed)
+{
+    using namespace compiler;
+
+    vm::Machine machine = MACHINE_INITLIST;
+
+    vm::VmErr err = vm::ctor(&machine, stdin, stdout);
+    if(err == vm::VM_ERR_NONE)
+        err = vm::load(&machine, image, size);
+
+    if(err == vm::VM_ERR_NONE) {
+        struct timespec begin = {};
+        struct timespec end   = {};
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        err = vm::run(&machine);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        *ms       = elapsed_ms_(&begin, &end);
+        *ret      = machine.regs[instr::REGISTER_A0];
+        *executed = machine.executed;
+    }
+
+    vm::dtor(&machine);
+
+    return err;
+}
+
+static compiler::vm::VmErr run_register_(uint8_t* image, size_t size, double* ms, int32_t* ret, size_t* executed)
+{
+    using namespace compiler;
+
+    regvm::Machine machine = REG_MACHINE_INITLIST;
+
+    vm::VmErr err = regvm::ctor(&machine, stdin, stdout);
+    if(err == vm::VM_ERR_NONE)
+        err = regvm::load(&machine, image, size);
+
+    if(err == vm::VM_ERR_NONE) {
+        struct timespec begin = {};
+        struct timespec end   = {};
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        err = regvm::run(&machine);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        *ms       = elapsed_ms_(&begin, &end);
+        *ret      = machine.ret;
+        *executed = machine.executed;
+    }
+
+    regvm::dtor(&machine);
+
+    return err;
+}
+
+static double elapsed_ms_(struct timespec* begin, struct timespec* end)
+{
+    const double ms_in_s  = 1e3;
+    const double ns_in_ms = 1e6;
+
+    return (double) (end->tv_sec - begin->tv_sec) * ms_in_s
+           + (double) (end->tv_nsec - begin->tv_nsec) / ns_in_ms;
+}